@@ -1,74 +1,630 @@
 //two helper functions work together to find out whether operations are balanced in a given string
+#include <cstdint>
+#include <fstream>
 #include <iostream>    // for cout, endl
 #include <string>      // for string class
+#include <string_view>
+#include <thread>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "balanced.h"
 #include "recursion.h"
+#include "error.h"
+#include "filelib.h"
+#include "random.h"
 #include "testing/SimpleTest.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BALANCED_SIMD
+#include <immintrin.h>
+#endif
 using namespace std;
 
+//this function returns whether c is one of the six bracketing operators
+bool isOperator(char c) {
+    return c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+//this function returns the opening bracket that closes with c, or '\0' if c does not close one
+char openerOf(char c) {
+    switch (c) {
+        case ')': return '(';
+        case ']': return '[';
+        case '}': return '{';
+        default: return '\0';
+    }
+}
+
+//the six bracketing operators
+const string_view BRACKET_CHARS = "()[]{}";
+
+//chars classified per call of bracketMasks when walking the brackets of a string, so the masks
+//fit in a small array on the stack
+const int MASK_BATCH_SIZE = 4096;
+
+//this function returns the mask of the brackets among the length chars at block, length <= 64
+uint64_t bracketMaskScalar(const char* block, size_t length) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (isOperator(block[i])) {
+            mask |= uint64_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+void bracketMasksScalar(string_view s, uint64_t* masks) {
+    for (size_t block = 0; block < s.length(); block += 64) {
+        masks[block / 64] = bracketMaskScalar(s.data() + block, min<size_t>(64, s.length() - block));
+    }
+}
+
+//this function returns the mask of the chars among the length chars at block that are in chars,
+//length <= 64
+uint64_t charMaskScalar(const char* block, size_t length, string_view chars) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (chars.find(block[i]) != string_view::npos) {
+            mask |= uint64_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef BALANCED_SIMD
+//the vector kernels compare every byte of a register against each of the chars and OR the
+//results, and the sign bits of the matching bytes are then gathered into the mask. only whole
+//64-byte blocks are done with vectors; the last part block is done a byte at a time
+__attribute__((target("sse2")))
+void charMasksSse2(string_view s, string_view chars, uint64_t* masks) {
+    size_t wholeBlocks = s.length() / 64;
+    for (size_t block = 0; block < wholeBlocks; block++) {
+        uint64_t mask = 0;
+        for (int part = 0; part < 4; part++) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (s.data() + 64 * block + 16 * part));
+            __m128i hits = _mm_setzero_si128();
+            for (char c : chars) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+            }
+            mask |= uint64_t(uint16_t(_mm_movemask_epi8(hits))) << (16 * part);
+        }
+        masks[block] = mask;
+    }
+    if (s.length() % 64 != 0) {
+        masks[wholeBlocks] = charMaskScalar(s.data() + 64 * wholeBlocks, s.length() % 64, chars);
+    }
+}
+
+__attribute__((target("avx2")))
+void charMasksAvx2(string_view s, string_view chars, uint64_t* masks) {
+    size_t wholeBlocks = s.length() / 64;
+    for (size_t block = 0; block < wholeBlocks; block++) {
+        uint64_t mask = 0;
+        for (int part = 0; part < 2; part++) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*) (s.data() + 64 * block + 32 * part));
+            __m256i hits = _mm256_setzero_si256();
+            for (char c : chars) {
+                hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)));
+            }
+            mask |= uint64_t(uint32_t(_mm256_movemask_epi8(hits))) << (32 * part);
+        }
+        masks[block] = mask;
+    }
+    if (s.length() % 64 != 0) {
+        masks[wholeBlocks] = charMaskScalar(s.data() + 64 * wholeBlocks, s.length() % 64, chars);
+    }
+}
+
+__attribute__((target("avx512bw")))
+void charMasksAvx512(string_view s, string_view chars, uint64_t* masks) {
+    size_t wholeBlocks = s.length() / 64;
+    for (size_t block = 0; block < wholeBlocks; block++) {
+        __m512i bytes = _mm512_loadu_si512((const void*) (s.data() + 64 * block));
+        uint64_t mask = 0;
+        for (char c : chars) {
+            mask |= _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(c));
+        }
+        masks[block] = mask;
+    }
+    if (s.length() % 64 != 0) {
+        masks[wholeBlocks] = charMaskScalar(s.data() + 64 * wholeBlocks, s.length() % 64, chars);
+    }
+}
+#endif
+
+//this function sets the bit of each char of s that is in chars, like bracketMasks does for the
+//brackets, using the widest vector kernel the processor running it has
+void charMasks(string_view s, string_view chars, uint64_t* masks) {
+#ifdef BALANCED_SIMD
+    if (__builtin_cpu_supports("avx512bw")) {
+        charMasksAvx512(s, chars, masks);
+        return;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        charMasksAvx2(s, chars, masks);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        charMasksSse2(s, chars, masks);
+        return;
+    }
+#endif
+    for (size_t block = 0; block < s.length(); block += 64) {
+        masks[block / 64] = charMaskScalar(s.data() + block, min<size_t>(64, s.length() - block), chars);
+    }
+}
+
+void bracketMasks(string_view s, uint64_t* masks) {
+    charMasks(s, BRACKET_CHARS, masks);
+}
+
+//this function calls visit(i, s[i]) on each char of s that is in chars, in order, until visit
+//returns false. the masks are found a batch at a time, and the lowest set bit of each mask is
+//the next char, so the chars in between are never looked at one by one
+template <typename Visitor>
+void forEachChar(string_view s, string_view chars, Visitor visit) {
+    uint64_t masks[MASK_BATCH_SIZE / 64];
+    for (size_t batch = 0; batch < s.length(); batch += MASK_BATCH_SIZE) {
+        string_view part = s.substr(batch, MASK_BATCH_SIZE);
+        charMasks(part, chars, masks);
+        for (size_t block = 0; 64 * block < part.length(); block++) {
+            for (uint64_t mask = masks[block]; mask != 0; mask &= mask - 1) {
+                size_t i = batch + 64 * block + __builtin_ctzll(mask);
+                if (!visit(i, s[i])) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+//this function copies the chars of block whose bits are set in mask to out, in order, and
+//returns how many it copied
+size_t compactBlockScalar(const char* block, uint64_t mask, char* out) {
+    size_t count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        out[count++] = block[__builtin_ctzll(mask)];
+    }
+    return count;
+}
+
+#ifdef BALANCED_SIMD
+//this function packs the marked chars of each whole block with one compress instruction. it
+//always stores 64 bytes, so out needs 64 bytes of room past the chars it keeps
+__attribute__((target("avx512bw,avx512vbmi2")))
+size_t compactBracketsVbmi2(string_view s, const uint64_t* masks, char* out) {
+    size_t count = 0;
+    size_t wholeBlocks = s.length() / 64;
+    for (size_t block = 0; block < wholeBlocks; block++) {
+        __m512i chars = _mm512_loadu_si512((const void*) (s.data() + 64 * block));
+        _mm512_storeu_si512((void*) (out + count), _mm512_maskz_compress_epi8(masks[block], chars));
+        count += __builtin_popcountll(masks[block]);
+    }
+    if (s.length() % 64 != 0) {
+        count += compactBlockScalar(s.data() + 64 * wholeBlocks, masks[wholeBlocks], out + count);
+    }
+    return count;
+}
+#endif
+
+//this function copies the chars of s marked in masks to out and returns how many it copied.
+//out must have room for s.length() + 64 chars
+size_t compactBrackets(string_view s, const uint64_t* masks, char* out) {
+#ifdef BALANCED_SIMD
+    if (__builtin_cpu_supports("avx512vbmi2")) {
+        return compactBracketsVbmi2(s, masks, out);
+    }
+#endif
+    size_t count = 0;
+    for (size_t block = 0; 64 * block < s.length(); block++) {
+        count += compactBlockScalar(s.data() + 64 * block, masks[block], out + count);
+    }
+    return count;
+}
+
 //this function takes in a string and returns the string without any non-operator characters
-//operators are defined as (), {}, or []
+//operators are defined as (), {}, or []. the brackets are found a batch of masks at a time and
+//packed out of each batch onto the end of the result
 string operatorsOnly(string s) {
-    string brackets = "()[]{}";
-    if (s == ""){
-        return "";
+    string ops;
+    uint64_t masks[MASK_BATCH_SIZE / 64];
+    char packed[MASK_BATCH_SIZE + 64];
+    for (size_t batch = 0; batch < s.length(); batch += MASK_BATCH_SIZE) {
+        string_view part = string_view(s).substr(batch, MASK_BATCH_SIZE);
+        bracketMasks(part, masks);
+        ops.append(packed, compactBrackets(part, masks, packed));
+    }
+    return ops;
+}
+
+//chars read from a stream per push
+const int STREAM_BUFFER_SIZE = 1 << 20;
+
+//the states of a BracketLexer. each quote has STRING_STATE_COUNT states of its own, numbered from
+//FIRST_STRING_STATE on in the order of StringState
+enum LexerState { IN_CODE, AFTER_COMMENT_CHAR, IN_LINE_COMMENT, IN_BLOCK_COMMENT, AFTER_BLOCK_END_CHAR,
+                  FIRST_STRING_STATE };
+enum StringState { STRING_START, IN_STRING, AFTER_ESCAPE, AFTER_EMPTY_STRING, IN_TRIPLE, AFTER_ONE_QUOTE,
+                   AFTER_TWO_QUOTES, AFTER_TRIPLE_ESCAPE, STRING_STATE_COUNT };
+
+//the most quotes a BracketSyntax can have, so every state and COUNTS_BRACKET fit in a byte
+const int MAX_QUOTES = 4;
+
+//stands for any char that is not special when building a lexer's table
+const int OTHER_CHAR = 256;
+
+//this function returns whether c, a byte or OTHER_CHAR, is the delimiter char d. '\0' is never a
+//delimiter
+bool isDelimiter(int c, char d) {
+    return d != '\0' && c == (unsigned char) d;
+}
+
+//this function returns char i of a delimiter, or '\0' if the delimiter is shorter than that
+char delimiterChar(const string& delimiter, size_t i) {
+    return i < delimiter.length() ? delimiter[i] : '\0';
+}
+
+//this function returns the step from code on c: into a string or comment, or staying in code
+//and counting c if it is a bracket
+uint8_t codeStep(const BracketSyntax& syntax, int c) {
+    for (size_t k = 0; k < syntax.quotes.length(); k++) {
+        if (isDelimiter(c, syntax.quotes[k])) {
+            return FIRST_STRING_STATE + STRING_STATE_COUNT * k + (syntax.tripleQuotes ? STRING_START : IN_STRING);
+        }
+    }
+    if (syntax.lineComment.length() == 1 && isDelimiter(c, syntax.lineComment[0])) {
+        return IN_LINE_COMMENT;
+    }
+    if ((syntax.lineComment.length() == 2 && isDelimiter(c, syntax.lineComment[0]))
+            || (syntax.blockStart.length() == 2 && isDelimiter(c, syntax.blockStart[0]))) {
+        return AFTER_COMMENT_CHAR;
+    }
+    return IN_CODE | (c < OTHER_CHAR && isOperator(c) ? BracketLexer::COUNTS_BRACKET : 0);
+}
+
+//this function returns the step from state on c. a state that only lasts one char, like the one
+//after the first char of a comment delimiter or after an escape, goes back to where it came from
+//on any char it was not waiting for
+uint8_t lexerStep(const BracketSyntax& syntax, int state, int c) {
+    switch (state) {
+        case IN_CODE:
+            return codeStep(syntax, c);
+        case AFTER_COMMENT_CHAR:
+            if (syntax.lineComment.length() == 2 && isDelimiter(c, syntax.lineComment[1])) {
+                return IN_LINE_COMMENT;
+            }
+            if (syntax.blockStart.length() == 2 && isDelimiter(c, syntax.blockStart[1])) {
+                return IN_BLOCK_COMMENT;
+            }
+            return codeStep(syntax, c);
+        case IN_LINE_COMMENT:
+            return isDelimiter(c, '\n') ? IN_CODE : IN_LINE_COMMENT;
+        case IN_BLOCK_COMMENT:
+            return isDelimiter(c, delimiterChar(syntax.blockEnd, 0)) ? AFTER_BLOCK_END_CHAR : IN_BLOCK_COMMENT;
+        case AFTER_BLOCK_END_CHAR:
+            if (isDelimiter(c, delimiterChar(syntax.blockEnd, 1))) {
+                return IN_CODE;
+            }
+            return isDelimiter(c, delimiterChar(syntax.blockEnd, 0)) ? AFTER_BLOCK_END_CHAR : IN_BLOCK_COMMENT;
+    }
+
+    int quote = (state - FIRST_STRING_STATE) / STRING_STATE_COUNT;
+    int base = FIRST_STRING_STATE + STRING_STATE_COUNT * quote;
+    bool isQuote = isDelimiter(c, syntax.quotes[quote]);
+    bool isEscape = isDelimiter(c, syntax.escape);
+    switch ((state - FIRST_STRING_STATE) % STRING_STATE_COUNT) {
+        case STRING_START:
+            return base + (isQuote ? AFTER_EMPTY_STRING : isEscape ? AFTER_ESCAPE : IN_STRING);
+        case IN_STRING:
+            return isQuote ? IN_CODE : base + (isEscape ? AFTER_ESCAPE : IN_STRING);
+        case AFTER_ESCAPE:
+            return base + IN_STRING;
+        case AFTER_EMPTY_STRING:
+            return isQuote ? base + IN_TRIPLE : codeStep(syntax, c);
+        case IN_TRIPLE:
+            return base + (isQuote ? AFTER_ONE_QUOTE : isEscape ? AFTER_TRIPLE_ESCAPE : IN_TRIPLE);
+        case AFTER_ONE_QUOTE:
+            return base + (isQuote ? AFTER_TWO_QUOTES : isEscape ? AFTER_TRIPLE_ESCAPE : IN_TRIPLE);
+        case AFTER_TWO_QUOTES:
+            return isQuote ? IN_CODE : base + (isEscape ? AFTER_TRIPLE_ESCAPE : IN_TRIPLE);
+        default:
+            return base + IN_TRIPLE;
+    }
+}
+
+//this constructor fills in the row of every state by stepping on every byte, and the step on a
+//char that is not special for afterOthers. a non-special char matches no delimiter, so every
+//one of them steps the same way, and each such step lands in a state that stays put on more
+BracketLexer::BracketLexer(const BracketSyntax& syntax) {
+    if (syntax.quotes.length() > MAX_QUOTES) {
+        error("A bracket syntax can have at most " + to_string(MAX_QUOTES) + " quotes");
+    }
+    if (syntax.lineComment.length() > 2 || syntax.blockStart.length() != syntax.blockEnd.length()
+            || (syntax.blockStart.length() != 0 && syntax.blockStart.length() != 2)) {
+        error("Line comments need 1 or 2 chars and block comments 2 at each end");
+    }
+    if (syntax.lineComment.length() == 2 && syntax.blockStart.length() == 2
+            && syntax.lineComment[0] != syntax.blockStart[0]) {
+        error("Two-char line and block comments must start with the same char");
     }
-    else if (brackets.find(s[0]) == string::npos) {
-            return operatorsOnly(s.substr(1));
 
+    //a bracket that might start a delimiter is only known to count once the next char is seen,
+    //which one next() step per char cannot report, so a Pascal "(*" or Haskell "{-" is refused
+    //rather than losing the brackets it starts with
+    string delimiters = syntax.quotes + syntax.escape + syntax.lineComment + syntax.blockStart + syntax.blockEnd;
+    if (delimiters.find_first_of(BRACKET_CHARS) != string::npos) {
+        error("A bracket syntax cannot use brackets in its quotes, escape or comments");
+    }
+    if (!syntax.lineComment.empty()) {
+        delimiters += '\n';
     }
-    else{
-        return s[0] + operatorsOnly(s.substr(1));
+    specials = string(BRACKET_CHARS);
+    for (char c : delimiters) {
+        if (c != '\0' && specials.find(c) == string::npos) {
+            specials += c;
+        }
     }
 
+    int numStates = FIRST_STRING_STATE + STRING_STATE_COUNT * syntax.quotes.length();
+    table.resize(256 * numStates);
+    others.resize(numStates);
+    for (int state = 0; state < numStates; state++) {
+        for (int c = 0; c < 256; c++) {
+            table[256 * state + c] = lexerStep(syntax, state, c);
+        }
+        others[state] = lexerStep(syntax, state, OTHER_CHAR);
+    }
 }
 
+BracketValidator::BracketValidator(long long maxDepth, bool bracketsOnly)
+    : maxDepth(maxDepth), bracketsOnly(bracketsOnly), pushed(0), mismatch(BALANCED), lexer(PLAIN_SYNTAX),
+      lexing(false), state(BracketLexer::START), lastSpecial(-1) {
+}
 
+BracketValidator::BracketValidator(const BracketSyntax& syntax, long long maxDepth) : BracketValidator(maxDepth) {
+    lexer = BracketLexer(syntax);
+    lexing = !syntax.quotes.empty() || !syntax.lineComment.empty() || !syntax.blockStart.empty();
+}
 
+//this function pushes an opener with its offset and pops the top for a closer that closes that
+//kind of bracket; any other closer is the mismatch. it returns false once there is a mismatch
+bool BracketValidator::matchBracket(long long offset, char c) {
+    if (c == '(' || c == '[' || c == '{') {
+        if (maxDepth > 0 && (long long) open.size() == maxDepth) {
+            error("Brackets are nested more than " + to_string(maxDepth) + " deep");
+        }
+        open.push_back({offset, c});
+    }
+    else if (open.empty() || open.back().c != openerOf(c)) {
+        mismatch = offset;
+        return false;
+    }
+    else {
+        open.pop_back();
+    }
+    return true;
+}
 
-//this function takes in a string of operators only and returns true if
-//it is balanced, and false if it is not. checkOperators uses recursion
-//to remove pairs of operators in order to verify the operators are balanced
-//if this is called with non-operator characters, it will return false
-bool checkOperators(string s) {
-    int index = -1;
-    if(s.find("()") != string::npos){
-        index = s.find("()");
+//this function walks the brackets of the chunk once, keeping the ones still open on a stack.
+//when only brackets are allowed, every char is looked at so the first other char is found. in
+//lexer mode the special chars are walked instead, and each goes through the lexer's table, so
+//a bracket only counts when the table says it is outside any string or comment
+bool BracketValidator::push(string_view chunk) {
+    if (mismatch == BALANCED && bracketsOnly) {
+        for (size_t i = 0; i < chunk.length(); i++) {
+            if (!isOperator(chunk[i])) {
+                mismatch = pushed + i;
+                break;
+            }
+            if (!matchBracket(pushed + i, chunk[i])) {
+                break;
+            }
+        }
     }
-    else if(s.find("[]") != string::npos){
-        index = s.find("[]");
+    else if (mismatch == BALANCED && lexing) {
+        forEachChar(chunk, lexer.specialChars(), [&](size_t i, char c) {
+            long long offset = pushed + i;
+            if (offset != lastSpecial + 1) {
+                state = lexer.afterOthers(state);
+            }
+            lastSpecial = offset;
+            uint8_t step = lexer.next(state, c);
+            state = step & ~BracketLexer::COUNTS_BRACKET;
+            return (step & BracketLexer::COUNTS_BRACKET) == 0 || matchBracket(offset, c);
+        });
     }
-    else if(s.find("{}") != string::npos){
-        index = s.find("{}");
+    else if (mismatch == BALANCED) {
+        forEachChar(chunk, BRACKET_CHARS, [&](size_t i, char c) {
+            return matchBracket(pushed + i, c);
+        });
+    }
+    pushed += chunk.length();
+    return mismatch == BALANCED;
+}
+
+long long BracketValidator::finalize() const {
+    if (mismatch != BALANCED || open.empty()) {
+        return mismatch;
     }
+    return open.back().offset;
+}
+
+long long BracketValidator::length() const {
+    return pushed;
+}
+
+long long firstMismatch(string_view s) {
+    BracketValidator validator;
+    validator.push(s);
+    return validator.finalize();
+}
 
-    if (s == ""){
+long long firstMismatch(string_view s, const BracketSyntax& syntax) {
+    BracketValidator validator(syntax);
+    validator.push(s);
+    return validator.finalize();
+}
+
+//this function reads the stream into one reused buffer and pushes it until the stream ends or
+//a mismatch is found. the loop stops the same way at the end of the stream and at a read
+//error, so badbit is what tells a failed read from a stream that really ended there
+long long firstMismatchInStream(istream& in, long long maxDepth, const BracketSyntax& syntax) {
+    BracketValidator validator(syntax, maxDepth);
+    vector<char> buffer(STREAM_BUFFER_SIZE);
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        if (!validator.push(string_view(buffer.data(), in.gcount()))) {
+            break;
+        }
+    }
+    if (in.bad()) {
+        error("Cannot read the stream past offset " + to_string(validator.length()));
+    }
+    return validator.finalize();
+}
+
+long long firstMismatchInFile(string filename, long long maxDepth, const BracketSyntax& syntax) {
+    ifstream in(filename, ios::binary);
+    if (!in) {
+        error("Cannot open file named " + filename);
+    }
+    return firstMismatchInStream(in, maxDepth, syntax);
+}
+
+//the fewest chars per thread firstMismatchParallel splits an input into when it picks the
+//number of threads itself
+const int PARALLEL_CHUNK_SIZE = 1 << 18;
+
+//this function splits numItems into numThreads contiguous ranges and calls worker(t, begin, end)
+//on range t in its own thread. the last range runs on the calling thread
+void runInParallel(long long numItems, int numThreads, const function<void(int, long long, long long)>& worker) {
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        long long begin = numItems * t / numThreads;
+        long long end = numItems * (t + 1) / numThreads;
+        if (t == numThreads - 1) {
+            worker(t, begin, end);
+        }
+        else {
+            workers.emplace_back(worker, t, begin, end);
+        }
+    }
+    for (thread& w : workers) {
+        w.join();
+    }
+}
+
+//this function is the validator's loop, except that a closer with nothing open in the chunk is
+//kept in closers instead of being a mismatch
+BracketSummary summarizeBrackets(string_view chunk, long long offset) {
+    BracketSummary summary;
+    forEachChar(chunk, BRACKET_CHARS, [&](size_t i, char c) {
+        if (c == '(' || c == '[' || c == '{') {
+            summary.openers.push_back({offset + (long long) i, c});
+        }
+        else if (summary.openers.empty()) {
+            summary.closers.push_back({offset + (long long) i, c});
+        }
+        else if (summary.openers.back().c != openerOf(c)) {
+            summary.mismatch = offset + i;
+            return false;
+        }
+        else {
+            summary.openers.pop_back();
+        }
         return true;
+    });
+    return summary;
+}
+
+//this function matches the closers of right against the openers of left, innermost first. the
+//first pair of different kinds is the mismatch. closers left over once left's openers run out
+//follow left's closers, and right's openers go on top of any of left's that are still open
+BracketSummary combineSummaries(BracketSummary left, BracketSummary right) {
+    if (left.mismatch != BALANCED) {
+        return left;
+    }
+    for (const Bracket& closer : right.closers) {
+        if (left.openers.empty()) {
+            left.closers.push_back(closer);
+        }
+        else if (left.openers.back().c != openerOf(closer.c)) {
+            left.mismatch = closer.offset;
+            return left;
+        }
+        else {
+            left.openers.pop_back();
+        }
+    }
+    left.openers.insert(left.openers.end(), right.openers.begin(), right.openers.end());
+    left.mismatch = right.mismatch;
+    return left;
+}
+
+//this function gives the closers first, since they come before any mismatch and have nothing
+//open to match, then the mismatch, then the innermost opener still open
+long long summaryMismatch(const BracketSummary& summary) {
+    if (!summary.closers.empty()) {
+        return summary.closers[0].offset;
+    }
+    if (summary.mismatch != BALANCED || summary.openers.empty()) {
+        return summary.mismatch;
+    }
+    return summary.openers.back().offset;
+}
+
+//this function summarizes one chunk per thread, then halves the summaries each round by
+//combining neighbours, with the pairs of a round split between the threads
+long long firstMismatchParallel(string_view s, int numThreads) {
+    if (numThreads <= 0) {
+        long long bigEnough = s.length() / PARALLEL_CHUNK_SIZE;
+        numThreads = min<long long>(max(1, (int) thread::hardware_concurrency()), bigEnough);
     }
-    else if (index >= 0){
-        s = s.substr(0, index) + s.substr(index + 2); //removes pair of operators
-        return checkOperators(s);
+    numThreads = min<long long>(numThreads, s.length());
+    if (numThreads <= 1) {
+        return firstMismatch(s);
     }
 
-    return false;
+    vector<BracketSummary> summaries(numThreads);
+    runInParallel(s.length(), numThreads, [&](int t, long long begin, long long end) {
+        summaries[t] = summarizeBrackets(s.substr(begin, end - begin), begin);
+    });
+    while (summaries.size() > 1) {
+        vector<BracketSummary> combined((summaries.size() + 1) / 2);
+        int pairThreads = min<long long>(numThreads, combined.size());
+        runInParallel(combined.size(), pairThreads, [&](int, long long begin, long long end) {
+            for (long long i = begin; i < end; i++) {
+                if (2 * i + 1 < (long long) summaries.size()) {
+                    combined[i] = combineSummaries(move(summaries[2 * i]), move(summaries[2 * i + 1]));
+                }
+                else {
+                    combined[i] = move(summaries[2 * i]);
+                }
+            }
+        });
+        summaries = move(combined);
+    }
+    return summaryMismatch(summaries[0]);
+}
 
+//this function takes in a string of operators only and returns true if
+//it is balanced, and false if it is not. checkOperators matches each
+//closer against the last unmatched opener in one pass over the string
+//if this is called with non-operator characters, it will return false
+bool checkOperators(string s) {
+    BracketValidator validator(0, true);
+    validator.push(s);
+    return validator.finalize() == BALANCED;
 }
 
 
-/* 
- * This function assumes correct implementation of the previous 
- * two functions. It uses the operatorsOnly function to strip out
- * all characters from the provided string and then checks to see
- * whether the remaining operators are balanced by using the 
- * checkOperators function. All in all, this function is able to 
- * correctly determine whether a snippet of code has correctly
- * balanced bracketing operators. You should not need to modify this
- * function if the previous two functions have been implemented
- * correctly. 
- */
+//this function returns whether a snippet of code has correctly balanced bracketing operators.
+//it gives the same answer as checkOperators(operatorsOnly(str)), but skips the other characters
+//as it goes instead of copying the operators out first
 bool isBalanced(string str) {
-    string ops = operatorsOnly(str);
-    return checkOperators(ops);
+    return firstMismatch(str) == BALANCED;
 }
 
 
@@ -144,3 +700,379 @@ STUDENT_TEST("isBalanced with no operators and another balanced input"){
     input = "([([()])])";
     EXPECT(isBalanced(input));
 }
+
+STUDENT_TEST("firstMismatch reports the offset of the first bracket that cannot match"){
+    EXPECT_EQUAL(firstMismatch("int main() { int x = 2 * (vec[2] + 3); x = (1 + random()); }"), BALANCED);
+    EXPECT_EQUAL(firstMismatch(""), BALANCED);
+    EXPECT_EQUAL(firstMismatch("3 ) ("), 2);
+    EXPECT_EQUAL(firstMismatch("{ ( x } y )"), 6);
+    EXPECT_EQUAL(firstMismatch("( ( [ a ] )"), 0);
+    EXPECT_EQUAL(firstMismatch("{[()]}(("), 7);
+    EXPECT_EQUAL(firstMismatch("(]"), 1);
+}
+
+STUDENT_TEST("checkOperators agrees with the pair removing version on random inputs"){
+    //the original version, which removes a matched pair and recurses
+    function<bool(string)> removePairs = [&](string s) {
+        for (string pair : {"()", "[]", "{}"}) {
+            size_t index = s.find(pair);
+            if (index != string::npos) {
+                return removePairs(s.substr(0, index) + s.substr(index + 2));
+            }
+        }
+        return s == "";
+    };
+    string brackets = "()[]{}";
+    for (int i = 0; i < 5000; i++) {
+        string input;
+        for (int length = randomInteger(0, 12); length > 0; length--) {
+            input += brackets[randomInteger(0, randomChance(0.2) ? 5 : 1)];
+        }
+        EXPECT_EQUAL(checkOperators(input), removePairs(input));
+        EXPECT_EQUAL(firstMismatch(input) == BALANCED, removePairs(input));
+    }
+}
+
+//this function returns n nested pairs of random brackets with filler text between them
+string nestedBrackets(int n) {
+    string brackets = "()[]{}";
+    string s;
+    string closers;
+    for (int i = 0; i < n; i++) {
+        int kind = 2 * randomInteger(0, 2);
+        s += brackets[kind];
+        s += "x + y";
+        closers += brackets[kind + 1];
+    }
+    return s + string(closers.rbegin(), closers.rend());
+}
+
+STUDENT_TEST("isBalanced on a million nested brackets does not run out of stack"){
+    string input = nestedBrackets(1000000);
+    EXPECT(isBalanced(input));
+    EXPECT_EQUAL(firstMismatch(input), BALANCED);
+    input[input.length() - 1] = input[input.length() - 1] == ')' ? ']' : ')';
+    EXPECT(!isBalanced(input));
+    EXPECT_EQUAL(firstMismatch(input), (long long) input.length() - 1);
+    EXPECT_EQUAL(firstMismatch(input.substr(0, 1000)), 996);
+}
+
+STUDENT_TEST("isBalanced time trials on multi-megabyte inputs"){
+    string small = nestedBrackets(2000);
+    string large = nestedBrackets(1000000);
+    EXPECT(isBalanced(small));
+    TIME_OPERATION(small.length(), isBalanced(small));
+    TIME_OPERATION(large.length(), isBalanced(large));
+    TIME_OPERATION(large.length(), firstMismatch(large));
+}
+
+STUDENT_TEST("BracketValidator gives the same offsets for any way of chunking the input"){
+    Vector<string> inputs = {"int main() { int x = 2 * (vec[2] + 3); }", "{ ( x } y )", "{[()]}((", "3 ) (", ""};
+    for (int i = 0; i < 200; i++) {
+        inputs.add(nestedBrackets(randomInteger(0, 50)));
+        string& input = inputs[inputs.size() - 1];
+        if (!input.empty() && randomChance(0.5)) {
+            input[randomInteger(0, input.length() - 1)] = "()[]{}"[randomInteger(0, 5)];
+        }
+    }
+    for (const string& input : inputs) {
+        BracketValidator validator;
+        size_t start = 0;
+        while (start < input.length()) {
+            size_t length = randomInteger(0, 7);
+            validator.push(string_view(input).substr(start, length));
+            start += length;
+        }
+        EXPECT_EQUAL(validator.finalize(), firstMismatch(input));
+        EXPECT_EQUAL(validator.finalize() == BALANCED, checkOperators(operatorsOnly(input)));
+    }
+
+    BracketValidator validator;
+    EXPECT(validator.push("([x"));
+    EXPECT(!validator.push(")]"));
+    EXPECT(!validator.push("()"));
+    EXPECT_EQUAL(validator.finalize(), 3);
+    EXPECT_EQUAL(validator.length(), 7);
+}
+
+STUDENT_TEST("BracketValidator keeps no more than maxDepth brackets open"){
+    BracketValidator validator(3);
+    EXPECT(validator.push("(((x)))((("));
+    EXPECT_ERROR(validator.push("("));
+    istringstream shallow("{[()]}");
+    EXPECT_EQUAL(firstMismatchInStream(shallow, 3), BALANCED);
+    istringstream deep(nestedBrackets(4));
+    EXPECT_ERROR(firstMismatchInStream(deep, 3));
+}
+
+//a stream buffer that hands out size chars of text, repeated, and then fails like a disk error
+struct FailingBuffer : streambuf {
+    string text;
+    long long left;
+
+    FailingBuffer(string text, long long size) : text(text), left(size) {}
+
+    int underflow() override {
+        if (left <= 0) {
+            throw runtime_error("read error");
+        }
+        long long chunk = min<long long>(left, text.length());
+        left -= chunk;
+        setg(&text[0], &text[0], &text[0] + chunk);
+        return (unsigned char) text[0];
+    }
+};
+
+STUDENT_TEST("firstMismatchInStream calls error when a read fails instead of ending early"){
+    FailingBuffer balanced("()", 10 << 20);
+    istream balancedIn(&balanced);
+    EXPECT_ERROR(firstMismatchInStream(balancedIn));
+    FailingBuffer open("((", 10 << 20);
+    istream openIn(&open);
+    EXPECT_ERROR(firstMismatchInStream(openIn, 1LL << 30));
+
+    //a mismatch found before the failed read is still the answer
+    FailingBuffer mismatched(")(", 10 << 20);
+    istream mismatchedIn(&mismatched);
+    EXPECT_EQUAL(firstMismatchInStream(mismatchedIn), 0);
+}
+
+STUDENT_TEST("firstMismatchInFile reads files bigger than its buffer"){
+    string filename = "generated-brackets.txt";
+    string input = nestedBrackets(500000);
+    ofstream out(filename, ios::binary);
+    out << input;
+    out.close();
+    EXPECT_EQUAL(firstMismatchInFile(filename), BALANCED);
+
+    input[input.length() - 2] = '{';
+    out.open(filename, ios::binary);
+    out << input;
+    out.close();
+    EXPECT_EQUAL(firstMismatchInFile(filename), firstMismatch(input));
+    deleteFile(filename);
+    EXPECT_ERROR(firstMismatchInFile(filename));
+}
+
+STUDENT_TEST("firstMismatchInFile time trials against reading the whole file first"){
+    string filename = "generated-brackets.txt";
+    ofstream out(filename, ios::binary);
+    for (int i = 0; i < 20; i++) {
+        out << nestedBrackets(500000);
+    }
+    out.close();
+
+    auto readWhole = [&]() {
+        ifstream in(filename, ios::binary);
+        string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        return firstMismatch(contents);
+    };
+    EXPECT_EQUAL(readWhole(), BALANCED);
+    TIME_OPERATION(70000000, readWhole());
+    TIME_OPERATION(70000000, firstMismatchInFile(filename));
+    deleteFile(filename);
+}
+
+STUDENT_TEST("combineSummaries gives the same summary in any grouping"){
+    string input = "}{([)]";
+    BracketSummary a = summarizeBrackets("}{(", 0);
+    BracketSummary b = summarizeBrackets("[", 3);
+    BracketSummary c = summarizeBrackets(")]", 4);
+    EXPECT_EQUAL(summaryMismatch(combineSummaries(combineSummaries(a, b), c)), firstMismatch(input));
+    EXPECT_EQUAL(summaryMismatch(combineSummaries(a, combineSummaries(b, c))), firstMismatch(input));
+    EXPECT_EQUAL(summaryMismatch(summarizeBrackets("([)]", 2)), 4);
+    EXPECT_EQUAL(summaryMismatch(summarizeBrackets(")(", 0)), 0);
+    EXPECT_EQUAL(summaryMismatch(summarizeBrackets("x(", 10)), 11);
+}
+
+STUDENT_TEST("firstMismatchParallel equals firstMismatch on any number of threads"){
+    for (int i = 0; i < 500; i++) {
+        string input = nestedBrackets(randomInteger(0, 40));
+        for (int changes = randomInteger(0, 2); changes > 0 && !input.empty(); changes--) {
+            input[randomInteger(0, input.length() - 1)] = "()[]{}"[randomInteger(0, 5)];
+        }
+        if (randomChance(0.2)) {
+            input = ")" + input;
+        }
+        for (int threads = 1; threads <= 9; threads++) {
+            EXPECT_EQUAL(firstMismatchParallel(input, threads), firstMismatch(input));
+        }
+        EXPECT_EQUAL(firstMismatchParallel(input), firstMismatch(input));
+    }
+}
+
+STUDENT_TEST("firstMismatchParallel time trials on 70 megabytes"){
+    string large;
+    for (int i = 0; i < 20; i++) {
+        large += nestedBrackets(500000);
+    }
+    EXPECT_EQUAL(firstMismatchParallel(large, 8), BALANCED);
+    char middle = large[large.length() / 2];
+    large[large.length() / 2] = ']';
+    EXPECT_EQUAL(firstMismatchParallel(large, 8), firstMismatch(large));
+    large[large.length() / 2] = middle;
+    TIME_OPERATION(large.length(), firstMismatch(large));
+    TIME_OPERATION(large.length(), firstMismatchParallel(large, 1));
+    TIME_OPERATION(large.length(), firstMismatchParallel(large, 4));
+    TIME_OPERATION(large.length(), firstMismatchParallel(large));
+}
+
+STUDENT_TEST("bracketMasks and compactBrackets agree with their byte at a time versions"){
+    for (int i = 0; i < 2000; i++) {
+        string input;
+        for (int length = randomInteger(0, 300); length > 0; length--) {
+            input += randomChance(0.3) ? "()[]{}"[randomInteger(0, 5)] : (char) randomInteger(-128, 127);
+        }
+        vector<uint64_t> expected((input.length() + 63) / 64);
+        vector<uint64_t> masks(expected.size());
+        bracketMasksScalar(input, expected.data());
+        bracketMasks(input, masks.data());
+        EXPECT(masks == expected);
+        string packed(input.length() + 64, '\0');
+        packed.resize(compactBrackets(input, masks.data(), &packed[0]));
+        string packedByBit;
+        for (size_t block = 0; 64 * block < input.length(); block++) {
+            char out[64];
+            packedByBit.append(out, compactBlockScalar(input.data() + 64 * block, masks[block], out));
+        }
+        EXPECT_EQUAL(packed, packedByBit);
+#ifdef BALANCED_SIMD
+        charMasksSse2(input, BRACKET_CHARS, masks.data());
+        EXPECT(masks == expected);
+        if (__builtin_cpu_supports("avx2")) {
+            charMasksAvx2(input, BRACKET_CHARS, masks.data());
+            EXPECT(masks == expected);
+        }
+        if (__builtin_cpu_supports("avx512bw")) {
+            charMasksAvx512(input, BRACKET_CHARS, masks.data());
+            EXPECT(masks == expected);
+        }
+#endif
+    }
+    uint64_t mask;
+    bracketMasks("a(b)", &mask);
+    EXPECT_EQUAL(mask, (uint64_t) 0b1010);
+}
+
+STUDENT_TEST("operatorsOnly and firstMismatch time trials on a large source file"){
+    string source;
+    while (source.length() < 50000000) {
+        source += "int main() { int x = 2 * (vec[2] + 3); x = (1 + random()); }\n";
+        source += "    // a comment line with no brackets in it at all, just words\n";
+    }
+    auto operatorsByChar = [&]() {
+        string ops;
+        for (char c : source) {
+            if (isOperator(c)) {
+                ops += c;
+            }
+        }
+        return ops;
+    };
+    auto mismatchByChar = [&]() {
+        BracketValidator validator(0, true);
+        validator.push(operatorsByChar());
+        return validator.finalize();
+    };
+    vector<uint64_t> masks((source.length() + 63) / 64);
+    EXPECT_EQUAL(operatorsOnly(source), operatorsByChar());
+    EXPECT_EQUAL(firstMismatch(source), mismatchByChar());
+    TIME_OPERATION(source.length(), bracketMasksScalar(source, masks.data()));
+    TIME_OPERATION(source.length(), bracketMasks(source, masks.data()));
+    TIME_OPERATION(source.length(), operatorsByChar());
+    TIME_OPERATION(source.length(), operatorsOnly(source));
+    TIME_OPERATION(source.length(), mismatchByChar());
+    TIME_OPERATION(source.length(), firstMismatch(source));
+}
+
+STUDENT_TEST("firstMismatch with a syntax skips the brackets in strings and comments"){
+    EXPECT_EQUAL(firstMismatch("f(\"(\", '[', /* { */ x) // )", C_SYNTAX), BALANCED);
+    EXPECT_EQUAL(firstMismatch("f(\"(\", '[', /* { */ x) // )", PLAIN_SYNTAX), 21);
+    EXPECT_EQUAL(firstMismatch("s = \"\\\"(\" )", C_SYNTAX), 10);
+    EXPECT_EQUAL(firstMismatch("a / (b) /*/ ] */ [c]", C_SYNTAX), BALANCED);
+    EXPECT_EQUAL(firstMismatch("x = 1; // (\n]", C_SYNTAX), 12);
+    EXPECT_EQUAL(firstMismatch("{ /* ] **/ } /* unterminated ]", C_SYNTAX), BALANCED);
+
+    EXPECT_EQUAL(firstMismatch("{\"a\": \"[}\", \"b\": [1, \"\\\"]\"]}", JSON_SYNTAX), BALANCED);
+    EXPECT_EQUAL(firstMismatch("{\"a\": '[}'}", JSON_SYNTAX), 8);
+
+    EXPECT_EQUAL(firstMismatch("f('''(\n''', \"#\", x) # )", PYTHON_SYNTAX), BALANCED);
+    EXPECT_EQUAL(firstMismatch("d = {'': [], \"\"\"a\"\" ]\"\"\": ()}", PYTHON_SYNTAX), BALANCED);
+    EXPECT_EQUAL(firstMismatch("x = ''(", PYTHON_SYNTAX), 6);
+}
+
+STUDENT_TEST("BracketLexer jumping between special chars agrees with stepping on every char"){
+    Vector<BracketSyntax> syntaxes = {C_SYNTAX, JSON_SYNTAX, PYTHON_SYNTAX, {"`", '\0', "--", "", "", false}};
+    for (const BracketSyntax& syntax : syntaxes) {
+        BracketLexer lexer(syntax);
+        string alphabet = string(lexer.specialChars()) + "ab \n";
+        for (int i = 0; i < 2000; i++) {
+            string input;
+            for (int length = randomInteger(0, 40); length > 0; length--) {
+                input += alphabet[randomInteger(0, alphabet.length() - 1)];
+            }
+            //the brackets that count, found by stepping on every char, with the rest blanked
+            string counted(input.length(), ' ');
+            uint8_t state = BracketLexer::START;
+            for (size_t c = 0; c < input.length(); c++) {
+                uint8_t step = lexer.next(state, input[c]);
+                state = step & ~BracketLexer::COUNTS_BRACKET;
+                if (step & BracketLexer::COUNTS_BRACKET) {
+                    counted[c] = input[c];
+                }
+            }
+            EXPECT_EQUAL(firstMismatch(input, syntax), firstMismatch(counted));
+
+            BracketValidator validator(syntax);
+            for (size_t start = 0; start < input.length(); start += 3) {
+                validator.push(string_view(input).substr(start, 3));
+            }
+            EXPECT_EQUAL(validator.finalize(), firstMismatch(counted));
+        }
+    }
+    EXPECT_ERROR(BracketLexer({"'\"`~^", '\\', "", "", "", false}));
+    EXPECT_ERROR(BracketLexer({"'", '\\', "//", "(*", "*)", false}));
+    EXPECT_ERROR(BracketLexer({"'", '\\', "", "/*", "", false}));
+}
+
+STUDENT_TEST("BracketLexer refuses delimiters that hold brackets instead of losing them"){
+    EXPECT_ERROR(firstMismatch("(x)", {"", '\0', "", "(*", "*)", false}));
+    EXPECT_ERROR(firstMismatch("{x}", {"\"", '\\', "--", "{-", "-}", false}));
+    EXPECT_ERROR(BracketLexer({"", '\0', "", "/*", "*)", false}));
+    EXPECT_ERROR(BracketLexer({"[", '\0', "", "", "", false}));
+    EXPECT_ERROR(BracketLexer({"'", '\0', "]", "", "", false}));
+    EXPECT_EQUAL(firstMismatch("(x)", {"", '\0', "", "%*", "*%", false}), BALANCED);
+}
+
+STUDENT_TEST("firstMismatch time trials with and without a C syntax"){
+    string plainSource;
+    string source;
+    while (source.length() < 50000000) {
+        plainSource += "int main() { int x = 2 * (vec[2] + 3); x = (1 + random()); }\n";
+        plainSource += "    // a comment line with no brackets in it at all, just words\n";
+        source += "int main() { int x = 2 * (vec[2] + 3); x = (1 + random()); }\n";
+        source += "    printf(\"%d (of %d]\\n\", x, y); /* a (comment */ c = ']';\n";
+        source += "    // a comment line with no brackets in it at all, just words\n";
+    }
+    BracketLexer lexer(C_SYNTAX);
+    auto mismatchByChar = [&]() {
+        BracketValidator validator;
+        uint8_t state = BracketLexer::START;
+        for (size_t c = 0; c < source.length(); c++) {
+            uint8_t step = lexer.next(state, source[c]);
+            state = step & ~BracketLexer::COUNTS_BRACKET;
+            if ((step & BracketLexer::COUNTS_BRACKET) && !validator.push(string_view(source).substr(c, 1))) {
+                break;
+            }
+        }
+        return validator.finalize();
+    };
+    EXPECT_EQUAL(firstMismatch(source, C_SYNTAX), BALANCED);
+    EXPECT(firstMismatch(source) != BALANCED);
+    EXPECT_EQUAL(mismatchByChar(), BALANCED);
+    EXPECT_EQUAL(firstMismatch(plainSource), BALANCED);
+    TIME_OPERATION(plainSource.length(), firstMismatch(plainSource));
+    TIME_OPERATION(plainSource.length(), firstMismatch(plainSource, C_SYNTAX));
+    TIME_OPERATION(source.length(), firstMismatch(source, C_SYNTAX));
+    TIME_OPERATION(source.length(), mismatchByChar());
+}
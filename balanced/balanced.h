@@ -0,0 +1,178 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+std::string operatorsOnly(std::string s);
+bool checkOperators(std::string s);
+bool isBalanced(std::string str);
+
+// The offset firstMismatch returns when every bracket is matched.
+const long long BALANCED = -1;
+
+// Returns the offset in s of the first bracket that shows s is not balanced, or BALANCED.
+// A closing bracket with nothing open, or that closes a bracket of another kind, is the
+// mismatch. If s ends with brackets still open, the innermost of them is the mismatch.
+// Characters other than ()[]{} are skipped.
+long long firstMismatch(std::string_view s);
+
+// Sets bit i % 64 of masks[i / 64] if s[i] is one of ()[]{} and clears it otherwise, so
+// masks must hold (s.length() + 63) / 64 words; bits past the end of s are cleared. On x86
+// processors the bytes are compared 64, 32 or 16 at a time with AVX-512, AVX2 or SSE2,
+// whichever the processor has; otherwise bracketMasksScalar does the work.
+void bracketMasks(std::string_view s, uint64_t* masks);
+
+// Same as bracketMasks, looking at one byte at a time.
+void bracketMasksScalar(std::string_view s, uint64_t* masks);
+
+// One bracket of an input and its offset from the start of the input.
+struct Bracket {
+    long long offset;
+    char c;
+};
+
+// The strings and comments of a language, whose brackets a BracketValidator can skip. Any
+// of the delimiters can be left empty to leave that kind of string or comment out.
+struct BracketSyntax {
+    std::string quotes;             // chars that start and end a string, at most 4
+    char escape;                    // in a string, makes the next char part of it
+    std::string lineComment;        // 1 or 2 chars that start a comment ended by '\n'
+    std::string blockStart;         // 2 chars that start a comment ...
+    std::string blockEnd;           // ... and the 2 that end it
+    bool tripleQuotes;              // three quotes start a string only three more end
+};
+
+// No strings or comments, so every bracket counts.
+const BracketSyntax PLAIN_SYNTAX = {"", '\0', "", "", "", false};
+
+// C and C++ string and char literals and comments. Raw strings are not recognized.
+const BracketSyntax C_SYNTAX = {"\"'", '\\', "//", "/*", "*/", false};
+
+// JSON strings. JSON has no comments.
+const BracketSyntax JSON_SYNTAX = {"\"", '\\', "", "", "", false};
+
+// Python strings, triple-quoted strings and comments.
+const BracketSyntax PYTHON_SYNTAX = {"\"'", '\\', "#", "", "", true};
+
+// The state machine that follows a BracketSyntax through an input one char at a time, as
+// a table with a row of 256 next states for each state. Only the chars of specialChars()
+// can do more than take the machine out of a state it is in for just one char, such as
+// right after an escape, so the machine can jump from one special char to the next as
+// long as it takes the step of afterOthers() across each gap.
+class BracketLexer {
+public:
+    // Builds the table. If the syntax has more than 4 quotes, delimiters of the wrong
+    // length, a two-char line comment and block comment that start with different chars,
+    // or a bracket in any of its delimiters, this constructor calls error().
+    BracketLexer(const BracketSyntax& syntax);
+
+    // Set in a next() result when c is a bracket outside any string or comment.
+    static const uint8_t COUNTS_BRACKET = 0x80;
+
+    // The state at the start of an input.
+    static const uint8_t START = 0;
+
+    // Returns the state after c, with COUNTS_BRACKET set if c is a bracket that counts.
+    uint8_t next(uint8_t state, char c) const {
+        return table[256 * state + (unsigned char) c];
+    }
+
+    // Returns the state after one or more chars that are not special.
+    uint8_t afterOthers(uint8_t state) const {
+        return others[state];
+    }
+
+    // Returns the brackets and the chars of the syntax's delimiters.
+    std::string_view specialChars() const {
+        return specials;
+    }
+
+private:
+    std::vector<uint8_t> table;
+    std::vector<uint8_t> others;
+    std::string specials;
+};
+
+// The most brackets the file and stream checkers keep open at once, by default.
+const long long DEFAULT_MAX_DEPTH = 1 << 20;
+
+// Checks the brackets of an input that arrives in chunks, such as a file too big to read
+// whole, giving the same offset firstMismatch would give for all the chunks joined. Only
+// the brackets still open are kept, so memory depends on how deeply they nest and not on
+// how long the input is. Once a mismatch is found the rest of the input is ignored.
+class BracketValidator {
+public:
+    // With bracketsOnly, any character other than ()[]{} is a mismatch, as in
+    // checkOperators. With more than maxDepth brackets open at once, push calls error();
+    // a maxDepth of 0 means no limit.
+    BracketValidator(long long maxDepth = 0, bool bracketsOnly = false);
+
+    // In lexer mode, brackets inside the strings and comments of syntax are skipped. The
+    // strings and comments are found in the same pass as the brackets.
+    BracketValidator(const BracketSyntax& syntax, long long maxDepth = 0);
+
+    // Checks the next chunk of input. Returns false once a mismatch has been found.
+    bool push(std::string_view chunk);
+
+    // Returns the offset firstMismatch gives for everything pushed so far, counting from
+    // the start of the first chunk.
+    long long finalize() const;
+
+    // Returns the number of chars pushed so far.
+    long long length() const;
+
+private:
+    bool matchBracket(long long offset, char c);
+
+    std::vector<Bracket> open;
+    long long maxDepth;
+    bool bracketsOnly;
+    long long pushed;
+    long long mismatch;
+    BracketLexer lexer;
+    bool lexing;
+    uint8_t state;
+    long long lastSpecial;      // offset of the last special char the lexer took
+};
+
+// Returns firstMismatch of s, skipping the brackets inside the strings and comments of
+// syntax. A string or comment still open at the end of s is not a mismatch.
+long long firstMismatch(std::string_view s, const BracketSyntax& syntax);
+
+// Returns firstMismatch of everything left in in, reading it a large buffer at a time. If
+// reading fails before the end of the stream, this function calls error().
+long long firstMismatchInStream(std::istream& in, long long maxDepth = DEFAULT_MAX_DEPTH,
+                                const BracketSyntax& syntax = PLAIN_SYNTAX);
+
+// Returns firstMismatch of the contents of a file. If the file is missing, this function
+// calls error().
+long long firstMismatchInFile(std::string filename, long long maxDepth = DEFAULT_MAX_DEPTH,
+                              const BracketSyntax& syntax = PLAIN_SYNTAX);
+
+// What one chunk of an input adds to the brackets checked before it, once the pairs that
+// match inside the chunk are taken out: the closers left over, which must match brackets
+// opened before the chunk, and then the openers left over. A closer that meets an opener of
+// another kind inside the chunk is a mismatch whatever came before, so mismatch is its
+// offset and the rest of the chunk is left out. Summaries of neighbouring chunks combine
+// into the summary of both, in any grouping.
+struct BracketSummary {
+    std::vector<Bracket> closers;
+    std::vector<Bracket> openers;
+    long long mismatch = BALANCED;
+};
+
+// Returns the summary of chunk, which starts at the given offset of the whole input.
+BracketSummary summarizeBrackets(std::string_view chunk, long long offset);
+
+// Returns the summary of left followed by right.
+BracketSummary combineSummaries(BracketSummary left, BracketSummary right);
+
+// Returns the offset firstMismatch gives for the input a summary covers from its start.
+long long summaryMismatch(const BracketSummary& summary);
+
+// Returns firstMismatch(s), splitting s into numThreads chunks that are summarized on their
+// own threads and then combined in pairs, also in parallel. With numThreads of 0, s is split
+// into one chunk per core, and inputs too small to be worth it are checked on this thread.
+long long firstMismatchParallel(std::string_view s, int numThreads = 0);
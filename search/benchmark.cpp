@@ -0,0 +1,307 @@
+//A benchmark harness for the search engine: it generates a synthetic corpus and query log
+//with a Zipf word distribution and reports index build time, index memory and query
+//latency percentiles in a fixed format that can be compared from run to run
+
+#include "testing/SimpleTest.h"
+#include "benchmark.h"
+#include "search.h"
+#include "postingindex.h"
+#include "filelib.h"
+#include "strlib.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+//bytes a std::map or std::set node needs besides its value: three pointers and a color,
+//padded. Stanford's Map and Set are built on red-black trees with nodes like these
+const long long TREE_NODE_OVERHEAD = 32;
+
+//the longest string kept inside the std::string object itself instead of on the heap
+const size_t SMALL_STRING_LENGTH = 15;
+
+//this constructor adds up the weight of every rank, then scales the running sums so the
+//last one is 1
+ZipfSampler::ZipfSampler(int size, double exponent) {
+    if (size < 1) {
+        error("A Zipf distribution needs at least one rank");
+    }
+    double total = 0;
+    for (int rank = 0; rank < size; rank++) {
+        total += 1 / pow(rank + 1, exponent);
+        cumulative.push_back(total);
+    }
+    for (double& sum : cumulative) {
+        sum /= total;
+    }
+}
+
+//this function picks a uniform point in [0, 1) and returns the first rank whose running sum
+//passes it
+int ZipfSampler::next() const {
+    double point = randomReal(0, 1);
+    int rank = upper_bound(cumulative.begin(), cumulative.end(), point) - cumulative.begin();
+    return min(rank, (int) cumulative.size() - 1);
+}
+
+//this function writes rank in bijective base 26, so every rank gets a different word made
+//only of letters
+string benchmarkWord(int rank) {
+    string word;
+    rank++;
+    while (rank > 0) {
+        rank--;
+        word += (char) ('a' + rank % 26);
+        rank /= 26;
+    }
+    reverse(word.begin(), word.end());
+    return word;
+}
+
+void writeZipfCorpus(string filename, int numPages, int vocabularySize, int wordsPerPage, double exponent) {
+    ZipfSampler sampler(vocabularySize, exponent);
+    ofstream out(filename);
+    if (!out) {
+        error("Cannot write file named " + filename);
+    }
+    for (int page = 0; page < numPages; page++) {
+        out << "www.page" << page << ".com" << '\n';
+        for (int w = randomInteger(1, 2 * wordsPerPage); w > 0; w--) {
+            out << benchmarkWord(sampler.next()) << (w > 1 ? " " : "");
+        }
+        out << '\n';
+    }
+}
+
+Vector<string> generateQueryLog(int numQueries, int vocabularySize, double exponent) {
+    ZipfSampler sampler(vocabularySize, exponent);
+    Vector<string> queries;
+    for (int i = 0; i < numQueries; i++) {
+        string query = benchmarkWord(sampler.next());
+        for (int extra = randomInteger(0, 3); extra > 0; extra--) {
+            double kind = randomReal(0, 1);
+            string prefix = kind < 0.6 ? "" : (kind < 0.85 ? "+" : "-");
+            query += " " + prefix + benchmarkWord(sampler.next());
+        }
+        queries.add(query);
+    }
+    return queries;
+}
+
+//this function sorts the latencies and takes the nearest-rank percentiles: the p-th
+//percentile is the smallest latency that at least p percent of latencies are at or below
+LatencySummary summarizeLatencies(Vector<double> latencies) {
+    LatencySummary summary = {latencies.size(), 0, 0, 0, 0, 0};
+    if (latencies.isEmpty()) {
+        return summary;
+    }
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        int rank = (int) ceil(p * latencies.size());
+        return latencies[max(rank, 1) - 1];
+    };
+
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    summary.mean = total / latencies.size();
+    summary.p50 = percentile(0.5);
+    summary.p99 = percentile(0.99);
+    summary.p999 = percentile(0.999);
+    summary.max = latencies[latencies.size() - 1];
+    return summary;
+}
+
+//this function returns the bytes one string uses, counting its heap buffer if it has one
+long long stringBytes(const string& text) {
+    return sizeof(string) + (text.length() > SMALL_STRING_LENGTH ? text.length() + 1 : 0);
+}
+
+long long estimateIndexBytes(const Map<string, Set<string>>& index) {
+    long long total = 0;
+    for (const string& term : index) {
+        total += TREE_NODE_OVERHEAD + stringBytes(term) + sizeof(Set<string>);
+        for (const string& url : index.get(term)) {
+            total += TREE_NODE_OVERHEAD + stringBytes(url);
+        }
+    }
+    return total;
+}
+
+//this function returns the most memory this process has held at once, or 0 if the platform
+//can't say. Linux reports it in kilobytes and macOS in bytes
+long long peakMemoryBytes() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return usage.ru_maxrss * 1024LL;
+#endif
+    }
+#endif
+    return 0;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//this function adds the summary of latencies to metrics under the given name
+void addLatencyMetrics(Vector<BenchmarkMetric>& metrics, const string& name, const Vector<double>& latencies) {
+    LatencySummary summary = summarizeLatencies(latencies);
+    metrics.add({name + ".count", (double) summary.count});
+    metrics.add({name + ".mean", summary.mean});
+    metrics.add({name + ".p50", summary.p50});
+    metrics.add({name + ".p99", summary.p99});
+    metrics.add({name + ".p999", summary.p999});
+    metrics.add({name + ".max", summary.max});
+}
+
+//this function times each part separately. every query is timed on its own, so the
+//percentiles show the slow queries that an average would hide. the answers are counted so
+//the compiler can't skip the work
+Vector<BenchmarkMetric> runSearchBenchmark(const SearchBenchmarkConfig& config) {
+    Vector<BenchmarkMetric> metrics;
+    setRandomSeed(config.seed);
+    writeZipfCorpus(config.corpusFile, config.numPages, config.vocabularySize, config.wordsPerPage,
+                    config.zipfExponent);
+    Vector<string> queries = generateQueryLog(config.numQueries, config.vocabularySize, config.zipfExponent);
+
+    auto start = chrono::steady_clock::now();
+    Map<string, Set<string>> docs = readDocs(config.corpusFile);
+    double readSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    Map<string, Set<string>> index = buildIndex(docs);
+    double buildSeconds = secondsSince(start);
+    metrics.add({"search.map.read_seconds", readSeconds});
+    metrics.add({"search.map.build_seconds", buildSeconds});
+    metrics.add({"search.map.terms", (double) index.size()});
+    metrics.add({"search.map.index_bytes", (double) estimateIndexBytes(index)});
+
+    long long matchCount = 0;
+    Vector<double> latencies;
+    for (const string& query : queries) {
+        start = chrono::steady_clock::now();
+        matchCount += findQueryMatches(index, query).size();
+        latencies.add(secondsSince(start) * 1e6);
+    }
+    addLatencyMetrics(metrics, "search.map.query_us", latencies);
+    metrics.add({"search.map.matches", (double) matchCount});
+    docs.clear();
+    index.clear();
+
+    start = chrono::steady_clock::now();
+    PostingIndex postings(config.corpusFile);
+    metrics.add({"search.posting.build_seconds", secondsSince(start)});
+    deleteFile(config.corpusFile);
+
+    matchCount = 0;
+    latencies.clear();
+    for (const string& query : queries) {
+        start = chrono::steady_clock::now();
+        matchCount += postings.findTopMatches(query, 10).size();
+        latencies.add(secondsSince(start) * 1e6);
+    }
+    addLatencyMetrics(metrics, "search.posting.top10_us", latencies);
+    metrics.add({"search.posting.matches", (double) matchCount});
+
+    metrics.add({"search.peak_memory_bytes", (double) peakMemoryBytes()});
+    return metrics;
+}
+
+void printBenchmarkReport(ostream& out, const SearchBenchmarkConfig& config, const Vector<BenchmarkMetric>& metrics) {
+    out << "search.config pages=" << config.numPages << " vocabulary=" << config.vocabularySize
+        << " words_per_page=" << config.wordsPerPage << " zipf=" << config.zipfExponent
+        << " queries=" << config.numQueries << " seed=" << config.seed << '\n';
+    for (const BenchmarkMetric& metric : metrics) {
+        out << metric.name << " ";
+        if (metric.value == floor(metric.value) && abs(metric.value) < 1e15) {
+            out << (long long) metric.value << '\n'; //counts and bytes print whole, never as 1e+07
+        }
+        else {
+            ostringstream value;
+            value << fixed;
+            value.precision(3);
+            value << metric.value;
+            out << value.str() << '\n';
+        }
+    }
+    out.flush();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("summarizeLatencies takes nearest-rank percentiles") {
+    Vector<double> latencies;
+    for (int i = 1000; i >= 1; i--) {
+        latencies.add(i);
+    }
+    LatencySummary summary = summarizeLatencies(latencies);
+    EXPECT_EQUAL(summary.count, 1000);
+    EXPECT_EQUAL(summary.mean, 500.5);
+    EXPECT_EQUAL(summary.p50, 500);
+    EXPECT_EQUAL(summary.p99, 990);
+    EXPECT_EQUAL(summary.p999, 999);
+    EXPECT_EQUAL(summary.max, 1000);
+    EXPECT_EQUAL(summarizeLatencies({7}).p999, 7);
+    EXPECT_EQUAL(summarizeLatencies({}).p50, 0);
+}
+
+STUDENT_TEST("Zipf corpus and query log have the promised shape") {
+    EXPECT_EQUAL(benchmarkWord(0), "a");
+    EXPECT_EQUAL(benchmarkWord(25), "z");
+    EXPECT_EQUAL(benchmarkWord(26), "aa");
+    EXPECT_EQUAL(benchmarkWord(26 + 26 * 26), "aaa");
+
+    ZipfSampler sampler(1000);
+    Vector<int> counts(1000);
+    for (int i = 0; i < 100000; i++) {
+        counts[sampler.next()]++;
+    }
+    EXPECT(counts[0] > counts[1] && counts[1] > counts[9] && counts[9] > counts[99]);
+    EXPECT(abs(counts[0] / (double) counts[1] - 2) < 0.2); //rank 1 is half as likely as rank 0
+
+    string filename = "res/generated-zipf.txt";
+    writeZipfCorpus(filename, 500, 1000, 20);
+    Map<string, Set<string>> docs = readDocs(filename);
+    deleteFile(filename);
+    EXPECT_EQUAL(docs.size(), 500);
+    EXPECT(buildIndex(docs).containsKey("a"));
+
+    Vector<string> queries = generateQueryLog(2000, 1000);
+    int intersections = 0;
+    int differences = 0;
+    for (const string& query : queries) {
+        intersections += query.find(" +") != string::npos;
+        differences += query.find(" -") != string::npos;
+    }
+    EXPECT_EQUAL(queries.size(), 2000);
+    EXPECT(intersections > 200 && differences > 100);
+}
+
+STUDENT_TEST("Search benchmark on a 20000 page Zipf corpus") {
+    SearchBenchmarkConfig config;
+    config.numQueries = 1000; //common words make some queries take tens of milliseconds
+    Vector<BenchmarkMetric> metrics = runSearchBenchmark(config);
+    printBenchmarkReport(cout, config, metrics);
+
+    Map<string, double> byName;
+    for (const BenchmarkMetric& metric : metrics) {
+        byName[metric.name] = metric.value;
+    }
+    EXPECT_EQUAL(byName["search.map.query_us.count"], config.numQueries);
+    EXPECT(byName["search.map.query_us.p50"] <= byName["search.map.query_us.p99"]);
+    EXPECT(byName["search.map.query_us.p99"] <= byName["search.map.query_us.p999"]);
+    EXPECT(byName["search.map.index_bytes"] > 0);
+    EXPECT(!fileExists(config.corpusFile));
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "map.h"
+#include "set.h"
+#include "vector.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Draws word ranks from a Zipf distribution over ranks 0 to size - 1: rank r is drawn with
+ * probability proportional to 1 / (r + 1)^exponent, so a few words are very common and most
+ * are rare, like the words of real text.
+ */
+class ZipfSampler {
+public:
+    ZipfSampler(int size, double exponent = 1.0);
+
+    /**
+     * Returns a random rank, using the Stanford random number generator.
+     */
+    int next() const;
+
+private:
+    std::vector<double> cumulative;     // cumulative[r] is the probability of ranks 0 to r
+};
+
+/**
+ * Returns the made-up word for a vocabulary rank: "a", "b", ... "z", "aa", "ab", ...
+ */
+std::string benchmarkWord(int rank);
+
+/**
+ * Writes a database file in the readDocs format with numPages pages whose words are drawn
+ * from a Zipf vocabulary of vocabularySize words. Page lengths are uniform between 1 and
+ * twice wordsPerPage.
+ */
+void writeZipfCorpus(std::string filename, int numPages, int vocabularySize, int wordsPerPage,
+                     double exponent = 1.0);
+
+/**
+ * Returns numQueries queries over the same Zipf vocabulary. Every query has one to four
+ * terms; after the first, about 60% of terms are unions, 25% '+' and 15% '-'.
+ */
+Vector<std::string> generateQueryLog(int numQueries, int vocabularySize, double exponent = 1.0);
+
+/**
+ * Percentiles of a set of latencies, in microseconds.
+ */
+struct LatencySummary {
+    int count;
+    double mean;
+    double p50;
+    double p99;
+    double p999;
+    double max;
+};
+
+/**
+ * Summarizes latencies given in microseconds, using nearest-rank percentiles. An empty
+ * list summarizes to all zeros.
+ */
+LatencySummary summarizeLatencies(Vector<double> latencies);
+
+/**
+ * Returns an estimate of the bytes a Map index built by buildIndex uses: a tree node per
+ * term and per URL in every term's set, plus the heap storage of strings too long for the
+ * small-string buffer.
+ */
+long long estimateIndexBytes(const Map<std::string, Set<std::string>>& index);
+
+/**
+ * The settings of one benchmark run. The same settings and seed always generate the same
+ * corpus and queries, so runs can be compared with each other.
+ */
+struct SearchBenchmarkConfig {
+    int numPages = 20000;
+    int vocabularySize = 50000;
+    int wordsPerPage = 50;
+    double zipfExponent = 1.0;
+    int numQueries = 5000;
+    int seed = 106;
+    std::string corpusFile = "res/generated-benchmark.txt";
+};
+
+/**
+ * One measurement of a benchmark run. Names are fixed and dotted, like
+ * "search.map.query_us.p99", and the unit is the last part of the name before any
+ * percentile.
+ */
+struct BenchmarkMetric {
+    std::string name;
+    double value;
+};
+
+/**
+ * Generates the corpus and query log for config, then times building the Map index with
+ * readDocs and buildIndex and answering every query with findQueryMatches, and does the
+ * same for a PostingIndex answering every query with findTopMatches(query, 10). The corpus
+ * file is deleted afterwards. search.peak_memory_bytes is the most memory the whole process
+ * has held so far, where the platform reports it.
+ */
+Vector<BenchmarkMetric> runSearchBenchmark(const SearchBenchmarkConfig& config);
+
+/**
+ * Prints the config and the metrics one per line as "name value", so two runs can be
+ * compared with diff or a script.
+ */
+void printBenchmarkReport(std::ostream& out, const SearchBenchmarkConfig& config,
+                          const Vector<BenchmarkMetric>& metrics);
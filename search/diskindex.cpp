@@ -0,0 +1,528 @@
+//An index built with bounded memory and kept on disk: postings are collected SPIMI style,
+//spilled to sorted run files whenever they outgrow a memory budget, and merged into one
+//index file that is read back a posting list at a time
+
+#include "testing/SimpleTest.h"
+#include "diskindex.h"
+#include "search.h"
+#include "hashmap.h"
+#include "filelib.h"
+#include "strlib.h"
+#include "random.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <queue>
+#include <sstream>
+using namespace std;
+
+//every index file starts with these bytes, followed by the offsets of its URL table and its
+//term table as 8-byte little-endian numbers. posting lists fill the rest of the file up to
+//the URL table
+const string INDEX_MAGIC = "SPIMIIX1";
+const long long POSTINGS_START = 24;
+
+//estimated bytes a term costs in memory besides its characters and postings: its hash map
+//entry, string and vector
+const long long TERM_OVERHEAD = 64;
+
+//this function writes value to out as a varint, like appendVarint
+void writeVarint(ostream& out, unsigned int value) {
+    while (value >= 0x80) {
+        out.put((char) (value | 0x80));
+        value >>= 7;
+    }
+    out.put((char) value);
+}
+
+//this function reads a varint from in into value, returning false if the stream ends first
+bool readVarint(istream& in, unsigned int& value) {
+    value = 0;
+    int shift = 0;
+    int byte;
+    while ((byte = in.get()) != EOF) {
+        value |= (unsigned int) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+void writeString(ostream& out, const string& text) {
+    writeVarint(out, text.length());
+    out.write(text.data(), text.length());
+}
+
+bool readString(istream& in, string& text) {
+    unsigned int length;
+    if (!readVarint(in, length)) {
+        return false;
+    }
+    text.resize(length);
+    return (bool) in.read(&text[0], length);
+}
+
+void writeOffset(ostream& out, long long offset) {
+    for (int i = 0; i < 8; i++) {
+        out.put((char) ((offset >> (8 * i)) & 0xff));
+    }
+}
+
+long long readOffset(istream& in) {
+    long long offset = 0;
+    for (int i = 0; i < 8; i++) {
+        offset |= (long long) (in.get() & 0xff) << (8 * i);
+    }
+    return offset;
+}
+
+//this function writes one run: every term in sorted order, each followed by its number of
+//postings and its docIds as gaps. the block is emptied
+void spillRun(HashMap<string, vector<int>>& block, const string& runfile) {
+    vector<string> terms;
+    for (const string& term : block) {
+        terms.push_back(term);
+    }
+    sort(terms.begin(), terms.end());
+
+    ofstream out(runfile, ios::binary);
+    if (!out) {
+        error("Cannot write run file " + runfile);
+    }
+    for (const string& term : terms) {
+        const vector<int>& docIds = block[term];
+        writeString(out, term);
+        writeVarint(out, docIds.size());
+        int previous = 0;
+        for (int docId : docIds) {
+            writeVarint(out, docId - previous);
+            previous = docId;
+        }
+    }
+    if (!out) {
+        error("Cannot write run file " + runfile);
+    }
+    block.clear();
+}
+
+//reads a run file one term at a time during the merge
+struct RunReader {
+    ifstream in;
+    string runfile;
+    string term;
+    vector<int> docIds;
+
+    void open(const string& filename) {
+        runfile = filename;
+        in.open(runfile, ios::binary);
+        if (!in) {
+            error("Cannot open run file " + runfile);
+        }
+    }
+
+    //this function reads the next term and its postings, returning false at the end of the
+    //run. a run that ends partway through a term calls error()
+    bool next() {
+        if (in.peek() == EOF) {
+            return false;
+        }
+        unsigned int count;
+        if (!readString(in, term) || !readVarint(in, count)) {
+            error("Run file " + runfile + " is damaged");
+        }
+        docIds.clear();
+        int docId = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int gap;
+            if (!readVarint(in, gap)) {
+                error("Run file " + runfile + " is damaged");
+            }
+            docId += gap;
+            docIds.push_back(docId);
+        }
+        return true;
+    }
+};
+
+//this function merges the runs into the posting lists of the index file, appending each
+//term's entry to termTable. runs hold increasing docIds, so the postings of a term are
+//joined in run order; the heap orders entries by term and then by run to make that happen
+void mergeRuns(const Vector<string>& runFiles, ostream& out, ostream& termTable, int& numTerms) {
+    vector<unique_ptr<RunReader>> runs;
+    typedef pair<string, int> HeapEntry;
+    priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry>> heap;
+    for (const string& runfile : runFiles) {
+        runs.emplace_back(new RunReader());
+        runs.back()->open(runfile);
+        if (runs.back()->next()) {
+            heap.push({runs.back()->term, runs.size() - 1});
+        }
+    }
+
+    numTerms = 0;
+    while (!heap.empty()) {
+        string term = heap.top().first;
+        long long start = out.tellp();
+        int count = 0;
+        int previous = 0;
+        while (!heap.empty() && heap.top().first == term) {
+            RunReader& run = *runs[heap.top().second];
+            int runIndex = heap.top().second;
+            heap.pop();
+            for (int docId : run.docIds) {
+                writeVarint(out, docId - previous);
+                previous = docId;
+                count++;
+            }
+            if (run.next()) {
+                heap.push({run.term, runIndex});
+            }
+        }
+        writeString(termTable, term);
+        writeVarint(termTable, count);
+        writeVarint(termTable, (long long) out.tellp() - start);
+        numTerms++;
+    }
+}
+
+//this function streams the file twice. the first pass finds each URL's last listing, and
+//the second collects the postings of those listings, spilling a run whenever the estimated
+//size of the collected postings passes the budget. the runs are then merged, and the URL
+//and term tables are written after the postings. the term table is only known once the
+//merge is done, so it waits in a temporary file next to the runs rather than in memory
+int buildDiskIndex(string dbfile, string indexfile, long long memoryBudget, string tempDir) {
+    HashMap<string, int> lastListing;
+    {
+        DocStream stream(dbfile);
+        string url;
+        string content;
+        while (stream.next(url, content)) {
+            lastListing[url] = stream.pagesRead() - 1;
+        }
+    }
+
+    string tempPrefix = tempDir == "" ? indexfile : tempDir + "/" + getTail(indexfile);
+    string runPrefix = tempPrefix + ".run";
+    string termsfile = tempPrefix + ".terms";
+    Vector<string> runFiles;
+    Vector<string> urls;
+    HashMap<string, vector<int>> block;
+    long long blockBytes = 0;
+
+    DocStream stream(dbfile);
+    string url;
+    string content;
+    while (stream.next(url, content)) {
+        if (lastListing[url] != stream.pagesRead() - 1) {
+            continue;
+        }
+        int docId = urls.size();
+        urls.add(url);
+        LineTokenizer tokenizer(content);
+        string_view token;
+        while (tokenizer.next(token)) {
+            vector<int>& docIds = block[string(token)];
+            if (docIds.empty()) {
+                blockBytes += TERM_OVERHEAD + token.length();
+            }
+            if (docIds.empty() || docIds.back() != docId) {
+                docIds.push_back(docId);
+                blockBytes += sizeof(int);
+            }
+        }
+        if (blockBytes > memoryBudget) {
+            runFiles.add(runPrefix + integerToString(runFiles.size()));
+            spillRun(block, runFiles[runFiles.size() - 1]);
+            blockBytes = 0;
+        }
+    }
+    if (!block.isEmpty()) {
+        runFiles.add(runPrefix + integerToString(runFiles.size()));
+        spillRun(block, runFiles[runFiles.size() - 1]);
+    }
+
+    ofstream out(indexfile, ios::binary);
+    if (!out) {
+        error("Cannot write index file " + indexfile);
+    }
+    out.write(INDEX_MAGIC.data(), INDEX_MAGIC.length());
+    writeOffset(out, 0);
+    writeOffset(out, 0);
+
+    ofstream termTable(termsfile, ios::binary);
+    if (!termTable) {
+        error("Cannot write term table file " + termsfile);
+    }
+    int numTerms;
+    mergeRuns(runFiles, out, termTable, numTerms);
+    termTable.close();
+    for (const string& runfile : runFiles) {
+        deleteFile(runfile);
+    }
+    if (!termTable) {
+        error("Cannot write term table file " + termsfile);
+    }
+
+    long long urlTableOffset = out.tellp();
+    writeVarint(out, urls.size());
+    for (const string& page : urls) {
+        writeString(out, page);
+    }
+    long long termTableOffset = out.tellp();
+    writeVarint(out, numTerms);
+    {
+        ifstream terms(termsfile, ios::binary);
+        if (numTerms > 0) {
+            out << terms.rdbuf(); //copying nothing would set out's failbit
+        }
+    }
+    deleteFile(termsfile);
+    out.seekp(INDEX_MAGIC.length());
+    writeOffset(out, urlTableOffset);
+    writeOffset(out, termTableOffset);
+    if (!out) {
+        error("Cannot write index file " + indexfile);
+    }
+    return runFiles.size();
+}
+
+//this constructor checks the header, loads the URL table, and rebuilds the term dictionary
+//and posting offsets from the term table. terms were written in sorted order, so their
+//dictionary ids are their positions in the table
+DiskIndex::DiskIndex(string indexfile) {
+    in.open(indexfile, ios::binary);
+    if (!in) {
+        error("Cannot open file named " + indexfile);
+    }
+    string magic(INDEX_MAGIC.length(), ' ');
+    in.read(&magic[0], magic.length());
+    if (!in || magic != INDEX_MAGIC) {
+        error(indexfile + " is not an index file");
+    }
+    long long urlTableOffset = readOffset(in);
+    long long termTableOffset = readOffset(in);
+
+    in.seekg(urlTableOffset);
+    unsigned int count;
+    bool valid = readVarint(in, count);
+    string text;
+    for (unsigned int i = 0; i < count && valid; i++) {
+        valid = readString(in, text);
+        urls.add(text);
+    }
+
+    in.seekg(termTableOffset);
+    valid = valid && readVarint(in, count);
+    Vector<string> terms;
+    long long offset = POSTINGS_START;
+    for (unsigned int i = 0; i < count && valid; i++) {
+        unsigned int postings = 0;
+        unsigned int bytes = 0;
+        valid = readString(in, text) && readVarint(in, postings) && readVarint(in, bytes);
+        terms.add(text);
+        postingOffsets.push_back(offset);
+        postingCounts.push_back(postings);
+        offset += bytes;
+    }
+    postingOffsets.push_back(offset);
+    if (!valid || offset != urlTableOffset) {
+        error("Index file " + indexfile + " is damaged");
+    }
+    dictionary = TermDictionary(terms);
+}
+
+int DiskIndex::size() const {
+    return urls.size();
+}
+
+int DiskIndex::termCount() const {
+    return dictionary.size();
+}
+
+//this function reads a varint from the bytes between data and end into value, moving data
+//past it, and returns false if the bytes end first
+bool readVarint(const unsigned char*& data, const unsigned char* end, unsigned int& value) {
+    value = 0;
+    int shift = 0;
+    while (data != end) {
+        unsigned char byte = *data++;
+        value |= (unsigned int) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+//this function reads one posting list from the file and decodes its gaps into docIds. a
+//list that does not decode to exactly its count of docIds within its bytes calls error()
+void DiskIndex::readPostings(int termId, vector<int>& docIds) const {
+    vector<unsigned char> bytes(postingOffsets[termId + 1] - postingOffsets[termId]);
+    {
+        lock_guard<mutex> guard(readLock);
+        in.clear();
+        in.seekg(postingOffsets[termId]);
+        in.read((char*) bytes.data(), bytes.size());
+        if (!in) {
+            error("Cannot read the postings of " + dictionary.term(termId));
+        }
+    }
+
+    docIds.clear();
+    const unsigned char* data = bytes.data();
+    const unsigned char* end = data + bytes.size();
+    unsigned int docId = 0;
+    for (int i = 0; i < postingCounts[termId]; i++) {
+        unsigned int gap;
+        if (!readVarint(data, end, gap) || (docId += gap) >= (unsigned int) urls.size()) {
+            error("The postings of " + dictionary.term(termId) + " are damaged");
+        }
+        docIds.push_back(docId);
+    }
+    if (data != end) {
+        error("The postings of " + dictionary.term(termId) + " are damaged");
+    }
+}
+
+Set<string> DiskIndex::matchesFor(const string& term) const {
+    Set<string> result;
+    if (term.find(' ') != string::npos) {
+        return result;
+    }
+    vector<int> docIds;
+    for (int termId : dictionary.matching(term)) {
+        readPostings(termId, docIds);
+        for (int docId : docIds) {
+            result.add(urls[docId]);
+        }
+    }
+    return result;
+}
+
+long long DiskIndex::matchEstimate(const string& term) const {
+    long long estimate = 0;
+    if (term.find(' ') == string::npos) {
+        for (int termId : dictionary.matching(term)) {
+            estimate += postingCounts[termId];
+        }
+    }
+    return estimate;
+}
+
+Set<string> DiskIndex::findQueryMatches(string query) const {
+    return evaluateQuery(query, [&](const string& term) {
+        return matchesFor(term);
+    }, [&](const string& term) {
+        return matchEstimate(term);
+    });
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("DiskIndex of tiny.txt answers queries like the Map index, however many runs it took") {
+    Map<string, Set<string>> mapIndex = buildIndex(readDocs("res/tiny.txt"));
+    Vector<string> queries = {"fish", "red fish", "fish +red", "fish -blue", "EGGS!", "i'm",
+                              "hippo", "milk +fish -eggs", "yellow -milk -you"};
+    string indexfile = "res/generated-tiny.idx";
+    for (long long budget : {1LL, 1LL << 20}) {
+        int runs = buildDiskIndex("res/tiny.txt", indexfile, budget, "res");
+        EXPECT_EQUAL(runs, budget == 1 ? 4 : 1);
+        EXPECT(!fileExists("res/generated-tiny.idx.run0"));
+
+        DiskIndex index(indexfile);
+        EXPECT_EQUAL(index.size(), 4);
+        EXPECT_EQUAL(index.termCount(), 20);
+        for (const string& query : queries) {
+            EXPECT_EQUAL(index.findQueryMatches(query), findQueryMatches(mapIndex, query));
+        }
+        EXPECT_EQUAL(index.findQueryMatches("f*"), Set<string>({"www.shoppinglist.com", "www.dr.seuss.net"}));
+        EXPECT(index.findQueryMatches("\"red fish\"").isEmpty());
+    }
+    deleteFile(indexfile);
+
+    EXPECT_ERROR(DiskIndex("res/missing.idx"));
+    EXPECT_ERROR(DiskIndex("res/tiny.txt"));
+    EXPECT_ERROR(buildDiskIndex("res/missing.txt", indexfile));
+}
+
+STUDENT_TEST("damaged run files and posting lists call error instead of reading past their end") {
+    string runfile = "res/generated-damaged.run0";
+    ofstream run(runfile, ios::binary);
+    writeString(run, "fish");
+    writeVarint(run, 3); //promises three docIds but only holds one
+    writeVarint(run, 1);
+    run.close();
+    ostringstream out;
+    ostringstream termTable;
+    int numTerms;
+    EXPECT_ERROR(mergeRuns({runfile}, out, termTable, numTerms));
+    deleteFile(runfile);
+    EXPECT_ERROR(mergeRuns({runfile}, out, termTable, numTerms));
+
+    string indexfile = "res/generated-damaged.idx";
+    buildDiskIndex("res/tiny.txt", indexfile, 1 << 20, "res");
+    EXPECT(!fileExists("res/generated-damaged.idx.terms"));
+    EXPECT_EQUAL(DiskIndex(indexfile).findQueryMatches("fish").size(), 2);
+    fstream file(indexfile, ios::binary | ios::in | ios::out);
+    file.seekp(POSTINGS_START);
+    for (int i = 0; i < 4; i++) {
+        file.put((char) 0xff); //every byte says another one follows
+    }
+    file.close();
+    DiskIndex damaged(indexfile);
+    Set<string> matches;
+    EXPECT_ERROR(matches = damaged.matchesFor("*"));
+    deleteFile(indexfile);
+}
+
+STUDENT_TEST("DiskIndex merged from many runs matches buildIndex on a generated file") {
+    string filename = "res/generated-spimi.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 6000; page++) {
+        out << "www.page" << page % 5000 << ".com" << endl; //the last 1000 listings replace earlier ones
+        for (int w = randomInteger(1, 30); w > 0; w--) {
+            out << "word" << randomInteger(0, 300) << (randomChance(0.1) ? "! " : " ");
+        }
+        out << endl;
+    }
+    out.close();
+
+    string indexfile = "res/generated-spimi.idx";
+    int runs = buildDiskIndex(filename, indexfile, 32 << 10);
+    EXPECT(runs > 5);
+    Map<string, Set<string>> mapIndex = buildIndex(readDocs(filename));
+    deleteFile(filename);
+
+    DiskIndex index(indexfile);
+    EXPECT_EQUAL(index.size(), 5000);
+    EXPECT_EQUAL(index.termCount(), mapIndex.size());
+    for (const string& word : mapIndex) {
+        EXPECT_EQUAL(index.matchesFor(word), mapIndex[word]);
+    }
+    EXPECT_EQUAL(index.findQueryMatches("word1 +word2 -word3"), findQueryMatches(mapIndex, "word1 +word2 -word3"));
+    deleteFile(indexfile);
+}
+
+STUDENT_TEST("buildDiskIndex time trials against readDocs and buildIndex") {
+    string filename = "res/generated-spimi.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 20000; page++) {
+        out << "www.page" << page << ".com" << endl;
+        for (int w = randomInteger(10, 60); w > 0; w--) {
+            out << "word" << (int) (pow(randomReal(0, 1), 3) * 5000) << " ";
+        }
+        out << endl;
+    }
+    out.close();
+    string indexfile = "res/generated-spimi.idx";
+
+    TIME_OPERATION(20000, buildIndex(readDocs(filename)));
+    TIME_OPERATION(20000, buildDiskIndex(filename, indexfile, 1 << 20));
+    TIME_OPERATION(20000, buildDiskIndex(filename, indexfile, 64 << 20));
+    deleteFile(filename);
+    deleteFile(indexfile);
+}
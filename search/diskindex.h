@@ -0,0 +1,80 @@
+#pragma once
+#include "set.h"
+#include "vector.h"
+#include "termdictionary.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Builds an index file for a database file too big to index in memory, SPIMI style. Pages
+ * are streamed and their postings collected in memory until they would take more than
+ * memoryBudget bytes; then the terms are sorted and the postings written out as a run file
+ * in tempDir, and collection starts over. Once every page is read, all runs are merged in
+ * one k-way merge into indexfile, which DiskIndex reads.
+ *
+ * Runs, and the term table while the merge writes it, are named after indexfile and
+ * deleted once merged. An empty tempDir puts them next to indexfile. A run file that cannot
+ * be read back in full calls error(). The URLs of the pages are kept in memory during the build, since postings
+ * far outnumber them. As with readDocs, a URL listed twice only keeps its last content.
+ * Returns the number of runs written.
+ */
+int buildDiskIndex(std::string dbfile, std::string indexfile, long long memoryBudget = 64 << 20,
+                   std::string tempDir = "");
+
+/**
+ * Reads an index file written by buildDiskIndex. The URLs and the term dictionary are
+ * loaded into memory; a term's posting list is only read from the file when a query asks
+ * for it. Safe to query from several threads at once.
+ */
+class DiskIndex {
+public:
+    /**
+     * Opens an index file. If it is missing or not an index file, this function calls error().
+     */
+    DiskIndex(std::string indexfile);
+
+    /**
+     * Returns the number of pages.
+     */
+    int size() const;
+
+    /**
+     * Returns the number of distinct terms.
+     */
+    int termCount() const;
+
+    /**
+     * Returns the URLs of every page containing a cleaned term. A term with a '*' in it is
+     * a wildcard matching every term it matches, as in PostingIndex. Phrases and NEAR terms
+     * need word positions, which this index does not keep, so they match nothing. If a
+     * posting list in the file is damaged, this function calls error().
+     */
+    Set<std::string> matchesFor(const std::string& term) const;
+
+    /**
+     * Returns an upper bound on the number of pages matchesFor(term) returns, read from
+     * the term table without touching any posting list.
+     */
+    long long matchEstimate(const std::string& term) const;
+
+    /**
+     * Returns the URLs matching query, using the same rules as findQueryMatches. The
+     * query runs through a query plan, so posting lists a plan skips are never read.
+     */
+    Set<std::string> findQueryMatches(std::string query) const;
+
+private:
+    Vector<std::string> urls;
+    TermDictionary dictionary;
+    std::vector<long long> postingOffsets;      // indexed by term id, plus one past the end
+    std::vector<int> postingCounts;             // indexed by term id
+    mutable std::ifstream in;
+    mutable std::mutex readLock;                // guards in
+
+    void readPostings(int termId, std::vector<int>& docIds) const;
+
+    DiskIndex(const DiskIndex&) = delete;
+    DiskIndex& operator=(const DiskIndex&) = delete;
+};
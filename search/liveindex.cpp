@@ -0,0 +1,517 @@
+//A live inverted index that pages can be added to, replaced in, or deleted from without
+//rebuilding the whole index. Updates are kept in small segments that a background thread
+//merges together, and queries always read one consistent view of the segments
+
+#include "testing/SimpleTest.h"
+#include "liveindex.h"
+#include "search.h"
+#include "strlib.h"
+#include "random.h"
+#include <atomic>
+#include <fstream>
+using namespace std;
+
+//this function returns how many URLs a segment adds or deletes, which is how segment
+//sizes are compared when choosing what to merge
+int IndexSegment::updateCount() const {
+    return docs.size() + tombstones.size();
+}
+
+//this function checks the sealed segments newer than segments[i] through shadowed[i], and
+//then the delta, unless segments[i] is the delta
+bool IndexView::isShadowed(int i, const string& url) const {
+    if (shadowed[i]->contains(url)) {
+        return true;
+    }
+    if (!hasDelta || i == segments.size() - 1) {
+        return false;
+    }
+    const IndexSegment& delta = *segments[segments.size() - 1];
+    return delta.docs.containsKey(url) || delta.tombstones.contains(url);
+}
+
+//this function returns the live URLs containing term. each segment answers it like a Map
+//index, which works because a page's newest content is all in one segment, and then
+//postings for URLs that a newer segment replaced or deleted are skipped; the delta's few
+//URLs are removed one at a time
+Set<string> IndexView::matchesFor(const string& term) const {
+    Set<string> result;
+    int deltaIndex = segments.size() - 1;
+    for (int i = 0; i < segments.size(); i++) {
+        Set<string> postings = mapMatchesFor(segments[i]->postings, term);
+        if (postings.isEmpty()) {
+            continue;
+        }
+        if (!shadowed[i]->isEmpty()) {
+            postings = postings - *shadowed[i];
+        }
+        if (hasDelta && i < deltaIndex) {
+            for (const string& url : segments[deltaIndex]->docs) {
+                postings.remove(url);
+            }
+            for (const string& url : segments[deltaIndex]->tombstones) {
+                postings.remove(url);
+            }
+        }
+        result += postings;
+    }
+    return result;
+}
+
+//this function returns whether url is live. segments are checked newest first, so the
+//first segment that mentions url decides
+bool IndexView::containsDoc(const string& url) const {
+    for (int i = segments.size() - 1; i >= 0; i--) {
+        if (segments[i]->docs.containsKey(url)) {
+            return true;
+        }
+        if (segments[i]->tombstones.contains(url)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+//this function returns the tokens of the newest live version of url, or an empty set
+Set<string> IndexView::tokensFor(const string& url) const {
+    for (int i = segments.size() - 1; i >= 0; i--) {
+        if (segments[i]->docs.containsKey(url)) {
+            return segments[i]->docs.get(url);
+        }
+        if (segments[i]->tombstones.contains(url)) {
+            break;
+        }
+    }
+    return Set<string>();
+}
+
+//this function counts the live pages across all segments
+int IndexView::size() const {
+    int count = 0;
+    for (int i = 0; i < segments.size(); i++) {
+        for (const string& url : segments[i]->docs) {
+            if (!isShadowed(i, url)) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+//this function merges a run of consecutive segments (oldest to newest) into one segment.
+//newer segments win over older ones, and tombstones are only kept when an older segment
+//outside the run could still hold the deleted URL
+shared_ptr<const IndexSegment> mergeSegments(const Vector<shared_ptr<const IndexSegment>>& inputs,
+                                             bool includesOldest) {
+    shared_ptr<IndexSegment> merged = make_shared<IndexSegment>();
+    Set<string> newer; //URLs replaced or deleted by an input newer than the one being read
+
+    for (int i = inputs.size() - 1; i >= 0; i--) {
+        const IndexSegment& segment = *inputs[i];
+        for (const string& url : segment.docs) {
+            if (!newer.contains(url)) {
+                merged->docs[url] = segment.docs.get(url);
+            }
+        }
+        for (const string& term : segment.postings) {
+            Set<string> live = segment.postings.get(term) - newer;
+            if (!live.isEmpty()) {
+                merged->postings[term] += live;
+            }
+        }
+        for (const string& url : segment.tombstones) {
+            if (!includesOldest && !newer.contains(url)) {
+                merged->tombstones.add(url);
+            }
+            newer.add(url);
+        }
+        for (const string& url : segment.docs) {
+            newer.add(url);
+        }
+    }
+    return merged;
+}
+
+//this constructor creates an empty index and starts the background merge thread
+LiveIndex::LiveIndex(int deltaCapacity, int maxSegments, int cacheCapacity) : cache(cacheCapacity) {
+    if (deltaCapacity < 1 || maxSegments < 1) {
+        error("LiveIndex needs a delta capacity and segment limit of at least 1");
+    }
+    this->deltaCapacity = deltaCapacity;
+    this->maxSegments = maxSegments;
+    merging = false;
+    stopping = false;
+    publish();
+    merger = thread(&LiveIndex::mergeLoop, this);
+}
+
+//this constructor creates an index whose oldest segment holds docs and its inverted index
+LiveIndex::LiveIndex(Map<string, Set<string>>& docs, int deltaCapacity, int maxSegments, int cacheCapacity)
+    : LiveIndex(deltaCapacity, maxSegments, cacheCapacity) {
+    shared_ptr<IndexSegment> base = make_shared<IndexSegment>();
+    base->docs = docs;
+    base->postings = buildIndex(docs);
+
+    lock_guard<mutex> lock(writeLock);
+    addSealed(base);
+    publish();
+}
+
+//this destructor tells the merge thread to stop and waits for it. a merge in progress is
+//finished first
+LiveIndex::~LiveIndex() {
+    {
+        lock_guard<mutex> lock(writeLock);
+        stopping = true;
+    }
+    mergeSignal.notify_all();
+    merger.join();
+}
+
+void LiveIndex::addDocument(string url, string content) {
+    lock_guard<mutex> lock(writeLock);
+    if (current->containsDoc(url)) {
+        error("addDocument: " + url + " is already indexed, use replaceDocument");
+    }
+    writeDocument(url, content);
+}
+
+void LiveIndex::replaceDocument(string url, string content) {
+    lock_guard<mutex> lock(writeLock);
+    if (!current->containsDoc(url)) {
+        error("replaceDocument: " + url + " is not indexed");
+    }
+    writeDocument(url, content);
+}
+
+//this function deletes a page by writing a tombstone for it into the delta segment. the
+//tombstone hides any older copy of the page until a merge drops it for good
+void LiveIndex::removeDocument(string url) {
+    lock_guard<mutex> lock(writeLock);
+    if (!current->containsDoc(url)) {
+        error("removeDocument: " + url + " is not indexed");
+    }
+    Set<string> oldTokens = current->tokensFor(url);
+    deleteFromDelta(url);
+    delta.tombstones.add(url);
+    publish();
+    invalidate(oldTokens);
+}
+
+//this function cleans content and writes it into the delta segment as the newest version
+//of url. the caller must hold writeLock
+void LiveIndex::writeDocument(const string& url, const string& content) {
+    Set<string> oldTokens = current->tokensFor(url);
+    deleteFromDelta(url);
+
+    Set<string> tokens;
+    string line = content;
+    LineTokenizer tokenizer(line);
+    string_view token;
+    while (tokenizer.next(token)) {
+        tokens.add(string(token));
+    }
+
+    for (const string& word : tokens) {
+        delta.postings[word].add(url);
+    }
+    delta.docs[url] = tokens;
+    delta.tombstones.remove(url);
+    publish();
+    invalidate(oldTokens + tokens);
+}
+
+//this function drops the cached results that depend on any of the words. it runs after the
+//update is published, so a result computed before the update can never be cached after it
+void LiveIndex::invalidate(const Set<string>& words) {
+    for (const string& word : words) {
+        cache.invalidateWord(word);
+    }
+}
+
+//this function removes url's content from the delta segment if the delta has any.
+//the caller must hold writeLock
+void LiveIndex::deleteFromDelta(const string& url) {
+    if (!delta.docs.containsKey(url)) {
+        return;
+    }
+    for (const string& word : delta.docs[url]) {
+        delta.postings[word].remove(url);
+        if (delta.postings[word].isEmpty()) {
+            delta.postings.remove(word);
+        }
+    }
+    delta.docs.remove(url);
+}
+
+//this function appends a newly sealed segment. its URLs are added to the shadowed set of
+//every older sealed segment, which costs the size of the new segment times the number of
+//segments, and never walks the older segments themselves. the caller must hold writeLock
+void LiveIndex::addSealed(shared_ptr<const IndexSegment> segment) {
+    for (int i = 0; i < sealed.size(); i++) {
+        shared_ptr<Set<string>> grown = make_shared<Set<string>>(*sealedShadowed[i]);
+        *grown += segment->tombstones;
+        for (const string& url : segment->docs) {
+            grown->add(url);
+        }
+        sealedShadowed[i] = grown;
+    }
+    sealed.add(segment);
+    sealedShadowed.add(make_shared<const Set<string>>());
+}
+
+//this function seals the delta segment if it is full and publishes a new view holding the
+//sealed segments plus a frozen copy of the delta. the shadowed sets of the sealed segments
+//are shared with the last view, so only the delta is copied. the caller must hold writeLock
+void LiveIndex::publish() {
+    if (delta.updateCount() >= deltaCapacity) {
+        addSealed(make_shared<const IndexSegment>(move(delta)));
+        delta = IndexSegment();
+        if (needsMerge()) {
+            mergeSignal.notify_all();
+        }
+    }
+
+    shared_ptr<IndexView> next = make_shared<IndexView>();
+    next->segments = sealed;
+    next->shadowed = sealedShadowed;
+    next->hasDelta = delta.updateCount() > 0;
+    if (next->hasDelta) {
+        next->segments.add(make_shared<const IndexSegment>(delta));
+        next->shadowed.add(make_shared<const Set<string>>());
+    }
+    atomic_store(&current, shared_ptr<const IndexView>(next));
+}
+
+//this function returns whether there are more sealed segments than allowed.
+//the caller must hold writeLock
+bool LiveIndex::needsMerge() const {
+    return sealed.size() > maxSegments;
+}
+
+//this function runs on the background thread. whenever there are too many sealed segments
+//it picks the newest run of similarly sized segments (a segment joins the run while it is no
+//more than twice the size of everything newer), merges them without holding the lock, and
+//then swaps the merged segment in. writers only ever append newer segments, so the run's
+//positions are unchanged when it is swapped in
+void LiveIndex::mergeLoop() {
+    unique_lock<mutex> lock(writeLock);
+    while (true) {
+        mergeSignal.wait(lock, [&] { return stopping || needsMerge(); });
+        if (stopping) {
+            return;
+        }
+        merging = true;
+
+        int end = sealed.size();
+        int start = end - 1;
+        int newerUpdates = sealed[start]->updateCount();
+        while (start > 0 && sealed[start - 1]->updateCount() <= 2 * newerUpdates) {
+            start--;
+            newerUpdates += sealed[start]->updateCount();
+        }
+        start = min(start, end - 2);
+
+        Vector<shared_ptr<const IndexSegment>> inputs;
+        for (int i = start; i < end; i++) {
+            inputs.add(sealed[i]);
+        }
+
+        lock.unlock();
+        shared_ptr<const IndexSegment> merged = mergeSegments(inputs, start == 0);
+        lock.lock();
+
+        //the merged segment is shadowed by what shadowed the newest segment of the run. the
+        //older segments keep their sets, since the merged segment touches the same URLs as
+        //the run, less tombstones that are only dropped when nothing is older
+        Vector<shared_ptr<const IndexSegment>> updated;
+        Vector<shared_ptr<const Set<string>>> updatedShadowed;
+        for (int i = 0; i < sealed.size(); i++) {
+            if (i == start) {
+                updated.add(merged);
+                updatedShadowed.add(sealedShadowed[end - 1]);
+            }
+            else if (i < start || i >= end) {
+                updated.add(sealed[i]);
+                updatedShadowed.add(sealedShadowed[i]);
+            }
+        }
+        sealed = updated;
+        sealedShadowed = updatedShadowed;
+        merging = false;
+        publish();
+        mergeSignal.notify_all();
+    }
+}
+
+Set<string> LiveIndex::findQueryMatches(string query) const {
+    return cache.lookup(query, [&](const string& uncached) {
+        shared_ptr<const IndexView> snapshot = view();
+        return evaluateQuery(uncached, [&](const string& term) {
+            return snapshot->matchesFor(term);
+        });
+    });
+}
+
+const QueryCache<Set<string>>& LiveIndex::queryCache() const {
+    return cache;
+}
+
+shared_ptr<const IndexView> LiveIndex::view() const {
+    return atomic_load(&current);
+}
+
+int LiveIndex::size() const {
+    return view()->size();
+}
+
+int LiveIndex::segmentCount() const {
+    return view()->segments.size();
+}
+
+void LiveIndex::waitForMerges() {
+    unique_lock<mutex> lock(writeLock);
+    mergeSignal.wait(lock, [&] { return !merging && !needsMerge(); });
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("LiveIndex on tiny.txt sees added, replaced and removed pages") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    Map<string, Set<string>> tinyIndex = buildIndex(docs);
+    LiveIndex index(docs);
+    EXPECT_EQUAL(index.size(), 4);
+    EXPECT_EQUAL(index.findQueryMatches("red fish"), findQueryMatches(tinyIndex, "red fish"));
+
+    index.addDocument("www.pond.org", "A red FISH swims");
+    EXPECT_EQUAL(index.size(), 5);
+    EXPECT_EQUAL(index.findQueryMatches("red +fish").size(), 2);
+    EXPECT_ERROR(index.addDocument("www.pond.org", "again"));
+
+    index.replaceDocument("www.dr.seuss.net", "no colors here");
+    EXPECT_EQUAL(index.findQueryMatches("red +fish"), Set<string>({"www.pond.org"}));
+    EXPECT_EQUAL(index.findQueryMatches("colors"), Set<string>({"www.dr.seuss.net"}));
+
+    index.removeDocument("www.rainbow.org");
+    EXPECT_EQUAL(index.size(), 4);
+    EXPECT(index.findQueryMatches("indigo").isEmpty());
+    EXPECT_ERROR(index.removeDocument("www.rainbow.org"));
+    EXPECT_ERROR(index.replaceDocument("www.rainbow.org", "red"));
+
+    index.addDocument("www.rainbow.org", "indigo again");
+    EXPECT_EQUAL(index.findQueryMatches("indigo"), Set<string>({"www.rainbow.org"}));
+    EXPECT(index.findQueryMatches("violet").isEmpty());
+}
+
+STUDENT_TEST("LiveIndex answers phrase and NEAR terms with the live pages holding all their words") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    LiveIndex index(docs);
+    Vector<string> queries = {"\"red fish\"", "red NEAR/2 fish", "milk -\"red fish\"", "\"one fish\" +blue",
+                              "eggs NEAR/1 milk NEAR/2 bread"};
+    for (const string& query : queries) {
+        EXPECT_EQUAL(index.findQueryMatches(query), findQueryMatches(buildIndex(docs), query));
+    }
+    EXPECT_EQUAL(index.findQueryMatches("\"red fish\""), Set<string>({"www.dr.seuss.net"}));
+    EXPECT_EQUAL(index.findQueryMatches("red NEAR/2 fish"), Set<string>({"www.dr.seuss.net"}));
+
+    //the words of a term have to be in the page's newest content, wherever its segment is
+    index.addDocument("www.pond.org", "a red fish swims");
+    index.replaceDocument("www.dr.seuss.net", "only red here");
+    docs["www.pond.org"] = {"a", "red", "fish", "swims"};
+    docs["www.dr.seuss.net"] = {"only", "red", "here"};
+    for (const string& query : queries) {
+        EXPECT_EQUAL(index.findQueryMatches(query), findQueryMatches(buildIndex(docs), query));
+    }
+    EXPECT_EQUAL(index.findQueryMatches("red NEAR/2 fish"), Set<string>({"www.pond.org"}));
+    index.removeDocument("www.pond.org");
+    EXPECT(index.findQueryMatches("\"red fish\"").isEmpty());
+}
+
+STUDENT_TEST("LiveIndex after many random updates and merges matches a full rebuild") {
+    Vector<string> words = {"red", "fish", "blue", "milk", "green", "bread", "eggs", "i'm"};
+    Map<string, Set<string>> expectedDocs;
+    LiveIndex index(3, 2);
+
+    for (int step = 0; step < 2000; step++) {
+        string url = "www.page" + integerToString(randomInteger(0, 99)) + ".com";
+        string content;
+        for (int w = 0; w < 4; w++) {
+            content += words[randomInteger(0, words.size() - 1)] + " ";
+        }
+        Set<string> tokens;
+        for (const string& word : stringSplit(content, " ")) {
+            tokens.add(cleanToken(word));
+        }
+
+        if (!expectedDocs.containsKey(url)) {
+            index.addDocument(url, content);
+            expectedDocs[url] = tokens;
+        }
+        else if (randomChance(0.5)) {
+            index.replaceDocument(url, content);
+            expectedDocs[url] = tokens;
+        }
+        else {
+            index.removeDocument(url);
+            expectedDocs.remove(url);
+        }
+    }
+    index.waitForMerges();
+
+    Map<string, Set<string>> expectedIndex = buildIndex(expectedDocs);
+    EXPECT_EQUAL(index.size(), expectedDocs.size());
+    EXPECT(index.segmentCount() <= 3);
+    for (const string& word : words) {
+        EXPECT_EQUAL(index.findQueryMatches(word), expectedIndex[word]);
+        EXPECT_EQUAL(index.findQueryMatches("red -" + word), findQueryMatches(expectedIndex, "red -" + word));
+    }
+}
+
+STUDENT_TEST("LiveIndex queries see one consistent view while pages are added and segments merge") {
+    LiveIndex index(4, 2);
+    atomic<bool> done(false);
+    atomic<int> inconsistent(0);
+
+    thread reader([&] {
+        int lastSeen = 0;
+        while (!done) {
+            shared_ptr<const IndexView> view = index.view();
+            int pages = view->size();
+            if (view->matchesFor("common").size() != pages || pages < lastSeen) {
+                inconsistent++;
+            }
+            lastSeen = pages;
+        }
+    });
+
+    for (int page = 0; page < 500; page++) {
+        index.addDocument("www.page" + integerToString(page) + ".com", "common unique" + integerToString(page));
+    }
+    done = true;
+    reader.join();
+    index.waitForMerges();
+
+    EXPECT_EQUAL(inconsistent.load(), 0);
+    EXPECT_EQUAL(index.findQueryMatches("common").size(), 500);
+    EXPECT_EQUAL(index.findQueryMatches("unique42"), Set<string>({"www.page42.com"}));
+}
+
+STUDENT_TEST("LiveIndex updates cost about the same on a small and a large base") {
+    for (int basePages : {2000, 100000}) {
+        Map<string, Set<string>> docs;
+        for (int page = 0; page < basePages; page++) {
+            docs["www.base" + integerToString(page) + ".com"] = {"common", "base" + integerToString(page % 100)};
+        }
+        LiveIndex index(docs);
+        int added = 0;
+        TIME_OPERATION(basePages, for (int i = 0; i < 2000; i++) {
+            index.addDocument("www.new" + integerToString(added++) + ".com", "common fresh");
+        });
+        index.removeDocument("www.base7.com");
+        index.waitForMerges();
+        EXPECT_EQUAL(index.size(), basePages + 2000 - 1);
+        EXPECT_EQUAL(index.findQueryMatches("fresh").size(), 2000);
+        EXPECT_EQUAL(index.findQueryMatches("common -fresh").size(), basePages - 1);
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "map.h"
+#include "set.h"
+#include "vector.h"
+#include "querycache.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * One immutable run of index updates. docs holds the pages whose newest content lives in
+ * this segment (URL -> cleaned tokens), postings is the inverted index of those pages and
+ * tombstones lists the URLs this segment deleted.
+ */
+struct IndexSegment {
+    Map<std::string, Set<std::string>> docs;
+    Map<std::string, Set<std::string>> postings;
+    Set<std::string> tombstones;
+
+    /**
+     * Returns the number of URLs this segment adds or deletes.
+     */
+    int updateCount() const;
+};
+
+/**
+ * A consistent, read-only view of a LiveIndex. segments runs from oldest to newest, and
+ * shadowed[i] holds every URL that a sealed segment newer than segments[i] replaced or
+ * deleted, so those URLs are ignored when reading segments[i]. If hasDelta is true, the
+ * newest segment is the unsealed delta; the URLs it touches also hide every older copy,
+ * and are looked up in it when reading instead of being copied into the shadowed sets, so
+ * publishing an update never walks the older segments.
+ */
+struct IndexView {
+    Vector<std::shared_ptr<const IndexSegment>> segments;
+    Vector<std::shared_ptr<const Set<std::string>>> shadowed;
+    bool hasDelta;
+
+    /**
+     * Returns whether a segment newer than segments[i] replaced or deleted url.
+     */
+    bool isShadowed(int i, const std::string& url) const;
+
+    /**
+     * Returns the live URLs whose content contains the cleaned term. Segments keep no word
+     * positions, so a phrase or NEAR term matches the live pages holding all its words, as
+     * with the Map findQueryMatches.
+     */
+    Set<std::string> matchesFor(const std::string& term) const;
+
+    /**
+     * Returns whether url is a live page in this view.
+     */
+    bool containsDoc(const std::string& url) const;
+
+    /**
+     * Returns the cleaned tokens of the live page url, or an empty set if it is not live.
+     */
+    Set<std::string> tokensFor(const std::string& url) const;
+
+    /**
+     * Returns the number of live pages in this view.
+     */
+    int size() const;
+};
+
+/**
+ * An inverted index that can be updated while it is being queried, built like a
+ * log-structured merge tree. Updates go into a small delta segment; once the delta holds
+ * deltaCapacity updates it is sealed, and a background thread merges sealed segments
+ * whenever there are more than maxSegments of them. Every update publishes a new IndexView,
+ * so a query always runs against one consistent set of segments, even mid-merge.
+ *
+ * Query results are kept in a QueryCache. An update invalidates the cached results that
+ * depend on any word of the old or new content of the page it touches; merges don't
+ * change results, so they leave the cache alone.
+ */
+class LiveIndex {
+public:
+    /**
+     * Creates an empty live index.
+     */
+    LiveIndex(int deltaCapacity = 64, int maxSegments = 4, int cacheCapacity = 1024);
+
+    /**
+     * Creates a live index whose first segment holds docs, as returned by readDocs.
+     */
+    LiveIndex(Map<std::string, Set<std::string>>& docs, int deltaCapacity = 64, int maxSegments = 4,
+              int cacheCapacity = 1024);
+
+    /**
+     * Stops the background merge thread.
+     */
+    ~LiveIndex();
+
+    /**
+     * Adds a new page. If url is already in the index, this function calls error().
+     */
+    void addDocument(std::string url, std::string content);
+
+    /**
+     * Replaces the content of a page. If url is not in the index, this function calls error().
+     */
+    void replaceDocument(std::string url, std::string content);
+
+    /**
+     * Deletes a page. If url is not in the index, this function calls error().
+     */
+    void removeDocument(std::string url);
+
+    /**
+     * Returns the URLs matching query, using the same rules as findQueryMatches. Repeated
+     * queries are answered from the query cache.
+     */
+    Set<std::string> findQueryMatches(std::string query) const;
+
+    /**
+     * Returns the query cache, for its hit and miss counters.
+     */
+    const QueryCache<Set<std::string>>& queryCache() const;
+
+    /**
+     * Returns the current view of the index. The view stays valid and unchanged for as
+     * long as the caller holds on to it.
+     */
+    std::shared_ptr<const IndexView> view() const;
+
+    /**
+     * Returns the number of live pages.
+     */
+    int size() const;
+
+    /**
+     * Returns the number of segments in the current view.
+     */
+    int segmentCount() const;
+
+    /**
+     * Blocks until the background thread has no merges left to do.
+     */
+    void waitForMerges();
+
+private:
+    int deltaCapacity;
+    int maxSegments;
+    mutable QueryCache<Set<std::string>> cache;             // locks itself
+
+    std::mutex writeLock;                                   // guards everything below
+    std::condition_variable mergeSignal;
+    Vector<std::shared_ptr<const IndexSegment>> sealed;     // oldest to newest
+    Vector<std::shared_ptr<const Set<std::string>>> sealedShadowed;  // as in IndexView, for sealed
+    IndexSegment delta;
+    bool merging;
+    bool stopping;
+    std::thread merger;
+
+    std::shared_ptr<const IndexView> current;               // read with std::atomic_load
+
+    void writeDocument(const std::string& url, const std::string& content);
+    void deleteFromDelta(const std::string& url);
+    void invalidate(const Set<std::string>& words);
+    void publish();
+    void addSealed(std::shared_ptr<const IndexSegment> segment);
+    bool needsMerge() const;
+    void mergeLoop();
+
+    LiveIndex(const LiveIndex&) = delete;
+    LiveIndex& operator=(const LiveIndex&) = delete;
+};
@@ -0,0 +1,904 @@
+//An inverted index that keeps term frequencies so pages can be ranked with BM25, and a
+//top-k search that uses each term's best possible score to skip pages that cannot make
+//the top k (the WAND algorithm)
+
+#include "testing/SimpleTest.h"
+#include "postingindex.h"
+#include "search.h"
+#include "filelib.h"
+#include "strlib.h"
+#include "random.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <fstream>
+#include <queue>
+using namespace std;
+
+//standard BM25 constants: K1 controls how quickly repeated terms stop adding score and
+//B controls how much long pages are penalized
+const double BM25_K1 = 1.2;
+const double BM25_B = 0.75;
+
+bool operator==(const ScoredMatch& a, const ScoredMatch& b) {
+    return a.url == b.url && a.score == b.score && a.docId == b.docId;
+}
+
+ostream& operator<<(ostream& out, const ScoredMatch& match) {
+    return out << match.url << " (" << match.score << ")";
+}
+
+//this function returns the BM25 inverse document frequency of a term found in
+//documentFrequency of numDocs pages
+double inverseDocumentFrequency(int numDocs, double documentFrequency) {
+    return log(1 + (numDocs - documentFrequency + 0.5) / (documentFrequency + 0.5));
+}
+
+//this function returns the average page length BM25 normalizes by, never less than one word
+double averageLengthOf(long long totalLength, int numDocs) {
+    return numDocs == 0 ? 0 : max(1.0, (double) totalLength / numDocs);
+}
+
+//this function returns the BM25 score a page of the given length gets from a term with the
+//given idf that appears frequency times in it
+double bm25(double idf, int frequency, int length, double averageLength) {
+    double lengthNorm = BM25_K1 * (1 - BM25_B + BM25_B * length / averageLength);
+    return idf * (double) frequency * (BM25_K1 + 1) / (frequency + lengthNorm);
+}
+
+//a term's postings and compressed positions for one thread's range of pages
+struct PartialPostings {
+    vector<Posting> postings;
+    vector<unsigned char> positions;
+};
+
+//this constructor streams the database file twice with a DocStream. the first pass only
+//finds each URL's last listing, since a URL listed twice only keeps its last content; the
+//second pass indexes the pages of this shard a batch at a time, so the raw file is never
+//held in memory. a shard still reads the whole file, since repeated URLs can only be
+//dropped by looking at every listing
+PostingIndex::PostingIndex(string dbfile, int shard, int numShards) {
+    if (numShards < 1 || shard < 0 || shard >= numShards) {
+        error("Shard " + integerToString(shard) + " of " + integerToString(numShards) + " does not exist");
+    }
+
+    HashMap<string, int> lastListing; //URL -> position of its last listing in the file
+    {
+        DocStream stream(dbfile);
+        string url;
+        string content;
+        while (stream.next(url, content)) {
+            lastListing[url] = stream.pagesRead() - 1;
+        }
+    }
+    firstDocId = (long long) lastListing.size() * shard / numShards;
+    int endDocId = (long long) lastListing.size() * (shard + 1) / numShards;
+
+    DocStream stream(dbfile);
+    Vector<string> batchUrls;
+    Vector<string> batchContents;
+    HashMap<string, int> termIds; //ids in order of first appearance, until the dictionary is built
+    int page = 0;  //position of the next kept page among all kept pages
+    while (page < endDocId) {
+        int firstListing = stream.pagesRead();
+        if (stream.readBatch(batchUrls, batchContents) == 0) {
+            break;
+        }
+        Vector<int> kept;
+        for (int i = 0; i < batchUrls.size(); i++) {
+            if (lastListing[batchUrls[i]] == firstListing + i) {
+                if (page >= firstDocId && page < endDocId) {
+                    urls.add(batchUrls[i]);
+                    kept.add(i);
+                }
+                page++;
+            }
+        }
+        indexBatch(batchContents, kept, termIds);
+    }
+
+    //terms are renumbered by their ids in the dictionary, which are in sorted order
+    Vector<string> terms;
+    for (const string& term : termIds) {
+        terms.add(term);
+    }
+    dictionary = TermDictionary(terms);
+    vector<vector<Posting>> sortedPostings(postings.size());
+    vector<vector<unsigned char>> sortedPositionData(positionData.size());
+    for (const string& term : termIds) {
+        int termId = dictionary.find(term);
+        sortedPostings[termId].swap(postings[termIds[term]]);
+        sortedPositionData[termId].swap(positionData[termIds[term]]);
+    }
+    postings.swap(sortedPostings);
+    positionData.swap(sortedPositionData);
+
+    totalLength = 0;
+    for (int length : docLengths) {
+        totalLength += length;
+    }
+    averageLength = averageLengthOf(totalLength, size());
+
+    for (const vector<Posting>& list : postings) {
+        idf.add(inverseDocumentFrequency(size(), list.size()));
+    }
+    for (int termId = 0; termId < (int) postings.size(); termId++) {
+        double best = 0;
+        int mostFrequent = 0;
+        int shortest = INT_MAX;
+        for (const Posting& posting : postings[termId]) {
+            best = max(best, score(termId, posting));
+            mostFrequent = max(mostFrequent, posting.frequency);
+            shortest = min(shortest, docLengths[posting.docId]);
+        }
+        maxScore.add(best);
+        maxFrequency.add(mostFrequent);
+        minLength.add(shortest);
+    }
+}
+
+//this function adds the pages contents[kept[0]], contents[kept[1]], ... as the next docIds.
+//pages are split across worker threads the same way readDocs splits them; each thread counts
+//term frequencies for its range of pages into partial posting lists, and the partial lists
+//are appended in thread order so every posting list stays sorted by docId
+void PostingIndex::indexBatch(Vector<string>& contents, const Vector<int>& kept, HashMap<string, int>& termIds) {
+    int docBase = docLengths.size();
+    int numDocs = kept.size();
+    int numThreads = ingestThreadCount(numDocs);
+    for (int doc = 0; doc < numDocs; doc++) {
+        docLengths.add(0);
+    }
+    Vector<HashMap<string, PartialPostings>> partialPostings(numThreads);
+
+    runInParallel(numDocs, numThreads, [&](int t, int begin, int end) {
+        for (int doc = begin; doc < end; doc++) {
+            HashMap<string, vector<int>> occurrences;
+            int length = 0;
+            LineTokenizer tokenizer(contents[kept[doc]]);
+            string_view token;
+            while (tokenizer.next(token)) {
+                occurrences[string(token)].push_back(length);
+                length++;
+            }
+            docLengths[docBase + doc] = length;
+            for (const string& term : occurrences) {
+                PartialPostings& partial = partialPostings[t][term];
+                const vector<int>& positions = occurrences[term];
+                partial.postings.push_back({docBase + doc, (int) positions.size(), (int) partial.positions.size()});
+                int previous = 0;
+                for (int position : positions) {
+                    appendVarint(partial.positions, position - previous); //gaps between positions
+                    previous = position;
+                }
+            }
+        }
+    });
+
+    for (HashMap<string, PartialPostings>& partialsForThread : partialPostings) {
+        for (const string& term : partialsForThread) {
+            if (!termIds.containsKey(term)) {
+                termIds[term] = postings.size();
+                postings.push_back({});
+                positionData.push_back({});
+            }
+            int termId = termIds[term];
+            PartialPostings& partial = partialsForThread[term];
+            int positionBase = positionData[termId].size();
+            for (Posting posting : partial.postings) {
+                posting.positionOffset += positionBase;
+                postings[termId].push_back(posting);
+            }
+            positionData[termId].insert(positionData[termId].end(), partial.positions.begin(), partial.positions.end());
+        }
+    }
+}
+
+int PostingIndex::size() const {
+    return urls.size();
+}
+
+int PostingIndex::termCount() const {
+    return postings.size();
+}
+
+string PostingIndex::url(int docId) const {
+    return urls[docId];
+}
+
+const vector<Posting>& PostingIndex::postingsFor(const string& term) const {
+    static const vector<Posting> none;
+    int termId = dictionary.find(term);
+    return termId == -1 ? none : postings[termId];
+}
+
+Vector<int> PostingIndex::positionsOf(const string& term, const Posting& posting) const {
+    Vector<int> result;
+    int termId = dictionary.find(term);
+    if (termId != -1) {
+        vector<int> positions;
+        decodePositions(termId, posting, positions);
+        for (int position : positions) {
+            result.add(position);
+        }
+    }
+    return result;
+}
+
+long long PostingIndex::positionBytes() const {
+    long long total = 0;
+    for (const vector<unsigned char>& bytes : positionData) {
+        total += bytes.size();
+    }
+    return total;
+}
+
+//this function decodes the sorted word positions of one posting into positions
+void PostingIndex::decodePositions(int termId, const Posting& posting, vector<int>& positions) const {
+    positions.clear();
+    const unsigned char* data = positionData[termId].data() + posting.positionOffset;
+    int position = 0;
+    for (int i = 0; i < posting.frequency; i++) {
+        position += readVarint(data);
+        positions.push_back(position);
+    }
+}
+
+//this function returns the posting of a term for one page, or nullptr if the page does
+//not contain the term
+const Posting* PostingIndex::findPosting(int termId, int docId) const {
+    const vector<Posting>& list = postings[termId];
+    auto found = lower_bound(list.begin(), list.end(), docId,
+                             [](const Posting& posting, int doc) { return posting.docId < doc; });
+    return (found != list.end() && found->docId == docId) ? &*found : nullptr;
+}
+
+//this function returns the pages where words appear one right after another. candidates are
+//the pages of the first word that contain every other word, and a candidate matches if some
+//position p of the first word has word i at position p + i
+Vector<int> PostingIndex::phraseMatches(const Vector<string>& words) const {
+    Vector<int> result;
+    Vector<int> ids;
+    for (const string& word : words) {
+        ids.add(dictionary.find(word));
+        if (ids[ids.size() - 1] == -1) {
+            return result;
+        }
+    }
+
+    Vector<vector<int>> positions(words.size());
+    for (const Posting& first : postings[ids[0]]) {
+        bool containsAll = true;
+        decodePositions(ids[0], first, positions[0]);
+        for (int i = 1; i < words.size() && containsAll; i++) {
+            const Posting* posting = findPosting(ids[i], first.docId);
+            containsAll = posting != nullptr;
+            if (containsAll) {
+                decodePositions(ids[i], *posting, positions[i]);
+            }
+        }
+        if (!containsAll) {
+            continue;
+        }
+
+        for (int start : positions[0]) {
+            bool isPhrase = true;
+            for (int i = 1; i < words.size() && isPhrase; i++) {
+                isPhrase = binary_search(positions[i].begin(), positions[i].end(), start + i);
+            }
+            if (isPhrase) {
+                result.add(first.docId);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+//this function returns the pages where word i and word i + 1 are at most distances[i] words
+//apart for every i. it walks the words in order, keeping the positions of the current word
+//that can be reached from some chain of positions of the earlier words
+Vector<int> PostingIndex::nearMatches(const Vector<string>& words, const Vector<int>& distances) const {
+    Vector<int> result;
+    Vector<int> ids;
+    for (const string& word : words) {
+        ids.add(dictionary.find(word));
+        if (ids[ids.size() - 1] == -1) {
+            return result;
+        }
+    }
+
+    vector<int> reachable;
+    vector<int> positions;
+    vector<int> nextReachable;
+    for (const Posting& first : postings[ids[0]]) {
+        decodePositions(ids[0], first, reachable);
+        for (int i = 1; i < words.size() && !reachable.empty(); i++) {
+            const Posting* posting = findPosting(ids[i], first.docId);
+            if (posting == nullptr) {
+                reachable.clear();
+                break;
+            }
+            decodePositions(ids[i], *posting, positions);
+
+            //both lists are sorted, so one pointer into reachable tracks the closest earlier
+            //reachable position and the next one is the closest later position
+            nextReachable.clear();
+            size_t r = 0;
+            for (int position : positions) {
+                while (r < reachable.size() && reachable[r] < position) {
+                    r++;
+                }
+                bool closeBefore = r > 0 && position - reachable[r - 1] <= distances[i - 1];
+                bool closeAfter = r < reachable.size() && reachable[r] - position <= distances[i - 1];
+                if (closeBefore || closeAfter) {
+                    nextReachable.push_back(position);
+                }
+            }
+            reachable.swap(nextReachable);
+        }
+        if (!reachable.empty()) {
+            result.add(first.docId);
+        }
+    }
+    return result;
+}
+
+//this function returns the URLs matching one cleaned query term. a term with a '*' in it
+//matches the pages of every word the dictionary matches with it. a term with spaces in it
+//came from a quoted phrase or a NEAR term, so its words are cleaned again one at a time and
+//matched by position. termKind tells the two apart from the quotes parseQuery leaves on a
+//phrase, so a phrase holding the word "near/2" is still a phrase
+Set<string> PostingIndex::matchesFor(const string& term) const {
+    Set<string> result;
+    if (term.find(' ') == string::npos) {
+        for (int termId : dictionary.matching(term)) {
+            for (const Posting& posting : postings[termId]) {
+                result.add(urls[posting.docId]);
+            }
+        }
+        return result;
+    }
+
+    Vector<string> words;
+    string line = term;
+    LineTokenizer tokenizer(line);
+    string_view token;
+    while (tokenizer.next(token)) {
+        words.add(string(token));
+    }
+
+    //a NEAR term whose words do not alternate with operators, like one with a word that
+    //cleaned to nothing, falls back to matching its words as a phrase
+    Vector<string> nearWords;
+    Vector<int> distances;
+    bool isNear = termKind(term) == QUERY_NEAR && words.size() >= 3 && words.size() % 2 == 1;
+    for (int i = 0; i < words.size() && isNear; i++) {
+        int distance;
+        if (i % 2 == 0) {
+            nearWords.add(words[i]);
+        }
+        else if (parseNearOperator(words[i], distance)) {
+            distances.add(distance);
+        }
+        else {
+            isNear = false;
+        }
+    }
+
+    Vector<int> docIds;
+    if (isNear) {
+        docIds = nearMatches(nearWords, distances);
+    }
+    else if (!words.isEmpty()) {
+        docIds = phraseMatches(words);
+    }
+    for (int docId : docIds) {
+        result.add(urls[docId]);
+    }
+    return result;
+}
+
+//this function adds up the posting lists a single word or wildcard reads. a page matching
+//a phrase or NEAR term contains all its words, so the rarest word bounds it
+long long PostingIndex::matchEstimate(const string& term) const {
+    long long estimate = 0;
+    if (term.find(' ') == string::npos) {
+        for (int termId : dictionary.matching(term)) {
+            estimate += postings[termId].size();
+        }
+        return estimate;
+    }
+
+    estimate = size();
+    for (const string& word : termWords(term)) {
+        estimate = min(estimate, (long long) postingsFor(word).size());
+    }
+    return estimate;
+}
+
+double PostingIndex::termScore(const string& term, const Posting& posting) const {
+    int termId = dictionary.find(term);
+    return termId == -1 ? 0 : score(termId, posting);
+}
+
+//this function returns the BM25 score a page gets from one term
+double PostingIndex::score(int termId, const Posting& posting) const {
+    return bm25(idf[termId], posting.frequency, docLengths[posting.docId], averageLength);
+}
+
+Set<string> PostingIndex::findQueryMatches(string query) const {
+    return evaluateQuery(query, [&](const string& term) {
+        return matchesFor(term);
+    }, [&](const string& term) {
+        return matchEstimate(term);
+    });
+}
+
+//this function picks out the query words that add to a page's score, following the same
+//rules evaluateQuery uses to read the query: every term except those prefixed with '-' is
+//scored, and terms that evaluateQuery ignores are ignored here too. each word is returned
+//once, in query order. hasOperators is set if the query uses '+', '-', a phrase or a NEAR
+//term, meaning not every page containing a scored word is a match. a wildcard term scores
+//every word of this index that it matches
+Vector<string> PostingIndex::rankedWords(const string& query, bool& hasOperators) const {
+    Vector<string> result;
+    Set<string> seen;
+    hasOperators = false;
+
+    for (const QueryTerm& term : parseQuery(query)) {
+        if (term.op != QUERY_UNION) {
+            hasOperators = true;
+        }
+        if (term.op == QUERY_DIFFERENCE) {
+            continue;
+        }
+
+        //every word of a phrase or NEAR term is scored, but the term only matches pages
+        //where the words are in the right places
+        if (term.kind != QUERY_WORD) {
+            hasOperators = true;
+        }
+        else if (term.term.find('*') != string::npos) {
+            for (int termId : dictionary.matching(term.term)) {
+                string word = dictionary.term(termId);
+                if (!seen.contains(word)) {
+                    seen.add(word);
+                    result.add(word);
+                }
+            }
+            continue;
+        }
+        for (const string& word : termWords(term.term)) {
+            if (!seen.contains(word)) {
+                seen.add(word);
+                result.add(word);
+            }
+        }
+    }
+    return result;
+}
+
+//this function returns the term ids of the ranked words this index knows, in query order
+Vector<int> PostingIndex::rankedTermIds(const string& query, bool& hasOperators) const {
+    Vector<int> result;
+    for (const string& word : rankedWords(query, hasOperators)) {
+        int termId = dictionary.find(word);
+        if (termId != -1) {
+            result.add(termId);
+        }
+    }
+    return result;
+}
+
+//this function sorts (score, docId) pairs best first, breaking ties by file order, and
+//turns the first k of them into matches
+Vector<ScoredMatch> PostingIndex::sortedMatches(Vector<pair<double, int>>& scored, int k) const {
+    sort(scored.begin(), scored.end(), [](const pair<double, int>& a, const pair<double, int>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    Vector<ScoredMatch> result;
+    for (int i = 0; i < min(k, scored.size()); i++) {
+        result.add({urls[scored[i].second], scored[i].first, firstDocId + scored[i].second});
+    }
+    return result;
+}
+
+//this function finds the k best matches with WAND. there is a cursor into every scored
+//term's posting list, kept sorted by the page each cursor is on. a heap holds the best k
+//pages so far, and the worst of those is the threshold a new page has to beat. adding up
+//the best possible scores of the cursors in page order, the first cursor where the sum
+//beats the threshold is the pivot: no page before the pivot's page can make the top k, so
+//the cursors behind it jump straight to the pivot's page. only pages where every cursor
+//that could contribute has caught up get fully scored
+Vector<ScoredMatch> PostingIndex::findTopMatches(string query, int k) const {
+    bool hasOperators;
+    Vector<int> terms = rankedTermIds(query, hasOperators);
+    Vector<double> termIdf;
+    Vector<double> termBound;
+    for (int termId : terms) {
+        termIdf.add(idf[termId]);
+        termBound.add(maxScore[termId]);
+    }
+    return topMatches(query, k, terms, hasOperators, termIdf, termBound, averageLength);
+}
+
+CollectionStatistics PostingIndex::statistics(string query) const {
+    CollectionStatistics result;
+    result.numDocs = size();
+    result.totalLength = totalLength;
+    bool hasOperators;
+    for (const string& word : rankedWords(query, hasOperators)) {
+        int termId = dictionary.find(word);
+        if (termId != -1) {
+            result.documentFrequencies[word] = postings[termId].size();
+        }
+    }
+    return result;
+}
+
+//this function scores with collection-wide idf and average length. the best score a term
+//can give is no longer known ahead of time, so it is bounded by a page that has the term's
+//highest frequency and its shortest length, since BM25 only grows with frequency and only
+//shrinks with length
+Vector<ScoredMatch> PostingIndex::findTopMatches(string query, int k, const CollectionStatistics& collection) const {
+    bool hasOperators;
+    Vector<int> terms = rankedTermIds(query, hasOperators);
+    double collectionAverage = averageLengthOf(collection.totalLength, collection.numDocs);
+    Vector<double> termIdf;
+    Vector<double> termBound;
+    for (const string& word : rankedWords(query, hasOperators)) {
+        int termId = dictionary.find(word);
+        if (termId != -1) {
+            if (!collection.documentFrequencies.containsKey(word)) {
+                error("Collection statistics are missing the query word " + word);
+            }
+            termIdf.add(inverseDocumentFrequency(collection.numDocs, collection.documentFrequencies.get(word)));
+            termBound.add(bm25(termIdf[termIdf.size() - 1], maxFrequency[termId], minLength[termId], collectionAverage));
+        }
+    }
+    return topMatches(query, k, terms, hasOperators, termIdf, termBound, collectionAverage);
+}
+
+//this function runs WAND over the posting lists of terms, where termIdf and termBound give
+//the idf and best possible score of each term by its position in terms
+Vector<ScoredMatch> PostingIndex::topMatches(const string& query, int k, const Vector<int>& terms, bool hasOperators,
+                                             const Vector<double>& termIdf, const Vector<double>& termBound,
+                                             double averageLength) const {
+    Set<string> allowed;
+    if (hasOperators) {
+        allowed = findQueryMatches(query);
+    }
+    if (k <= 0) {
+        return {};
+    }
+
+    struct Cursor {
+        int slot;                          //position of the term in the query
+        const vector<Posting>* list;
+        size_t position;
+        int doc() const { return (*list)[position].docId; }
+    };
+    vector<Cursor> cursors;
+    for (int slot = 0; slot < terms.size(); slot++) {
+        cursors.push_back({slot, &postings[terms[slot]], 0});
+    }
+
+    //the top of the heap is the worst page kept: lowest score, then latest in the file
+    auto worse = [](const pair<double, int>& a, const pair<double, int>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+    priority_queue<pair<double, int>, vector<pair<double, int>>, decltype(worse)> best(worse);
+    Vector<double> contributions(terms.size());
+
+    while (true) {
+        cursors.erase(remove_if(cursors.begin(), cursors.end(), [](const Cursor& c) {
+            return c.position >= c.list->size();
+        }), cursors.end());
+        if (cursors.empty()) {
+            break;
+        }
+        sort(cursors.begin(), cursors.end(), [](const Cursor& a, const Cursor& b) {
+            return a.doc() < b.doc();
+        });
+
+        double threshold = (int) best.size() < k ? -1 : best.top().first;
+        double bound = 0;
+        int pivot = -1;
+        for (int i = 0; i < (int) cursors.size(); i++) {
+            bound += termBound[cursors[i].slot];
+            if (bound * (1 + 1e-12) > threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == -1) {
+            break; //even a page containing every remaining term could not make the top k
+        }
+
+        int pivotDoc = cursors[pivot].doc();
+        if (cursors[0].doc() == pivotDoc) {
+            bool isMatch = !hasOperators || allowed.contains(urls[pivotDoc]);
+            for (int slot = 0; slot < contributions.size(); slot++) {
+                contributions[slot] = 0;
+            }
+            for (Cursor& cursor : cursors) {
+                if (cursor.doc() == pivotDoc) {
+                    const Posting& posting = (*cursor.list)[cursor.position];
+                    contributions[cursor.slot] = bm25(termIdf[cursor.slot], posting.frequency,
+                                                      docLengths[posting.docId], averageLength);
+                    cursor.position++;
+                }
+            }
+            if (isMatch) {
+                double total = 0;
+                for (double contribution : contributions) {
+                    total += contribution;
+                }
+                pair<double, int> candidate(total, pivotDoc);
+                if ((int) best.size() < k) {
+                    best.push(candidate);
+                }
+                else if (worse(candidate, best.top())) {
+                    best.pop();
+                    best.push(candidate);
+                }
+            }
+        }
+        else {
+            for (int i = 0; i < pivot; i++) {
+                Cursor& cursor = cursors[i];
+                auto next = lower_bound(cursor.list->begin() + cursor.position, cursor.list->end(), pivotDoc,
+                                        [](const Posting& posting, int doc) { return posting.docId < doc; });
+                cursor.position = next - cursor.list->begin();
+            }
+        }
+    }
+
+    Vector<pair<double, int>> scored;
+    while (!best.empty()) {
+        scored.add(best.top());
+        best.pop();
+    }
+    return sortedMatches(scored, k);
+}
+
+//this function scores every page that matches the query and returns the k best, adding
+//up term scores in query order just like findTopMatches does
+Vector<ScoredMatch> PostingIndex::rankAllMatches(string query, int k) const {
+    bool hasOperators;
+    Vector<int> terms = rankedTermIds(query, hasOperators);
+    Set<string> allowed;
+    if (hasOperators) {
+        allowed = findQueryMatches(query);
+    }
+
+    Set<int> candidates;
+    for (int termId : terms) {
+        for (const Posting& posting : postings[termId]) {
+            candidates.add(posting.docId);
+        }
+    }
+
+    Vector<pair<double, int>> scored;
+    for (int doc : candidates) {
+        if (hasOperators && !allowed.contains(urls[doc])) {
+            continue;
+        }
+        double total = 0;
+        for (int termId : terms) {
+            const Posting* posting = findPosting(termId, doc);
+            total += posting != nullptr ? score(termId, *posting) : 0.0;
+        }
+        scored.add({total, doc});
+    }
+    return sortedMatches(scored, k);
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("PostingIndex on tiny.txt keeps term frequencies and matches like findQueryMatches") {
+    PostingIndex index("res/tiny.txt");
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    Map<string, Set<string>> mapIndex = buildIndex(docs);
+
+    EXPECT_EQUAL(index.size(), 4);
+    EXPECT_EQUAL(index.termCount(), 20);
+    EXPECT_EQUAL(index.postingsFor("fish").size(), 2);
+    EXPECT_EQUAL(index.postingsFor("fish")[1].frequency, 4);
+    EXPECT(index.postingsFor("hippo").empty());
+
+    for (string query : {"red", "red fish", "red +fish", "red -fish", "BLUE bread -green", "yellow -milk -you"}) {
+        EXPECT_EQUAL(index.findQueryMatches(query), findQueryMatches(mapIndex, query));
+    }
+}
+
+STUDENT_TEST("findTopMatches on tiny.txt ranks the page that repeats a term first") {
+    PostingIndex index("res/tiny.txt");
+    Vector<ScoredMatch> fish = index.findTopMatches("fish", 10);
+    EXPECT_EQUAL(fish.size(), 2);
+    EXPECT_EQUAL(fish[0].url, "www.dr.seuss.net");
+    EXPECT(fish[0].score > fish[1].score);
+
+    Vector<ScoredMatch> top = index.findTopMatches("red fish", 1);
+    EXPECT_EQUAL(top.size(), 1);
+    EXPECT_EQUAL(top[0].url, "www.dr.seuss.net");
+
+    EXPECT_EQUAL(index.findTopMatches("red -fish", 10).size(), 1);
+    EXPECT_EQUAL(index.findTopMatches("red -fish", 10)[0].url, "www.rainbow.org");
+    EXPECT(index.findTopMatches("hippo", 10).isEmpty());
+    EXPECT(index.findTopMatches("fish", 0).isEmpty());
+}
+
+STUDENT_TEST("findTopMatches skips pages but returns exactly what scoring every match returns") {
+    string filename = "res/generated-ranked.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 3000; page++) {
+        out << "www.page" << page << ".com" << endl;
+        int numWords = randomInteger(1, 40);
+        for (int w = 0; w < numWords; w++) {
+            //low word numbers are far more common than high ones, like real text
+            int word = (int) (pow(randomReal(0, 1), 3) * 200);
+            out << "word" << word << " ";
+        }
+        out << endl;
+    }
+    out.close();
+    PostingIndex index(filename);
+    deleteFile(filename);
+
+    for (int trial = 0; trial < 200; trial++) {
+        string query = "word" + integerToString(randomInteger(0, 10));
+        for (int extra = randomInteger(0, 4); extra > 0; extra--) {
+            string prefix = randomChance(0.2) ? (randomChance(0.5) ? "+" : "-") : "";
+            query += " " + prefix + "word" + integerToString(randomInteger(0, 199));
+        }
+        for (int k : {1, 10, 50}) {
+            EXPECT_EQUAL(index.findTopMatches(query, k), index.rankAllMatches(query, k));
+        }
+    }
+}
+
+STUDENT_TEST("PostingIndex streamed in batches keeps the last listing of URLs repeated across batches") {
+    string filename = "res/generated-stream.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 20000; page++) {
+        out << "www.page" << page % 17000 << ".com" << endl;
+        for (int w = randomInteger(1, 10); w > 0; w--) {
+            out << "word" << randomInteger(0, 50) << " ";
+        }
+        out << "page" << page << endl;
+    }
+    out.close();
+    PostingIndex index(filename);
+    PostingIndex lastShard(filename, 2, 3);
+    Map<string, Set<string>> mapIndex = buildIndex(readDocs(filename));
+    deleteFile(filename);
+
+    EXPECT_EQUAL(index.size(), 17000);
+    EXPECT_EQUAL(lastShard.size(), 17000 - 17000 * 2 / 3);
+    EXPECT_EQUAL(index.url(0), "www.page3000.com"); //pages 0 to 2999 are listed again at the end
+    EXPECT_EQUAL(index.url(16999), "www.page2999.com");
+    EXPECT_EQUAL(index.findQueryMatches("page17005"), Set<string>({"www.page5.com"}));
+    EXPECT(index.findQueryMatches("page5").isEmpty());
+    for (int word = 0; word <= 50; word++) {
+        string query = "word" + integerToString(word);
+        EXPECT_EQUAL(index.findQueryMatches(query), findQueryMatches(mapIndex, query));
+    }
+}
+
+STUDENT_TEST("PostingIndex phrase and NEAR queries on tiny.txt") {
+    PostingIndex index("res/tiny.txt");
+    EXPECT_EQUAL(index.positionsOf("fish", index.postingsFor("fish")[1]), Vector<int>({1, 3, 5, 7}));
+
+    EXPECT_EQUAL(index.findQueryMatches("\"red fish\""), Set<string>({"www.dr.seuss.net"}));
+    EXPECT_EQUAL(index.findQueryMatches("\"Fish, blue!\""), Set<string>({"www.dr.seuss.net"}));
+    EXPECT(index.findQueryMatches("\"red blue\"").isEmpty());
+    EXPECT_EQUAL(index.findQueryMatches("\"fish bread\""), Set<string>({"www.shoppinglist.com"})); //@ is not a word
+    EXPECT_EQUAL(index.findQueryMatches("\"yellow blue\" fish").size(), 3);
+    EXPECT_EQUAL(index.findQueryMatches("fish -\"two fish\""), Set<string>({"www.shoppinglist.com"}));
+    EXPECT_EQUAL(index.findQueryMatches("\"milk\""), Set<string>({"www.shoppinglist.com"}));
+
+    EXPECT_EQUAL(index.findQueryMatches("red NEAR/2 blue"), Set<string>({"www.dr.seuss.net"}));
+    EXPECT_EQUAL(index.findQueryMatches("red NEAR/4 blue").size(), 2);
+    EXPECT_EQUAL(index.findQueryMatches("blue near/2 red"), Set<string>({"www.dr.seuss.net"}));
+    EXPECT(index.findQueryMatches("red NEAR/1 blue").isEmpty());
+    EXPECT_EQUAL(index.findQueryMatches("eggs NEAR/1 milk NEAR/2 bread"), Set<string>({"www.shoppinglist.com"}));
+    EXPECT(index.findQueryMatches("eggs NEAR/1 milk NEAR/1 bread").isEmpty());
+
+    EXPECT_EQUAL(index.findTopMatches("\"red fish\"", 10).size(), 1);
+}
+
+STUDENT_TEST("PostingIndex reads a phrase holding the word near/2 as a phrase, not a NEAR term") {
+    string filename = "res/generated-near.txt";
+    ofstream out(filename);
+    out << "www.literal.com" << endl << "exit near/2 gate" << endl;
+    out << "www.close.com" << endl << "exit by the gate" << endl;
+    out.close();
+    PostingIndex index(filename);
+    deleteFile(filename);
+
+    EXPECT_EQUAL(index.findQueryMatches("\"exit near/2 gate\""), Set<string>({"www.literal.com"}));
+    EXPECT_EQUAL(index.findQueryMatches("exit NEAR/3 gate"), Set<string>({"www.literal.com", "www.close.com"}));
+    EXPECT(index.findQueryMatches("\"exit gate\"").isEmpty());
+    EXPECT_EQUAL(index.matchEstimate("\"exit near/2 gate\""), 1);
+    EXPECT_EQUAL(parseQuery("\"exit near/2 gate\"")[0].kind, QUERY_PHRASE);
+    EXPECT_EQUAL(parseQuery("fish -exit NEAR/2 gate")[1].kind, QUERY_NEAR);
+    EXPECT_EQUAL(parseQuery("\"gate\" +\"exit,\"")[1].term, "exit");
+    EXPECT_EQUAL(parseQuery("\"gate\" +\"exit,\"")[1].kind, QUERY_WORD);
+}
+
+STUDENT_TEST("PostingIndex wildcard queries on tiny.txt") {
+    PostingIndex index("res/tiny.txt");
+    EXPECT_EQUAL(index.findQueryMatches("f*"), Set<string>({"www.shoppinglist.com", "www.dr.seuss.net"}));
+    EXPECT_EQUAL(index.findQueryMatches("Y*"), Set<string>({"www.rainbow.org", "www.bigbadwolf.com"}));
+    EXPECT_EQUAL(index.findQueryMatches("*ee*"), Set<string>({"www.shoppinglist.com", "www.rainbow.org"}));
+    EXPECT_EQUAL(index.findQueryMatches("r* +b*"), Set<string>({"www.rainbow.org", "www.dr.seuss.net"}));
+    EXPECT_EQUAL(index.findQueryMatches("red -i*"), Set<string>({"www.dr.seuss.net"}));
+    EXPECT(index.findQueryMatches("zebra*").isEmpty());
+    EXPECT(index.findQueryMatches("*").isEmpty()); //no letters, so the term is ignored
+
+    //a wildcard scores every word it matches, so "o*" ranks like "one orange"
+    EXPECT_EQUAL(index.findTopMatches("o*", 10), index.findTopMatches("one orange", 10));
+    EXPECT_EQUAL(index.findTopMatches("f* +b*", 10), index.rankAllMatches("f* +b*", 10));
+}
+
+STUDENT_TEST("PostingIndex phrase queries agree with scanning every page, and positions stay compact") {
+    string filename = "res/generated-phrases.txt";
+    Vector<Vector<string>> pages;
+    ofstream out(filename);
+    for (int page = 0; page < 500; page++) {
+        out << "www.page" << page << ".com" << endl;
+        Vector<string> words;
+        for (int w = randomInteger(1, 300); w > 0; w--) {
+            words.add("w" + integerToString(randomInteger(0, 5)));
+            out << words.back() << " ";
+        }
+        pages.add(words);
+        out << endl;
+    }
+    out.close();
+    PostingIndex index(filename);
+    deleteFile(filename);
+
+    long long totalPositions = 0;
+    for (const Vector<string>& words : pages) {
+        totalPositions += words.size();
+    }
+    EXPECT(index.positionBytes() <= totalPositions); //every gap fits in one byte here
+
+    for (int trial = 0; trial < 50; trial++) {
+        Vector<string> phrase;
+        for (int w = randomInteger(2, 4); w > 0; w--) {
+            phrase.add("w" + integerToString(randomInteger(0, 5)));
+        }
+        int distance = randomInteger(1, 5);
+
+        Set<string> expectedPhrase;
+        Set<string> expectedNear;
+        for (int page = 0; page < pages.size(); page++) {
+            const Vector<string>& words = pages[page];
+            for (int start = 0; start + phrase.size() <= words.size(); start++) {
+                bool isPhrase = true;
+                for (int i = 0; i < phrase.size(); i++) {
+                    isPhrase = isPhrase && words[start + i] == phrase[i];
+                }
+                if (isPhrase) {
+                    expectedPhrase.add("www.page" + integerToString(page) + ".com");
+                }
+            }
+            for (int a = 0; a < words.size(); a++) {
+                for (int b = max(0, a - distance); b <= min(words.size() - 1, a + distance); b++) {
+                    if (words[a] == phrase[0] && words[b] == phrase[1]) {
+                        expectedNear.add("www.page" + integerToString(page) + ".com");
+                    }
+                }
+            }
+        }
+
+        EXPECT_EQUAL(index.findQueryMatches("\"" + stringJoin(phrase, " ") + "\""), expectedPhrase);
+        string nearQuery = phrase[0] + " NEAR/" + integerToString(distance) + " " + phrase[1];
+        EXPECT_EQUAL(index.findQueryMatches(nearQuery), expectedNear);
+    }
+}
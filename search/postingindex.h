@@ -0,0 +1,180 @@
+#pragma once
+#include "map.h"
+#include "set.h"
+#include "vector.h"
+#include "hashmap.h"
+#include "termdictionary.h"
+#include <string>
+#include <vector>
+
+/**
+ * One entry of a posting list: a page (by its position in the database file), how many
+ * times the term appears in that page, and where that page's word positions start in the
+ * term's compressed position data.
+ */
+struct Posting {
+    int docId;
+    int frequency;
+    int positionOffset;
+};
+
+/**
+ * A page returned by ranked retrieval along with its BM25 score. docId is the page's
+ * position in the whole database file, so matches from different shards can be put back
+ * in file order.
+ */
+struct ScoredMatch {
+    std::string url;
+    double score;
+    int docId;
+};
+
+bool operator==(const ScoredMatch& a, const ScoredMatch& b);
+std::ostream& operator<<(std::ostream& out, const ScoredMatch& match);
+
+/**
+ * The numbers BM25 needs about a whole collection of pages: how many pages there are, how
+ * many words they hold altogether, and how many pages contain each of a query's words.
+ * The statistics of several shards add up to the statistics of the whole collection.
+ */
+struct CollectionStatistics {
+    int numDocs;
+    long long totalLength;
+    HashMap<std::string, int> documentFrequencies;
+};
+
+/**
+ * An inverted index that keeps term frequencies and page lengths, so that pages can be
+ * ranked by BM25 instead of just matched. Posting lists are sorted by docId, and every
+ * term also records the best score any single page can get from it, which lets
+ * findTopMatches skip pages that cannot make the top k (WAND).
+ *
+ * Terms are kept in a front-coded TermDictionary, and a term id is the term's position in
+ * sorted order.
+ *
+ * Every posting also records the word positions of the term in its page, so queries can
+ * use quoted phrases ("red fish") and NEAR/k terms (red NEAR/3 fish: both words within k
+ * words of each other, in either order). Positions are stored as varint-encoded gaps, so
+ * each one usually takes a single byte and never more than five.
+ */
+class PostingIndex {
+public:
+    /**
+     * Reads a database file in the format readDocs uses. If a URL is listed more than
+     * once, its last content is the one indexed.
+     *
+     * With numShards above 1, only shard number shard of the pages is indexed: the pages
+     * (after repeated URLs are dropped) are split into numShards ranges in file order, as
+     * evenly as possible. docIds inside the index still start at 0.
+     */
+    PostingIndex(std::string dbfile, int shard = 0, int numShards = 1);
+
+    /**
+     * Returns the number of pages.
+     */
+    int size() const;
+
+    /**
+     * Returns the number of distinct terms.
+     */
+    int termCount() const;
+
+    /**
+     * Returns the URL of the page with the given docId.
+     */
+    std::string url(int docId) const;
+
+    /**
+     * Returns the postings for a cleaned term, sorted by docId. Unknown terms have none.
+     */
+    const std::vector<Posting>& postingsFor(const std::string& term) const;
+
+    /**
+     * Returns the word positions of a cleaned term in the page of one of its postings.
+     */
+    Vector<int> positionsOf(const std::string& term, const Posting& posting) const;
+
+    /**
+     * Returns the number of bytes used by compressed word positions.
+     */
+    long long positionBytes() const;
+
+    /**
+     * Returns the URLs of every page matching a cleaned term. A term with spaces in it is
+     * a phrase, or a NEAR term if every other word is a NEAR/k operator. A term with a '*'
+     * in it is a wildcard matching the pages of every word it matches, so "fish*" matches
+     * pages with "fish", "fishing" or "fishy".
+     */
+    Set<std::string> matchesFor(const std::string& term) const;
+
+    /**
+     * Returns an upper bound on the number of pages matchesFor(term) returns, from the
+     * lengths of posting lists: the total for the words a wildcard matches, or the
+     * shortest list among the words of a phrase or NEAR term.
+     */
+    long long matchEstimate(const std::string& term) const;
+
+    /**
+     * Returns the BM25 score of one page for a single term with the given frequency in it.
+     */
+    double termScore(const std::string& term, const Posting& posting) const;
+
+    /**
+     * Returns the URLs matching query, using the same rules as findQueryMatches. The
+     * query runs through a query plan estimated with matchEstimate.
+     */
+    Set<std::string> findQueryMatches(std::string query) const;
+
+    /**
+     * Returns the k best pages for query, best first, ties broken by file order. The
+     * query uses the findQueryMatches rules to decide which pages match, and a page's
+     * score is the sum of BM25 scores of the query terms not prefixed by '-'.
+     */
+    Vector<ScoredMatch> findTopMatches(std::string query, int k) const;
+
+    /**
+     * Returns the statistics of this index for query: its page count and total length,
+     * and the document frequency of every scored query word it contains.
+     */
+    CollectionStatistics statistics(std::string query) const;
+
+    /**
+     * Same as findTopMatches, but BM25 uses the given statistics instead of this index's
+     * own. A shard given the summed statistics of every shard scores its pages exactly as
+     * an index of the whole file would.
+     */
+    Vector<ScoredMatch> findTopMatches(std::string query, int k, const CollectionStatistics& collection) const;
+
+    /**
+     * Same result as findTopMatches, but scores every matching page. Used to check the
+     * pruned search.
+     */
+    Vector<ScoredMatch> rankAllMatches(std::string query, int k) const;
+
+private:
+    Vector<std::string> urls;
+    Vector<int> docLengths;
+    int firstDocId;                                          // docId of page 0 in the whole file
+    long long totalLength;
+    double averageLength;
+    TermDictionary dictionary;                               // term -> term id
+    std::vector<std::vector<Posting>> postings;             // indexed by term id
+    std::vector<std::vector<unsigned char>> positionData;   // indexed by term id
+    Vector<double> idf;                                      // indexed by term id
+    Vector<double> maxScore;                                 // indexed by term id
+    Vector<int> maxFrequency;                                // indexed by term id
+    Vector<int> minLength;                                   // indexed by term id, over pages with the term
+
+    void indexBatch(Vector<std::string>& contents, const Vector<int>& kept, HashMap<std::string, int>& termIds);
+    double score(int termId, const Posting& posting) const;
+    void decodePositions(int termId, const Posting& posting, std::vector<int>& positions) const;
+    const Posting* findPosting(int termId, int docId) const;
+    Vector<int> phraseMatches(const Vector<std::string>& words) const;
+    Vector<int> nearMatches(const Vector<std::string>& words, const Vector<int>& distances) const;
+    Vector<std::string> rankedWords(const std::string& query, bool& hasOperators) const;
+    Vector<int> rankedTermIds(const std::string& query, bool& hasOperators) const;
+    Vector<ScoredMatch> topMatches(const std::string& query, int k, const Vector<int>& terms, bool hasOperators,
+                                   const Vector<double>& termIdf, const Vector<double>& termBound,
+                                   double averageLength) const;
+    Vector<ScoredMatch> sortedMatches(Vector<std::pair<double, int>>& scored, int k) const;
+};
@@ -0,0 +1,187 @@
+//Helpers that turn a query into a cache key and into the list of words its result depends
+//on, used by QueryCache to share results between equivalent queries and to invalidate
+//them when an index update touches one of those words
+
+#include "testing/SimpleTest.h"
+#include "querycache.h"
+#include "search.h"
+#include "liveindex.h"
+#include "set.h"
+using namespace std;
+
+//this function builds the cache key for a query. each run of terms with the same operator
+//goes into a sorted Set, which also drops repeats, and every term is written as its operator
+//character followed by the term and a newline (which can never appear in a query line).
+//multi-word terms are retokenized so extra spaces or punctuation inside quotes don't matter,
+//and a phrase gets its quotes back so it never shares a key with a NEAR term
+string normalizeQuery(const string& query) {
+    const string operatorChars = " +-";
+    Vector<QueryTerm> terms = parseQuery(query);
+    string key;
+
+    int runStart = 0;
+    while (runStart < terms.size()) {
+        int runEnd = runStart;
+        Set<string> run;
+        while (runEnd < terms.size() && terms[runEnd].op == terms[runStart].op) {
+            string term = terms[runEnd].term;
+            if (term.find(' ') != string::npos) {
+                string line = term;
+                LineTokenizer tokenizer(line);
+                string_view token;
+                term = "";
+                while (tokenizer.next(token)) {
+                    term += (term.empty() ? "" : " ") + string(token);
+                }
+                if (terms[runEnd].kind == QUERY_PHRASE) {
+                    term = "\"" + term + "\"";
+                }
+            }
+            run.add(term);
+            runEnd++;
+        }
+        for (const string& term : run) {
+            key += operatorChars[terms[runStart].op] + term + "\n";
+        }
+        runStart = runEnd;
+    }
+    return key;
+}
+
+//this function returns whether a parsed term is a wildcard, which looks up no one word
+bool isWildcard(const QueryTerm& term) {
+    return term.kind == QUERY_WORD && term.term.find('*') != string::npos;
+}
+
+//this function lists every distinct word any term of the query looks up
+Vector<string> queryWords(const string& query) {
+    Set<string> words;
+    for (const QueryTerm& term : parseQuery(query)) {
+        if (isWildcard(term)) {
+            continue;
+        }
+        for (const string& word : termWords(term.term)) {
+            words.add(word);
+        }
+    }
+
+    Vector<string> result;
+    for (const string& word : words) {
+        result.add(word);
+    }
+    return result;
+}
+
+
+//this function lists every distinct wildcard term of the query
+Vector<string> queryPatterns(const string& query) {
+    Set<string> patterns;
+    for (const QueryTerm& term : parseQuery(query)) {
+        if (isWildcard(term)) {
+            patterns.add(term.term);
+        }
+    }
+
+    Vector<string> result;
+    for (const string& pattern : patterns) {
+        result.add(pattern);
+    }
+    return result;
+}
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("normalizeQuery shares keys only between queries that must give the same result") {
+    EXPECT_EQUAL(normalizeQuery("Fish red +blue"), normalizeQuery("red fish fish +BLUE!"));
+    EXPECT_EQUAL(normalizeQuery("red -fish -blue"), normalizeQuery("red -blue -fish"));
+    EXPECT_EQUAL(normalizeQuery("\"Red,  fish\" milk"), normalizeQuery("milk \"red fish\""));
+    EXPECT_EQUAL(normalizeQuery("red 106 fish"), normalizeQuery("red fish")); //106 is ignored by the query rules
+    EXPECT(normalizeQuery("red +blue fish") != normalizeQuery("red fish +blue"));
+    EXPECT(normalizeQuery("red -fish") != normalizeQuery("red +fish"));
+    EXPECT(normalizeQuery("\"red fish\"") != normalizeQuery("\"fish red\""));
+
+    EXPECT_EQUAL(queryWords("Red +\"one fish\" -blue NEAR/2 milk"), Vector<string>({"blue", "fish", "milk", "one", "red"}));
+    EXPECT_EQUAL(queryWords("Fish* red -*ing"), Vector<string>({"red"}));
+    EXPECT_EQUAL(queryPatterns("Fish* red -*ing fish*"), Vector<string>({"*ing", "fish*"}));
+}
+
+STUDENT_TEST("QueryCache counts hits and misses and evicts the least recently used query") {
+    QueryCache<Set<string>> cache(2);
+    int evaluations = 0;
+    auto evaluate = [&](const string& query) {
+        evaluations++;
+        return Set<string>({query});
+    };
+
+    EXPECT_EQUAL(cache.lookup("red fish", evaluate), Set<string>({"red fish"}));
+    EXPECT_EQUAL(cache.lookup("fish red", evaluate), Set<string>({"red fish"})); //same key, cached result
+    cache.lookup("blue", evaluate);
+    cache.lookup("red fish", evaluate);  //now "blue" is the least recently used
+    cache.lookup("milk", evaluate);      //evicts "blue"
+    EXPECT_EQUAL(evaluations, 3);
+    cache.lookup("red fish", evaluate);
+    cache.lookup("blue", evaluate);
+    EXPECT_EQUAL(evaluations, 4);
+
+    EXPECT_EQUAL(cache.hits(), 3);
+    EXPECT_EQUAL(cache.misses(), 4);
+    EXPECT_EQUAL(cache.hitRate(), 3.0 / 7);
+    EXPECT_EQUAL(cache.size(), 2);
+
+    cache.invalidateWord("fish");
+    EXPECT_EQUAL(cache.size(), 1);
+    cache.lookup("blue", evaluate);
+    EXPECT_EQUAL(evaluations, 4);
+}
+
+STUDENT_TEST("LiveIndex cache is invalidated for the words of updated pages only") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    LiveIndex index(docs);
+
+    EXPECT_EQUAL(index.findQueryMatches("red").size(), 2);
+    EXPECT_EQUAL(index.findQueryMatches("milk").size(), 1);
+    EXPECT_EQUAL(index.findQueryMatches("RED!").size(), 2);
+    EXPECT_EQUAL(index.queryCache().hits(), 1);
+
+    index.addDocument("www.pond.org", "red herring");
+    EXPECT_EQUAL(index.findQueryMatches("red").size(), 3);
+    EXPECT_EQUAL(index.findQueryMatches("milk").size(), 1);
+    EXPECT_EQUAL(index.queryCache().hits(), 2); //milk was untouched by the update
+
+    index.replaceDocument("www.pond.org", "milk");
+    EXPECT_EQUAL(index.findQueryMatches("red").size(), 2);
+    EXPECT_EQUAL(index.findQueryMatches("milk").size(), 2);
+
+    index.removeDocument("www.shoppinglist.com");
+    EXPECT_EQUAL(index.findQueryMatches("milk"), Set<string>({"www.pond.org"}));
+    EXPECT_EQUAL(index.queryCache().hits(), 2);
+    EXPECT_EQUAL(index.queryCache().misses(), 6);
+}
+
+STUDENT_TEST("LiveIndex expands wildcards and drops cached wildcard results a new word matches") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    LiveIndex index(docs);
+
+    EXPECT_EQUAL(index.findQueryMatches("fish*"), findQueryMatches(buildIndex(docs), "fish*"));
+    EXPECT_EQUAL(index.findQueryMatches("fish*").size(), 2);
+    EXPECT_EQUAL(index.findQueryMatches("m*k"), Set<string>({"www.shoppinglist.com"}));
+    EXPECT_EQUAL(index.queryCache().hits(), 1);
+
+    //"fishing" is a word no page had, and "fish*" has to see it
+    index.addDocument("www.pond.org", "gone fishing");
+    EXPECT_EQUAL(index.findQueryMatches("fish*").size(), 3);
+    EXPECT_EQUAL(index.findQueryMatches("m*k"), Set<string>({"www.shoppinglist.com"}));
+    EXPECT_EQUAL(index.queryCache().hits(), 2); //m*k matches no word of the new page
+
+    index.replaceDocument("www.pond.org", "silk");
+    EXPECT_EQUAL(index.findQueryMatches("fish*").size(), 2);
+    EXPECT_EQUAL(index.findQueryMatches("m*k"), Set<string>({"www.shoppinglist.com"}));
+    EXPECT_EQUAL(index.queryCache().hits(), 3);
+
+    QueryCache<Set<string>> cache;
+    cache.lookup("red f*sh*", [](const string&) { return Set<string>(); });
+    cache.invalidateWord("blue");
+    EXPECT_EQUAL(cache.size(), 1);
+    cache.invalidateWord("flashy");
+    EXPECT_EQUAL(cache.size(), 0);
+}
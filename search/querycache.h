@@ -0,0 +1,201 @@
+#pragma once
+#include "vector.h"
+#include "termdictionary.h"
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * Returns a cache key for query: the query's terms cleaned the way evaluateQuery cleans
+ * them, with terms that evaluateQuery ignores dropped. Runs of terms with the same
+ * operator are sorted and deduplicated, since they can be applied in any order, so
+ * "Fish red +blue" and "red fish fish +BLUE" share a key but "red +blue fish" does not.
+ */
+std::string normalizeQuery(const std::string& query);
+
+/**
+ * Returns every cleaned word the query's result depends on, including the words inside
+ * phrases and NEAR terms. Wildcard terms are left to queryPatterns.
+ */
+Vector<std::string> queryWords(const std::string& query);
+
+/**
+ * Returns every wildcard term of the query, with its '*'s. A result that depends on one
+ * depends on every word the wildcard matches, including words no page had when it was
+ * computed.
+ */
+Vector<std::string> queryPatterns(const std::string& query);
+
+/**
+ * A least-recently-used cache of query results keyed by normalizeQuery. Every cached
+ * result remembers the words and wildcard patterns it depends on, so an index update only
+ * has to invalidate the words of the pages it touched: a word drops the results that
+ * depend on it and those with a pattern matching it. Safe to use from several threads at
+ * once.
+ *
+ * A result is only stored if no invalidation happened while it was being computed, so a
+ * result computed from an index that changed underneath it is never cached. Index updates
+ * must publish their change before invalidating.
+ */
+template <typename Result>
+class QueryCache {
+public:
+    /**
+     * Creates an empty cache that holds at most capacity results.
+     */
+    QueryCache(int capacity = 1024) {
+        this->capacity = capacity;
+        generation = 0;
+        hitCount = 0;
+        missCount = 0;
+    }
+
+    /**
+     * Returns the cached result for query, or calls evaluate(query), caches what it
+     * returns and returns it.
+     */
+    Result lookup(const std::string& query, const std::function<Result(const std::string&)>& evaluate) {
+        std::string key = normalizeQuery(query);
+        long long startGeneration;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = entries.find(key);
+            if (found != entries.end()) {
+                hitCount++;
+                recent.splice(recent.begin(), recent, found->second);
+                return found->second->result;
+            }
+            missCount++;
+            startGeneration = generation;
+        }
+
+        Result result = evaluate(query);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (generation == startGeneration && entries.find(key) == entries.end() && capacity > 0) {
+            recent.push_front({key, result, queryWords(query), queryPatterns(query)});
+            entries[key] = recent.begin();
+            for (const std::string& word : recent.front().words) {
+                keysByWord[word].insert(key);
+            }
+            for (const std::string& pattern : recent.front().patterns) {
+                keysByPattern[pattern].insert(key);
+            }
+            if ((int) entries.size() > capacity) {
+                evict(std::prev(recent.end()));
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Drops every cached result that depends on the cleaned word, directly or through a
+     * wildcard matching it.
+     */
+    void invalidateWord(const std::string& word) {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        std::unordered_set<std::string> keys;
+        auto found = keysByWord.find(word);
+        if (found != keysByWord.end()) {
+            keys = found->second;
+        }
+        for (const auto& pattern : keysByPattern) {
+            if (wildcardMatches(pattern.first, word)) {
+                keys.insert(pattern.second.begin(), pattern.second.end());
+            }
+        }
+        for (const std::string& key : keys) {
+            evict(entries[key]);
+        }
+    }
+
+    /**
+     * Drops every cached result.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        recent.clear();
+        entries.clear();
+        keysByWord.clear();
+        keysByPattern.clear();
+    }
+
+    /**
+     * Returns the number of lookups answered from the cache.
+     */
+    long long hits() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return hitCount;
+    }
+
+    /**
+     * Returns the number of lookups that had to be evaluated.
+     */
+    long long misses() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return missCount;
+    }
+
+    /**
+     * Returns the fraction of lookups answered from the cache, or 0 before any lookups.
+     */
+    double hitRate() const {
+        std::lock_guard<std::mutex> guard(lock);
+        long long lookups = hitCount + missCount;
+        return lookups == 0 ? 0 : (double) hitCount / lookups;
+    }
+
+    /**
+     * Returns the number of cached results.
+     */
+    int size() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        Result result;
+        Vector<std::string> words;
+        Vector<std::string> patterns;
+    };
+
+    int capacity;
+    mutable std::mutex lock;                      // guards everything below
+    std::list<Entry> recent;                      // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> entries;
+    std::unordered_map<std::string, std::unordered_set<std::string>> keysByWord;
+    std::unordered_map<std::string, std::unordered_set<std::string>> keysByPattern;
+    long long generation;                         // bumped by every invalidation
+    long long hitCount;
+    long long missCount;
+
+    // removes one entry; the caller must hold lock
+    void evict(typename std::list<Entry>::iterator entry) {
+        unlink(keysByWord, entry->words, entry->key);
+        unlink(keysByPattern, entry->patterns, entry->key);
+        entries.erase(entry->key);
+        recent.erase(entry);
+    }
+
+    // removes key from the sets of names in keysByName, dropping sets it empties
+    static void unlink(std::unordered_map<std::string, std::unordered_set<std::string>>& keysByName,
+                       const Vector<std::string>& names, const std::string& key) {
+        for (const std::string& name : names) {
+            auto keys = keysByName.find(name);
+            if (keys == keysByName.end()) {
+                continue;
+            }
+            keys->second.erase(key);
+            if (keys->second.empty()) {
+                keysByName.erase(keys);
+            }
+        }
+    }
+};
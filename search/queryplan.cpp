@@ -0,0 +1,224 @@
+//A query planner: it turns a query into an expression tree, estimates how many pages each
+//node can match from the lengths of posting lists, and runs the cheapest nodes first so
+//that empty intermediate results stop the work early
+
+#include "testing/SimpleTest.h"
+#include "queryplan.h"
+#include "search.h"
+#include "postingindex.h"
+#include "benchmark.h"
+#include "filelib.h"
+#include "random.h"
+#include <algorithm>
+#include <sstream>
+using namespace std;
+
+PlanNode termNode(const string& term) {
+    return {PLAN_TERM, term, {}, {}, 0};
+}
+
+//this function returns node inside a new node of the given kind, unless it is already of
+//that kind, so runs of terms with the same operator gather in one node
+PlanNode& gather(PlanNode& node, PlanNodeKind kind) {
+    if (node.kind != kind) {
+        node = {kind, "", {node}, {}, 0};
+    }
+    return node;
+}
+
+//this function estimates every node from the bottom up and sorts the children of each
+//node cheapest first. the sort is stable, so equal estimates keep their query order
+void estimateNode(PlanNode& node, const function<long long(const string&)>& estimate) {
+    if (node.kind == PLAN_TERM) {
+        node.estimate = estimate(node.term);
+        return;
+    }
+    for (PlanNode& child : node.children) {
+        estimateNode(child, estimate);
+    }
+    for (PlanNode& child : node.excluded) {
+        estimateNode(child, estimate);
+    }
+    auto cheaper = [](const PlanNode& a, const PlanNode& b) {
+        return a.estimate < b.estimate;
+    };
+    stable_sort(node.children.begin(), node.children.end(), cheaper);
+    stable_sort(node.excluded.begin(), node.excluded.end(), cheaper);
+
+    node.estimate = 0;
+    for (const PlanNode& child : node.children) {
+        node.estimate += child.estimate;
+    }
+    if (node.kind == PLAN_AND && !node.children.empty()) {
+        node.estimate = node.children[0].estimate;
+    }
+}
+
+//this function builds the left-deep tree of the query, with each run of plain terms in a
+//union node and each run of '+' and '-' terms in an and node, then estimates and orders it.
+//the two kinds of node alternate down the tree, so "a b +c d" still unions d with the
+//intersection of c and the union of a and b
+PlanNode planQuery(string query, const function<long long(const string&)>& estimate) {
+    Vector<QueryTerm> terms = parseQuery(query);
+    PlanNode plan = {PLAN_UNION, "", {}, {}, 0};
+    if (!terms.isEmpty()) {
+        plan = termNode(terms[0].term);
+    }
+    for (int i = 1; i < terms.size(); i++) {
+        if (terms[i].op == QUERY_UNION) {
+            gather(plan, PLAN_UNION).children.push_back(termNode(terms[i].term));
+        }
+        else if (terms[i].op == QUERY_INTERSECT) {
+            gather(plan, PLAN_AND).children.push_back(termNode(terms[i].term));
+        }
+        else {
+            gather(plan, PLAN_AND).excluded.push_back(termNode(terms[i].term));
+        }
+    }
+    estimateNode(plan, estimate);
+    return plan;
+}
+
+Set<string> executePlan(const PlanNode& plan, const function<Set<string>(const string&)>& matchesFor) {
+    Set<string> result;
+    if (plan.estimate == 0) {
+        return result;
+    }
+    if (plan.kind == PLAN_TERM) {
+        return matchesFor(plan.term);
+    }
+    if (plan.kind == PLAN_UNION) {
+        for (const PlanNode& child : plan.children) {
+            result = result + executePlan(child, matchesFor);
+        }
+        return result;
+    }
+
+    result = executePlan(plan.children[0], matchesFor);
+    for (size_t i = 1; i < plan.children.size() && !result.isEmpty(); i++) {
+        result = result * executePlan(plan.children[i], matchesFor);
+    }
+    for (size_t i = 0; i < plan.excluded.size() && !result.isEmpty(); i++) {
+        result = result - executePlan(plan.excluded[i], matchesFor);
+    }
+    return result;
+}
+
+//this function writes one node and then its children one level deeper
+void explainNode(ostream& out, const PlanNode& node, int depth, bool isExcluded) {
+    out << string(2 * depth, ' ') << (isExcluded ? "NOT " : "");
+    if (node.kind == PLAN_TERM) {
+        out << "TERM \"" << node.term << "\"";
+    }
+    else {
+        out << (node.kind == PLAN_UNION ? "UNION" : "AND");
+    }
+    out << " est=" << node.estimate << (node.estimate == 0 ? " (skipped)" : "") << '\n';
+    for (const PlanNode& child : node.children) {
+        explainNode(out, child, depth + 1, false);
+    }
+    for (const PlanNode& child : node.excluded) {
+        explainNode(out, child, depth + 1, true);
+    }
+}
+
+string explainPlan(const PlanNode& plan) {
+    ostringstream out;
+    explainNode(out, plan, 0, false);
+    return out.str();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("planQuery orders runs of terms cheapest first and explains the plan") {
+    Map<string, Set<string>> index = buildIndex(readDocs("res/tiny.txt"));
+    auto estimate = [&](const string& term) {
+        return (long long) index.get(term).size();
+    };
+
+    EXPECT_EQUAL(explainPlan(planQuery("fish +milk", estimate)),
+                 "AND est=1\n"
+                 "  TERM \"milk\" est=1\n"
+                 "  TERM \"fish\" est=2\n");
+    EXPECT_EQUAL(explainPlan(planQuery("fish red -blue +milk i'm", estimate)),
+                 "UNION est=2\n"
+                 "  AND est=1\n"
+                 "    TERM \"milk\" est=1\n"
+                 "    UNION est=4\n"
+                 "      TERM \"fish\" est=2\n"
+                 "      TERM \"red\" est=2\n"
+                 "    NOT TERM \"blue\" est=2\n"
+                 "  TERM \"i'm\" est=1\n");
+    EXPECT_EQUAL(explainPlan(planQuery("zebra +fish -red", estimate)),
+                 "AND est=0 (skipped)\n"
+                 "  TERM \"zebra\" est=0 (skipped)\n"
+                 "  TERM \"fish\" est=2\n"
+                 "  NOT TERM \"red\" est=2\n");
+    EXPECT_EQUAL(explainPlan(planQuery("", estimate)), "UNION est=0 (skipped)\n");
+}
+
+STUDENT_TEST("executePlan matches left to right evaluation on random queries") {
+    Map<string, Set<string>> index = buildIndex(readDocs("res/tiny.txt"));
+    Vector<string> words = {"fish", "red", "blue", "milk", "eggs", "one", "i'm", "zebra", "green", "bread"};
+    Vector<string> operators = {"", "+", "-"};
+    auto matchesFor = [&](const string& term) {
+        return index.get(term);
+    };
+    auto estimate = [&](const string& term) {
+        return (long long) index.get(term).size();
+    };
+    for (int i = 0; i < 2000; i++) {
+        string query = words[randomInteger(0, words.size() - 1)];
+        for (int extra = randomInteger(0, 5); extra > 0; extra--) {
+            query += " " + operators[randomInteger(0, 2)] + words[randomInteger(0, words.size() - 1)];
+        }
+        EXPECT_EQUAL(executePlan(planQuery(query, estimate), matchesFor), evaluateQuery(query, matchesFor));
+        EXPECT_EQUAL(findQueryMatches(index, query), evaluateQuery(query, matchesFor));
+    }
+}
+
+STUDENT_TEST("executePlan never looks up terms once a result is known to be empty") {
+    Map<string, Set<string>> index = buildIndex(readDocs("res/tiny.txt"));
+    Vector<string> lookedUp;
+    auto matchesFor = [&](const string& term) {
+        lookedUp.add(term);
+        return index.get(term);
+    };
+    auto estimate = [&](const string& term) {
+        return (long long) index.get(term).size();
+    };
+
+    EXPECT(executePlan(planQuery("fish +zebra -red -blue", estimate), matchesFor).isEmpty());
+    EXPECT_EQUAL(lookedUp, Vector<string>());
+
+    EXPECT(executePlan(planQuery("fish +milk -eggs -red", estimate), matchesFor).isEmpty());
+    EXPECT_EQUAL(lookedUp, Vector<string>({"milk", "fish", "eggs"}));
+
+    lookedUp.clear();
+    EXPECT_EQUAL(executePlan(planQuery("zebra blue i'm", estimate), matchesFor),
+                 Set<string>({"www.rainbow.org", "www.dr.seuss.net", "www.bigbadwolf.com"}));
+    EXPECT_EQUAL(lookedUp, Vector<string>({"i'm", "blue"}));
+}
+
+STUDENT_TEST("Planned PostingIndex queries time trials against left to right evaluation") {
+    setRandomSeed(38);
+    string filename = "res/generated-plan.txt";
+    writeZipfCorpus(filename, 20000, 20000, 50);
+    PostingIndex index(filename);
+    deleteFile(filename);
+
+    Vector<string> queries;
+    for (int i = 0; i < 100; i++) {
+        //half the rare words are past the end of the vocabulary, like a misspelled word
+        queries.add("a b +" + benchmarkWord(randomInteger(10000, 29999)) + " -c");
+    }
+    auto matchesFor = [&](const string& term) {
+        return index.matchesFor(term);
+    };
+    for (const string& query : queries) {
+        EXPECT_EQUAL(index.findQueryMatches(query), evaluateQuery(query, matchesFor));
+    }
+    TIME_OPERATION(queries.size(), for (const string& query : queries) evaluateQuery(query, matchesFor));
+    TIME_OPERATION(queries.size(), for (const string& query : queries) index.findQueryMatches(query));
+}
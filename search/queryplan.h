@@ -0,0 +1,55 @@
+#pragma once
+#include "set.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// The kinds of node in a query plan.
+enum PlanNodeKind { PLAN_TERM, PLAN_UNION, PLAN_AND };
+
+/**
+ * One node of a query plan. A PLAN_TERM node matches the pages of one cleaned query term.
+ * A PLAN_UNION node matches the pages of any of its children. A PLAN_AND node matches the
+ * pages of all its children that none of its excluded nodes match.
+ *
+ * estimate is the most pages the node can match, so a node estimated at 0 matches nothing.
+ */
+struct PlanNode {
+    PlanNodeKind kind;
+    std::string term;                   // PLAN_TERM only
+    std::vector<PlanNode> children;     // PLAN_UNION and PLAN_AND, cheapest first
+    std::vector<PlanNode> excluded;     // PLAN_AND only, cheapest first
+    long long estimate;
+};
+
+/**
+ * Parses query with the findQueryMatches rules into a plan that gives the same result
+ * as evaluating the query left to right, but in a cheaper order. estimate is asked for
+ * the number of pages each cleaned term matches, and may overestimate but never
+ * underestimate, since a term estimated at 0 is never looked up.
+ *
+ * A run of '+' and '-' terms filters everything before it, so the run becomes one
+ * PLAN_AND node whose intersections happen smallest first, before its differences.
+ * A run of plain terms becomes one PLAN_UNION node. An empty query plans to an empty
+ * PLAN_UNION.
+ */
+PlanNode planQuery(std::string query, const std::function<long long(const std::string&)>& estimate);
+
+/**
+ * Returns the URLs a plan matches, asking matchesFor for the URLs of each term it needs.
+ * Nodes estimated at 0 are skipped, and a PLAN_AND node stops as soon as its result is
+ * empty, so later terms are never looked up.
+ */
+Set<std::string> executePlan(const PlanNode& plan,
+                             const std::function<Set<std::string>(const std::string&)>& matchesFor);
+
+/**
+ * Returns the plan as indented lines, one per node with its estimate, in the order the
+ * nodes run, like:
+ *
+ *     AND est=2
+ *       TERM "rare" est=2
+ *       TERM "the" est=950
+ *       NOT TERM "fish" est=4
+ */
+std::string explainPlan(const PlanNode& plan);
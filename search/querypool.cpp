@@ -0,0 +1,207 @@
+//A pool of worker threads that answers batches of queries against an immutable index
+//snapshot, so many queries run at once with no locking around the index itself
+
+#include "testing/SimpleTest.h"
+#include "querypool.h"
+#include "search.h"
+#include "filelib.h"
+#include "strlib.h"
+#include "random.h"
+#include <atomic>
+#include <fstream>
+using namespace std;
+
+//this constructor starts the worker threads, which wait for a batch
+QueryPool::QueryPool(int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = max(1, (int) thread::hardware_concurrency());
+    }
+    queries = nullptr;
+    evaluate = nullptr;
+    results = nullptr;
+    nextQuery = 0;
+    unfinished = 0;
+    batchNumber = 0;
+    stopping = false;
+    for (int i = 0; i < numThreads; i++) {
+        workers.emplace_back(&QueryPool::workLoop, this);
+    }
+}
+
+//this destructor wakes every worker so it sees it should stop, then waits for them
+QueryPool::~QueryPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int QueryPool::threadCount() const {
+    return workers.size();
+}
+
+//this function hands a batch to the workers and waits until every query is answered
+Vector<Set<string>> QueryPool::runBatch(const Vector<string>& queries,
+                                        const function<Set<string>(const string&)>& evaluate) {
+    lock_guard<mutex> oneBatch(batchLock);
+    Vector<Set<string>> results(queries.size());
+
+    unique_lock<mutex> guard(lock);
+    this->queries = &queries;
+    this->evaluate = &evaluate;
+    this->results = &results;
+    firstError = nullptr;
+    nextQuery = 0;
+    unfinished = queries.size();
+    batchNumber++;
+    workReady.notify_all();
+    batchDone.wait(guard, [&] { return unfinished == 0; });
+
+    this->queries = nullptr;
+    this->evaluate = nullptr;
+    this->results = nullptr;
+    if (firstError) {
+        rethrow_exception(firstError);
+    }
+    return results;
+}
+
+//this function answers every query against whichever snapshot is current when the query
+//starts. each query holds on to its snapshot, so a snapshot published mid-batch only affects
+//the queries that start after it
+Vector<Set<string>> QueryPool::findQueryMatches(const IndexSnapshots& index, const Vector<string>& queries) {
+    return runBatch(queries, [&](const string& query) {
+        shared_ptr<const Map<string, Set<string>>> snapshot = index.load();
+        return ::findQueryMatches(*snapshot, query);
+    });
+}
+
+//this function is what every worker runs. it sleeps until a new batch arrives, then keeps
+//claiming the next unanswered query of the batch until there are none left. queries are
+//answered without holding the lock
+void QueryPool::workLoop() {
+    long long lastBatch = 0;
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        workReady.wait(guard, [&] { return stopping || batchNumber != lastBatch; });
+        if (stopping) {
+            return;
+        }
+        lastBatch = batchNumber;
+
+        while (queries != nullptr && nextQuery < queries->size()) {
+            int index = nextQuery++;
+            guard.unlock();
+            Set<string> answer;
+            exception_ptr failure = nullptr;
+            try {
+                answer = (*evaluate)((*queries)[index]);
+            }
+            catch (...) {
+                failure = current_exception();
+            }
+            guard.lock();
+
+            (*results)[index] = answer;
+            if (failure && !firstError) {
+                firstError = failure;
+            }
+            unfinished--;
+            if (unfinished == 0) {
+                batchDone.notify_all();
+            }
+        }
+    }
+}
+
+//this function reads the query file and answers each non-blank line with the pool
+Vector<Set<string>> findQueryFileMatches(const IndexSnapshots& index, string queryfile, QueryPool& pool) {
+    ifstream in;
+    if (!openFile(in, queryfile)) {
+        error("Cannot open file named " + queryfile);
+    }
+    Vector<string> lines;
+    readEntireFile(in, lines);
+
+    Vector<string> queries;
+    for (const string& line : lines) {
+        if (trim(line) != "") {
+            queries.add(line);
+        }
+    }
+    return pool.findQueryMatches(index, queries);
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("findQueryMatches on a const index never adds terms to it") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    const Map<string, Set<string>> index = buildIndex(docs);
+    EXPECT(findQueryMatches(index, "hippo +fish -zebra").isEmpty());
+    EXPECT_EQUAL(index.size(), 20);
+    EXPECT(!index.containsKey("hippo"));
+}
+
+STUDENT_TEST("QueryPool answers a query file the same as answering each query in turn") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    IndexSnapshots snapshots(make_shared<const Map<string, Set<string>>>(buildIndex(docs)));
+    Vector<string> words = {"red", "fish", "blue", "milk", "i'm", "hippo", "GREEN", "bread"};
+
+    string filename = "res/generated-queries.txt";
+    ofstream out(filename);
+    Vector<string> queries;
+    for (int i = 0; i < 2000; i++) {
+        string query = words[randomInteger(0, words.size() - 1)];
+        for (int extra = randomInteger(0, 3); extra > 0; extra--) {
+            string prefix = randomChance(0.3) ? (randomChance(0.5) ? "+" : "-") : "";
+            query += " " + prefix + words[randomInteger(0, words.size() - 1)];
+        }
+        queries.add(query);
+        out << query << endl << (i % 100 == 0 ? "\n" : "");
+    }
+    out.close();
+
+    QueryPool pool(4);
+    EXPECT_EQUAL(pool.threadCount(), 4);
+    Vector<Set<string>> results = findQueryFileMatches(snapshots, filename, pool);
+    deleteFile(filename);
+
+    EXPECT_EQUAL(results.size(), queries.size());
+    for (int i = 0; i < queries.size(); i++) {
+        EXPECT_EQUAL(results[i], findQueryMatches(*snapshots.load(), queries[i]));
+    }
+    EXPECT_ERROR(pool.runBatch(queries, [](const string& query) -> Set<string> {
+        if (query.find("hippo") != string::npos) error("no hippos");
+        return {};
+    }));
+}
+
+STUDENT_TEST("QueryPool queries see either the old or the new snapshot while a rebuilt one is published") {
+    Map<string, Set<string>> docs = readDocs("res/tiny.txt");
+    IndexSnapshots snapshots(make_shared<const Map<string, Set<string>>>(buildIndex(docs)));
+    Set<string> before = findQueryMatches(buildIndex(docs), "fish");
+    docs["www.pond.org"] = {"fish"};
+    shared_ptr<const Map<string, Set<string>>> rebuilt = make_shared<const Map<string, Set<string>>>(buildIndex(docs));
+    Set<string> after = findQueryMatches(*rebuilt, "fish");
+
+    QueryPool pool(4);
+    Vector<string> queries(20000, "fish");
+    atomic<bool> published(false);
+    thread publisher([&] {
+        snapshots.publish(rebuilt);
+        published = true;
+    });
+    Vector<Set<string>> results = pool.findQueryMatches(snapshots, queries);
+    publisher.join();
+
+    for (const Set<string>& result : results) {
+        EXPECT(result == before || result == after);
+    }
+    EXPECT(published);
+    EXPECT_EQUAL(pool.findQueryMatches(snapshots, {"fish"})[0], after);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "map.h"
+#include "set.h"
+#include "vector.h"
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Holds the current snapshot of an immutable index, RCU style. Readers take a reference to
+ * the snapshot with load() and query it for as long as they like without any locking;
+ * publish() swaps in a rebuilt snapshot with one atomic pointer store. An old snapshot is
+ * freed once the last reader still holding it lets go.
+ */
+template <typename Index>
+class SnapshotHolder {
+public:
+    /**
+     * Creates a holder whose first snapshot is initial.
+     */
+    SnapshotHolder(std::shared_ptr<const Index> initial) {
+        snapshot = initial;
+    }
+
+    /**
+     * Returns the current snapshot.
+     */
+    std::shared_ptr<const Index> load() const {
+        return std::atomic_load(&snapshot);
+    }
+
+    /**
+     * Makes next the snapshot that later calls to load() return.
+     */
+    void publish(std::shared_ptr<const Index> next) {
+        std::atomic_store(&snapshot, next);
+    }
+
+private:
+    std::shared_ptr<const Index> snapshot;      // only read and written atomically
+};
+
+/**
+ * The snapshot type for the Map index built by buildIndex.
+ */
+typedef SnapshotHolder<Map<std::string, Set<std::string>>> IndexSnapshots;
+
+/**
+ * A fixed set of worker threads that answer batches of queries. Workers take the next
+ * unanswered query of the batch as soon as they finish one, so a few slow queries don't
+ * hold up the rest.
+ */
+class QueryPool {
+public:
+    /**
+     * Starts numThreads workers, or one per hardware thread if numThreads is 0.
+     */
+    QueryPool(int numThreads = 0);
+
+    /**
+     * Stops the workers.
+     */
+    ~QueryPool();
+
+    /**
+     * Returns the number of worker threads.
+     */
+    int threadCount() const;
+
+    /**
+     * Answers every query with evaluate, using all the workers, and returns the results in
+     * query order. If evaluate throws for any query, that error is rethrown here once the
+     * rest of the batch is done.
+     */
+    Vector<Set<std::string>> runBatch(const Vector<std::string>& queries,
+                                      const std::function<Set<std::string>(const std::string&)>& evaluate);
+
+    /**
+     * Answers every query against the Map index snapshot that is current when the query
+     * starts, with the findQueryMatches rules.
+     */
+    Vector<Set<std::string>> findQueryMatches(const IndexSnapshots& index, const Vector<std::string>& queries);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex batchLock;                       // one batch at a time
+
+    std::mutex lock;                            // guards everything below
+    std::condition_variable workReady;
+    std::condition_variable batchDone;
+    const Vector<std::string>* queries;
+    const std::function<Set<std::string>(const std::string&)>* evaluate;
+    Vector<Set<std::string>>* results;
+    std::exception_ptr firstError;
+    int nextQuery;
+    int unfinished;
+    long long batchNumber;
+    bool stopping;
+
+    void workLoop();
+
+    QueryPool(const QueryPool&) = delete;
+    QueryPool& operator=(const QueryPool&) = delete;
+};
+
+/**
+ * Reads a file with one query per line and answers all of them with the pool. Blank lines
+ * are skipped.
+ */
+Vector<Set<std::string>> findQueryFileMatches(const IndexSnapshots& index, std::string queryfile, QueryPool& pool);
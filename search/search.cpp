@@ -4,6 +4,7 @@
 #include "testing/SimpleTest.h"
 #include "map.h"
 #include "set.h"
+#include "hashmap.h"
 #include <string>
 #include <iostream>
 #include "filelib.h"
@@ -12,74 +13,246 @@
 #include "simpio.h"
 #include "strlib.h"
 #include "search.h"
+#include "postingindex.h"
+#include "querycache.h"
+#include "queryplan.h"
+#include "termdictionary.h"
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <climits>
+#include <string_view>
+#include <chrono>
 using namespace std;
 
+//documents are only handed to extra threads once there are at least this many per thread,
+//otherwise thread start-up costs more than the work it saves (tiny.txt stays single threaded)
+const int MIN_DOCS_PER_THREAD = 256;
+
+//searchEngine prints this many of the best ranked pages for each query
+const int SEARCH_RESULTS_SHOWN = 10;
+
+//character classes for every byte value, looked up by the tokenizer instead of calling
+//isalpha/ispunct per character. the classes follow the "C" locale, so bytes above 127 are
+//neither letters nor punctuation, same as cleanToken always treated them
+const unsigned char CHAR_LETTER = 1;
+const unsigned char CHAR_UPPER = 2;
+const unsigned char CHAR_PUNCT = 4;
+
+struct CharClassTable {
+    unsigned char classes[256] = {};
+
+    constexpr CharClassTable() {
+        for (int c = 'a'; c <= 'z'; c++) {
+            classes[c] = CHAR_LETTER;
+        }
+        for (int c = 'A'; c <= 'Z'; c++) {
+            classes[c] = CHAR_LETTER | CHAR_UPPER;
+        }
+        for (int c = '!'; c <= '~'; c++) {
+            bool isDigit = c >= '0' && c <= '9';
+            if (classes[c] == 0 && !isDigit) {
+                classes[c] = CHAR_PUNCT;
+            }
+        }
+    }
+};
+
+constexpr CharClassTable CHAR_CLASSES;
+
+//this function cleans the characters in [begin, end) in place: uppercase letters are lowered
+//while the token is walked once, and a view of the token with the punctuation on both ends
+//trimmed off is returned. an empty view is returned if the token has no letters
+string_view cleanTokenInPlace(char* begin, char* end) {
+    char* firstKept = nullptr;
+    char* lastKept = nullptr;
+    bool containsAtleastOneLetter = false;
+
+    for (char* p = begin; p < end; p++) {
+        unsigned char charClass = CHAR_CLASSES.classes[(unsigned char) *p];
+        if (charClass & CHAR_UPPER) {
+            *p = *p - 'A' + 'a';
+        }
+        if (!(charClass & CHAR_PUNCT)) {
+            if (firstKept == nullptr) {
+                firstKept = p;
+            }
+            lastKept = p;
+        }
+        containsAtleastOneLetter |= (charClass & CHAR_LETTER) != 0;
+    }
+
+    if (!containsAtleastOneLetter) {
+        return string_view();
+    }
+    return string_view(firstKept, lastKept - firstKept + 1);
+}
+
 //this function takes a string token and trims all of the punctuation from the
 //beginning and end according to the ispunct function. If the token does not
 //contain at least one letter, an empty string is returned and all cleaned tokens
 //are converted to lowercase before being returned
 string cleanToken(string token) {
-    bool containsAtleastOneLetter = false;
-    for (char character : token){
-        if (isalpha(character)) {
-            containsAtleastOneLetter = true;
-            break;
+    return string(cleanTokenInPlace(token.data(), token.data() + token.length()));
+}
+
+//this function cleans a query term like cleanToken, except that a single word with a '*' in
+//it keeps every '*' so it can be used as a wildcard. while cleaning, each '*' is swapped for
+//a byte that is neither a letter nor punctuation, so it is never trimmed off
+string cleanQueryTerm(string term) {
+    if (term.find('*') == string::npos || term.find(' ') != string::npos) {
+        return cleanToken(term);
+    }
+    string cleaning = term;
+    replace(cleaning.begin(), cleaning.end(), '*', '\x80');
+    string_view cleaned = cleanTokenInPlace(cleaning.data(), cleaning.data() + cleaning.length());
+    string result(cleaned);
+    size_t offset = cleaned.empty() ? 0 : cleaned.data() - cleaning.data();
+    for (size_t i = 0; i < result.length(); i++) {
+        if (term[offset + i] == '*') {
+            result[i] = '*';
         }
     }
+    return result;
+}
 
-    if (ispunct(token[0])) { //removes punctuation from the beginning
-        for(int i = 1; i < token.length(); i++){
-            if (!ispunct(token[i])) {
-                token = token.substr(i);
-                break;
-            }
+//the tokenizer keeps a reference to the line it walks, since the tokens it hands out
+//are views into that line
+LineTokenizer::LineTokenizer(string& line) : line(line), position(0) {}
+
+//this function finds the next space-separated word of the line that still has letters once it
+//is cleaned. the word is cleaned in place in the line and token is set to view it. false is
+//returned once the end of the line is reached
+bool LineTokenizer::next(string_view& token) {
+    char* data = line.data();
+    size_t length = line.length();
+
+    while (position < length) {
+        size_t wordEnd = line.find(' ', position);
+        if (wordEnd == string::npos) {
+            wordEnd = length;
+        }
+        string_view cleaned = cleanTokenInPlace(data + position, data + wordEnd);
+        position = wordEnd + 1;
+        if (!cleaned.empty()) {
+            token = cleaned;
+            return true;
         }
     }
+    return false;
+}
 
-    if (ispunct(token[token.length() -1])) { //removes punctuation from the end
-        for (int i = token.length() -1; i >= 0; i--){
-            if (!ispunct(token[i])) {
-                token = token.substr(0, i+1);
-                break;
-            }
-        }
+//the stream opens the file right away, so a missing file is reported when it is created
+DocStream::DocStream(string dbfile) : dbfile(dbfile), pages(0) {
+    if (!openFile(in, dbfile)) {
+        error("Cannot open file named " + dbfile);
     }
+}
 
-    if (containsAtleastOneLetter == true) {
-        return toLowerCase(token);
+//this function reads the next page's URL and content lines into url and content, reusing
+//their storage. false is returned once the file has no more pages
+bool DocStream::next(string& url, string& content) {
+    if (!getline(in, url)) {
+        return false;
     }
-    else{
-        return "";
+    if (!getline(in, content)) {
+        error("Database file " + dbfile + " has a URL without a content line");
     }
+    pages++;
+    return true;
+}
 
+//this function replaces urls and contents with the next pages of the file, at most maxPages
+//of them, and returns how many it read. 0 means the file has no more pages
+int DocStream::readBatch(Vector<string>& urls, Vector<string>& contents, int maxPages) {
+    urls.clear();
+    contents.clear();
+    string url;
+    string content;
+    while (urls.size() < maxPages && next(url, content)) {
+        urls.add(url);
+        contents.add(content);
+    }
+    return urls.size();
 }
 
-//this function takes a file and reads the contents onto a vector of lines
-//all URLs are read from the Vector<string> and added to a map as a key
-//each URL or key is associated with a Set<string> of cleaned tokens.
-//the map containing the URLs as keys and the set of cleaned tokens is returned
-Map<string, Set<string>> readDocs(string dbfile) {
-    Map<string, Set<string>> docs;
-    ifstream in;
+//this function returns how many pages have been read so far, which is also the position in
+//the file of the next page
+int DocStream::pagesRead() const {
+    return pages;
+}
 
-    if (!openFile(in, dbfile)) {
-        error("Cannot open file named " + dbfile);
+//this function picks how many worker threads to use for numItems documents. it uses every
+//hardware thread available but never gives a thread fewer than MIN_DOCS_PER_THREAD documents.
+//a numThreads above 0 is used as it is, so tests can run the parallel path on any machine
+int ingestThreadCount(int numItems, int numThreads) {
+    if (numThreads > 0) {
+        return numThreads;
     }
+    int hardwareThreads = max(1, (int) thread::hardware_concurrency());
+    return max(1, min(hardwareThreads, numItems / MIN_DOCS_PER_THREAD));
+}
 
-    Vector<string> lines;
-    readEntireFile(in, lines);
-
-    for(int i = 0; i < lines.size(); i++){
-        if (i % 2 == 0) {
-            Set<string> allTokens;
-            Vector<string> pageContent = stringSplit(lines.get(i+1), " ");
+//this function splits the items [0, numItems) into numThreads contiguous ranges and calls
+//worker(threadIndex, begin, end) for each range on its own thread. ranges are handed out in
+//order, so threadIndex 0 always gets the first documents of the file. the calling thread runs
+//the last range itself and returns once every range is done
+void runInParallel(int numItems, int numThreads, const function<void(int, int, int)>& worker) {
+    vector<thread> workers;
+    int perThread = numItems / numThreads;
+    int leftover = numItems % numThreads;
+    int begin = 0;
+    for (int t = 0; t < numThreads; t++) {
+        int end = begin + perThread + (t < leftover ? 1 : 0);
+        if (t == numThreads - 1) {
+            worker(t, begin, end);
+        }
+        else {
+            workers.emplace_back(worker, t, begin, end);
+        }
+        begin = end;
+    }
+    for (thread& w : workers) {
+        w.join();
+    }
+}
 
-            for (string word : pageContent){
-                if (cleanToken(word) != "") {
-                    allTokens.add(cleanToken(word)); //adding all cleaned words to a set
+//this function takes a file and streams its pages in batches with a DocStream
+//all URLs in each batch are added to a map as a key
+//each URL or key is associated with a Set<string> of cleaned tokens.
+//each batch is split into contiguous chunks of pages and each worker thread cleans its chunk
+//into its own partial map. the partial maps are merged in file order, batch after batch, so a
+//URL listed twice keeps its last content. only one batch of raw lines is held at a time
+//the map containing the URLs as keys and the set of cleaned tokens is returned
+Map<string, Set<string>> readDocs(string dbfile, int numThreads) {
+    Map<string, Set<string>> docs;
+    DocStream stream(dbfile);
+    Vector<string> urls;
+    Vector<string> contents;
+
+    while (stream.readBatch(urls, contents) > 0) {
+        int numDocs = urls.size();
+        int batchThreads = ingestThreadCount(numDocs, numThreads);
+        Vector<Map<string, Set<string>>> partialDocs(batchThreads);
+
+        runInParallel(numDocs, batchThreads, [&](int t, int begin, int end) {
+            for (int doc = begin; doc < end; doc++) {
+                Set<string> allTokens;
+                LineTokenizer pageContent(contents[doc]);
+                string_view word;
+
+                while (pageContent.next(word)) {
+                    allTokens.add(string(word)); //adding all cleaned words to a set
                 }
+                partialDocs[t][urls.get(doc)] = allTokens; //adding the URL and cleaned tokens into this thread's map
+            }
+        });
+
+        for (const Map<string, Set<string>>& partial : partialDocs) {
+            for (const string& URL : partial) {
+                docs[URL] = partial.get(URL);
             }
-            docs[lines.get(i)] = allTokens; //adding the URL and cleaned tokens into the map
         }
     }
 
@@ -87,77 +260,278 @@ Map<string, Set<string>> readDocs(string dbfile) {
 }
 
 //this function creates an inverted index given a map with URLs as the keys and sets of words
-//associated with those keys. A map containing words as the keys and a set of URLs associated with
-//each word is returned
-Map<string, Set<string>> buildIndex(Map<string, Set<string>>& docs) {
+//associated with those keys. every worker thread inverts a contiguous range of the URLs into a
+//partial index, and the partial indexes are unioned together at the end. A map containing words
+//as the keys and a set of URLs associated with each word is returned
+Map<string, Set<string>> buildIndex(const Map<string, Set<string>>& docs, int numThreads) {
     Map<string, Set<string>> index;
 
-    for (string key : docs){
-        for(string word : docs[key]){
-            index[word];      //finds a word and then adds it to our index as a key
-            for (string URL : docs){ //looks through all our Sets in docs. if a word is in the Set, the URL associated with that set is added to the index entry for the word
-                if (docs[URL].contains(word)) {
-                    index[word].add(URL);
-                }
+    Vector<string> URLs = docs.keys();
+    numThreads = ingestThreadCount(URLs.size(), numThreads);
+    Vector<Map<string, Set<string>>> partialIndexes(numThreads);
+
+    runInParallel(URLs.size(), numThreads, [&](int t, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const string& URL = URLs.get(i);
+            for (const string& word : docs.get(URL)) {
+                partialIndexes[t][word].add(URL); //each word in a page points back to that page's URL
             }
         }
+    });
 
+    for (const Map<string, Set<string>>& partial : partialIndexes) {
+        for (const string& word : partial) {
+            index[word] += partial.get(word);
+        }
     }
 
     return index;
 }
 
-//this function takes a map, which is the inverted index, and a query
-//and returns a set of URL matches for the given query. Querys can
-//use '-', '+' and spaces to indicate whether invidivdual search matches
-//should be unioned, intersected, or differenced
-Set<string> findQueryMatches(Map<string, Set<string>>& index, string query) {
-    Set<string> result;
+//this function checks whether a query word is a NEAR/k operator (any case) and if so sets
+//distance to k. a k too big for an int is read as the biggest int, since no two words of a
+//page can be further apart than that
+bool parseNearOperator(const string& word, int& distance) {
+    if (word.length() < 6 || toLowerCase(word.substr(0, 5)) != "near/") {
+        return false;
+    }
+    long long value = 0;
+    for (size_t i = 5; i < word.length(); i++) {
+        if (!isdigit(word[i])) {
+            return false;
+        }
+        value = min<long long>(value * 10 + (word[i] - '0'), INT_MAX);
+    }
+    distance = value;
+    return true;
+}
+
+//this function splits a query into its terms. terms are normally separated by spaces, but a
+//quoted phrase such as "red fish" (optionally prefixed by '+' or '-') stays together as one
+//term, and "a NEAR/k b" is joined into one term as long as neither side is a phrase
+Vector<string> splitQuery(string query) {
+    Vector<QueryTermKind> kinds;
+    return splitQuery(query, kinds);
+}
+
+//this function splits a query like splitQuery and also sets kinds to what each term is, as
+//only the split knows which terms were quoted and which were joined around a NEAR/k
+Vector<string> splitQuery(string query, Vector<QueryTermKind>& kinds) {
+    Vector<string> words = stringSplit(query, " ");
+    Vector<string> terms;
+    kinds.clear();
+    int distance;
+
+    for (int i = 0; i < words.size(); i++) {
+        string term = words[i];
+        size_t quote = term.find('"');
+        bool opensPhrase = quote <= 1 && (term.length() == quote + 1 || term.back() != '"');
+        while (opensPhrase && i + 1 < words.size()) {
+            term += " " + words[++i];
+            if (!term.empty() && term.back() == '"') {
+                break;
+            }
+        }
+
+        bool joinsNeighbours = parseNearOperator(term, distance) && !terms.isEmpty() && i + 1 < words.size()
+                               && terms.back().find('"') == string::npos && words[i + 1].find('"') == string::npos;
+        if (joinsNeighbours) {
+            terms.back() += " " + term + " " + words[++i];
+            kinds[kinds.size() - 1] = QUERY_NEAR;
+        }
+        else {
+            terms.add(term);
+            kinds.add(quote <= 1 ? QUERY_PHRASE : QUERY_WORD);
+        }
+    }
+    return terms;
+}
+
+//this function cleans one split query term, with its operator already removed, into a parsed
+//term. a phrase keeps its quotes around its cleaned words, so the kind reaches any index that
+//is only handed the term. a phrase or NEAR term that cleans to one word is just that word
+QueryTerm parsedTerm(QueryOperator op, const string& term, QueryTermKind kind) {
+    string cleaned = cleanQueryTerm(term);
+    if (cleaned.find(' ') == string::npos) {
+        return {op, cleaned, QUERY_WORD};
+    }
+    return {op, kind == QUERY_PHRASE ? "\"" + cleaned + "\"" : cleaned, kind};
+}
 
-    Vector<string> terms = stringSplit(query, " ");
-    result += index[cleanToken(terms.get(0))];
+//this function reads a query into its terms in order, following the query rules: the first
+//term and every term starting with a letter or a quote are unioned, a term starting with '+'
+//is intersected and one starting with '-' is differenced from everything before it. each
+//term is cleaned with cleanToken after its operator is removed. terms starting with anything
+//else are ignored, so they are left out. phrases and NEAR terms come out as one cleaned
+//string with spaces in it, a phrase wrapped in quotes, and each term carries its kind
+Vector<QueryTerm> parseQuery(string query) {
+    Vector<QueryTerm> parsed;
+    Vector<QueryTermKind> kinds;
+    Vector<string> terms = splitQuery(query, kinds);
+    if (terms.isEmpty()) {
+        return parsed;
+    }
+    parsed.add(parsedTerm(QUERY_UNION, terms.get(0), kinds[0]));
 
     for(int i = 1; i < terms.size(); i++){
         string currentTerm = terms.get(i);
 
-        if (isalpha(currentTerm[0])) {
-            result = result + index[cleanToken(currentTerm)];
+        if (isalpha(currentTerm[0]) || currentTerm[0] == '"') {
+            parsed.add(parsedTerm(QUERY_UNION, currentTerm, kinds[i]));
         }
         else if (currentTerm[0] == '+') {
-            result = result * index[cleanToken(currentTerm.substr(1))];
+            parsed.add(parsedTerm(QUERY_INTERSECT, currentTerm.substr(1), kinds[i]));
         }
         else if (currentTerm[0] == '-') {
-            result = result - index[cleanToken(currentTerm.substr(1))];
+            parsed.add(parsedTerm(QUERY_DIFFERENCE, currentTerm.substr(1), kinds[i]));
+        }
+    }
+    return parsed;
+}
+
+//this function returns the kind of a term parseQuery cleaned, for indexes that are only
+//handed the term: parseQuery wraps a phrase in quotes, and only a NEAR term has spaces
+//without them
+QueryTermKind termKind(const string& term) {
+    if (!term.empty() && term[0] == '"') {
+        return QUERY_PHRASE;
+    }
+    return term.find(' ') == string::npos ? QUERY_WORD : QUERY_NEAR;
+}
+
+//this function returns the cleaned words of a term parseQuery cleaned, in order. the NEAR/k
+//operators of a NEAR term are not words, but a phrase's words are all kept, even one that
+//looks like an operator
+Vector<string> termWords(const string& term) {
+    Vector<string> words;
+    bool isNear = termKind(term) == QUERY_NEAR;
+    string line = term;
+    LineTokenizer tokenizer(line);
+    string_view token;
+    int distance;
+    while (tokenizer.next(token)) {
+        string word(token);
+        if (!isNear || !parseNearOperator(word, distance)) {
+            words.add(word);
+        }
+    }
+    return words;
+}
+
+//this function evaluates a query left to right, asking matchesFor for the URLs of each
+//cleaned term, so the same query rules work for any kind of index. terms separated by
+//spaces are unioned, a term starting with '+' is intersected and one starting with '-'
+//is differenced from everything before it. phrases and NEAR terms reach matchesFor as one
+//cleaned string with spaces in it, which only a positional index can answer exactly, and
+//wildcard terms keep their '*'s for matchesFor to match against the index's words.
+//the set of matching URLs is returned
+Set<string> evaluateQuery(string query, const function<Set<string>(const string&)>& matchesFor) {
+    Set<string> result;
+
+    for (const QueryTerm& term : parseQuery(query)) {
+        if (term.op == QUERY_UNION) {
+            result = result + matchesFor(term.term);
+        }
+        else if (term.op == QUERY_INTERSECT) {
+            result = result * matchesFor(term.term);
+        }
+        else {
+            result = result - matchesFor(term.term);
         }
     }
 
     return result;
 }
 
-//this function uses helper functions readDocs, buildIndex, and findQueryMatches
-//to allow the user to see how many URLs are processed from a file, how many distinct words
-//are found across all content, and find URL matches for queries. The file name is taken
-//as the argument and the function returns nothing
+//this function evaluates a query to the same result, but through a query plan: estimate
+//gives an upper bound on the pages each cleaned term matches, so cheap terms run first
+//and terms that can no longer change the result are never passed to matchesFor
+Set<string> evaluateQuery(string query, const function<Set<string>(const string&)>& matchesFor,
+                          const function<long long(const string&)>& estimate) {
+    return executePlan(planQuery(query, estimate), matchesFor);
+}
+
+//this function returns the URLs a Map index has for one cleaned query term. a Map has no
+//word positions, so a phrase or NEAR term is answered with the pages holding all its words,
+//which is every page the exact answer holds and possibly more. a Map has no term dictionary
+//either, so a wildcard term is matched against every key of the index
+Set<string> mapMatchesFor(const Map<string, Set<string>>& index, const string& term) {
+    if (term.find(' ') == string::npos) {
+        if (term.find('*') == string::npos) {
+            return index.get(term); //get never adds a key, so many threads can share one index
+        }
+        Set<string> result;
+        for (const string& word : index) {
+            if (wildcardMatches(term, word)) {
+                result = result + index.get(word);
+            }
+        }
+        return result;
+    }
+    Set<string> result;
+    bool first = true;
+    for (const string& word : termWords(term)) {
+        result = first ? index.get(word) : result * index.get(word);
+        first = false;
+    }
+    return result;
+}
+
+//this function takes a map, which is the inverted index, and a query
+//and returns a set of URL matches for the given query. Querys can
+//use '-', '+' and spaces to indicate whether invidivdual search matches
+//should be unioned, intersected, or differenced. phrases and NEAR terms match the pages with
+//all their words, a superset of what a PostingIndex returns for them. a Map can only hand out
+//copies of its sets, so each term is copied once while planning and the plan reuses that copy
+Set<string> findQueryMatches(const Map<string, Set<string>>& index, string query) {
+    HashMap<string, Set<string>> fetched;
+    return evaluateQuery(query, [&](const string& term) {
+        return fetched[term];
+    }, [&](const string& term) {
+        if (!fetched.containsKey(term)) {
+            fetched[term] = mapMatchesFor(index, term);
+        }
+        return (long long) fetched[term].size();
+    });
+}
+
+//this function builds a PostingIndex from the file and lets the user search it. the user
+//sees how many URLs are processed from a file and how many distinct words are found across
+//all content, and every query prints its best SEARCH_RESULTS_SHOWN matching pages ranked by
+//BM25, or fewer if fewer match. repeated queries are answered from a query cache, and a query
+//starting with "EXPLAIN " prints its query plan instead. The file name is taken as the
+//argument and the function returns nothing
 void searchEngine(string dbfile) {
-    Map<string, Set<string>> readFile = readDocs(dbfile);
     cout << "Stand by while building index..." << endl;
-    Map<string, Set<string>> index = buildIndex(readFile);
-
+    PostingIndex index(dbfile);
+    QueryCache<Vector<ScoredMatch>> cache;
 
-    cout << "Indexed " << readFile.size() << " pages containing " << index.size() << " unique terms." << endl;
+    cout << "Indexed " << index.size() << " pages containing " << index.termCount() << " unique terms." << endl;
     bool isRunning = true;
     while (isRunning){
         string searchTerm = getLine("Enter query sentence (RETURN/ENTER to quit): ");
         if (searchTerm == "") {
+            cout << "Query cache answered " << cache.hits() << " of " << cache.hits() + cache.misses()
+                 << " queries." << endl;
             cout << "All done!";
             isRunning = false;
         }
         else{
-            Set<string> allMatches = findQueryMatches(index, searchTerm);
-            cout << "Found " << allMatches.size() << " matching page(s)" << endl << allMatches << endl << "\n";
+            if (startsWith(searchTerm, "EXPLAIN ")) {
+                cout << explainPlan(planQuery(searchTerm.substr(8), [&](const string& term) {
+                    return index.matchEstimate(term);
+                })) << endl;
+                continue;
+            }
+            Vector<ScoredMatch> bestMatches = cache.lookup(searchTerm, [&](const string& query) {
+                return index.findTopMatches(query, SEARCH_RESULTS_SHOWN);
+            });
+            cout << "Best " << bestMatches.size() << " matching page(s)" << endl;
+            for (const ScoredMatch& match : bestMatches) {
+                cout << "    " << match << endl;
+            }
+            cout << endl;
         }
-
-
     }
 
 }
@@ -280,3 +654,213 @@ STUDENT_TEST("findQueryMatches compound queries. Various tests to ensure searchi
     Set<string> matchesYellowNotMilkNotYou = findQueryMatches(index, "yellow -milk -you");
     EXPECT_EQUAL(matchesYellowNotMilkNotYou.size(), 1);
 }
+
+STUDENT_TEST("readDocs and buildIndex on several threads match a one-thread build") {
+    string filename = "res/generated-readdocs.txt";
+    ofstream out(filename);
+    Vector<string> words = {"Red", "fish!", "~blue~", "i'm", "106", "--", "milk,", "Green"};
+    for (int page = 0; page < 5000; page++) {
+        out << "www.page" << page << ".com" << endl;
+        for (int w = 0; w < 12; w++) {
+            out << words[(page * 7 + w * w) % words.size()] << " ";
+        }
+        out << endl;
+    }
+    out << "www.page0.com" << endl << "only this" << endl; //a repeated URL keeps its last content
+    out.close();
+
+    Map<string, Set<string>> docs = readDocs(filename, 4);
+    Map<string, Set<string>> index = buildIndex(docs, 3);
+    EXPECT_EQUAL(docs, readDocs(filename, 1));
+    EXPECT_EQUAL(index, buildIndex(docs, 1));
+    deleteFile(filename);
+
+    EXPECT_EQUAL(docs.size(), 5000);
+    EXPECT_EQUAL(docs["www.page0.com"], Set<string>({"only", "this"}));
+    for (const string& URL : docs) {
+        for (const string& word : docs[URL]) {
+            EXPECT(index[word].contains(URL));
+        }
+    }
+    EXPECT_EQUAL(index["only"].size(), 1);
+    EXPECT_EQUAL(index.size(), 8);
+}
+
+STUDENT_TEST("DocStream reads pages one at a time and in batches") {
+    DocStream stream("res/tiny.txt");
+    string url;
+    string content;
+    EXPECT(stream.next(url, content));
+    EXPECT_EQUAL(url, "www.shoppinglist.com");
+    EXPECT_EQUAL(content, "EGGS! milk, fish,      @  bread cheese");
+    Vector<string> urls;
+    Vector<string> contents;
+    EXPECT_EQUAL(stream.readBatch(urls, contents, 2), 2);
+    EXPECT_EQUAL(urls, Vector<string>({"www.rainbow.org", "www.dr.seuss.net"}));
+    EXPECT_EQUAL(stream.pagesRead(), 3);
+    EXPECT_EQUAL(stream.readBatch(urls, contents, 2), 1);
+    EXPECT_EQUAL(stream.readBatch(urls, contents, 2), 0);
+    EXPECT(urls.isEmpty());
+
+    string filename = "res/generated-missing-content.txt";
+    ofstream out(filename);
+    out << "www.pond.org" << endl << "red fish" << endl << "www.lake.org" << endl;
+    out.close();
+    DocStream broken(filename);
+    EXPECT(broken.next(url, content));
+    EXPECT_ERROR(broken.next(url, content));
+    EXPECT_ERROR(readDocs(filename));
+    deleteFile(filename);
+    EXPECT_ERROR(DocStream("res/missing.txt"));
+}
+
+STUDENT_TEST("readDocs streams a file of several batches the same as reading it page by page") {
+    string filename = "res/generated-stream.txt";
+    ofstream out(filename);
+    Vector<string> words = {"Red", "fish!", "~blue~", "i'm", "106", "milk,", "Green", "one"};
+    for (int page = 0; page < 20000; page++) {
+        out << "www.page" << page % 17000 << ".com" << endl; //repeats span batches
+        for (int w = 0; w < 6; w++) {
+            out << words[(page * 5 + w * 3) % words.size()] << (page % 3 == 0 ? "! " : " ");
+        }
+        out << "page" << page << endl;
+    }
+    out.close();
+
+    Map<string, Set<string>> expected;
+    DocStream stream(filename);
+    string url;
+    string content;
+    while (stream.next(url, content)) {
+        Set<string> tokens;
+        LineTokenizer tokenizer(content);
+        string_view token;
+        while (tokenizer.next(token)) {
+            tokens.add(string(token));
+        }
+        expected[url] = tokens;
+    }
+    Map<string, Set<string>> docs = readDocs(filename);
+    deleteFile(filename);
+
+    EXPECT_EQUAL(docs.size(), 17000);
+    EXPECT(docs == expected);
+    EXPECT(docs["www.page5.com"].contains("page17005"));
+}
+
+STUDENT_TEST("LineTokenizer gives the same words as stringSplit and cleanToken, lowercased in place") {
+    string line = "One Fish  Two ~FISH~ !!! 106 -!!didn't!- ~?as-is! @";
+    Vector<string> expected;
+    for (const string& word : stringSplit(line, " ")) {
+        if (cleanToken(word) != "") {
+            expected.add(cleanToken(word));
+        }
+    }
+
+    Vector<string> tokens;
+    LineTokenizer tokenizer(line);
+    string_view token;
+    while (tokenizer.next(token)) {
+        tokens.add(string(token));
+    }
+    EXPECT_EQUAL(tokens, expected);
+    EXPECT_EQUAL(line, "one fish  two ~fish~ !!! 106 -!!didn't!- ~?as-is! @");
+}
+
+STUDENT_TEST("cleanToken matches the old punctuation rules on every single character") {
+    for (int c = 1; c < 256; c++) {
+        string token = string("x") + char(c);
+        string expected = ispunct(c) ? "x" : toLowerCase(token);
+        if (c >= 128) {
+            expected = token; //bytes above 127 are never punctuation or letters
+        }
+        EXPECT_EQUAL(cleanToken(token), expected);
+        EXPECT_EQUAL(cleanToken(string(1, char(c))), isalpha(c) ? string(1, char(tolower(c))) : "");
+    }
+}
+
+STUDENT_TEST("splitQuery keeps quoted phrases and NEAR terms together") {
+    EXPECT_EQUAL(splitQuery("red fish"), Vector<string>({"red", "fish"}));
+    EXPECT_EQUAL(splitQuery("\"red fish\" +blue"), Vector<string>({"\"red fish\"", "+blue"}));
+    EXPECT_EQUAL(splitQuery("milk -\"one fish two\" \"eggs\""), Vector<string>({"milk", "-\"one fish two\"", "\"eggs\""}));
+    EXPECT_EQUAL(splitQuery("red NEAR/3 blue -fish"), Vector<string>({"red NEAR/3 blue", "-fish"}));
+    EXPECT_EQUAL(splitQuery("NEAR/3 blue"), Vector<string>({"NEAR/3", "blue"}));
+    EXPECT_EQUAL(splitQuery("\"red fish\" NEAR/2 blue"), Vector<string>({"\"red fish\"", "NEAR/2", "blue"}));
+}
+
+STUDENT_TEST("Map findQueryMatches answers phrase and NEAR terms with pages holding all their words") {
+    Map<string, Set<string>> index = buildIndex(readDocs("res/tiny.txt"));
+    PostingIndex positional("res/tiny.txt");
+    Set<string> both = index.get("red") * index.get("fish");
+    EXPECT(!both.isEmpty());
+    for (string query : {"\"red fish\"", "red NEAR/1 fish", "red NEAR/99999999999 fish"}) {
+        EXPECT_EQUAL(findQueryMatches(index, query), both);
+        EXPECT(positional.findQueryMatches(query).isSubsetOf(both));
+    }
+    EXPECT_EQUAL(findQueryMatches(index, "milk -\"red fish\""), index.get("milk") - both);
+
+    int distance;
+    EXPECT(parseNearOperator("near/99999999999", distance));
+    EXPECT_EQUAL(distance, INT_MAX);
+    EXPECT(parseNearOperator("NEAR/12", distance));
+    EXPECT_EQUAL(distance, 12);
+    EXPECT(!parseNearOperator("NEAR/1x", distance));
+}
+
+STUDENT_TEST("parseQuery keeps the '*'s of wildcard terms") {
+    EXPECT_EQUAL(cleanQueryTerm("Fish*!"), "fish*");
+    EXPECT_EQUAL(cleanQueryTerm("*Fi*SH."), "*fi*sh");
+    EXPECT_EQUAL(cleanQueryTerm("**"), "");
+    EXPECT_EQUAL(cleanQueryTerm("\"red fish*\""), "red fish");
+    Vector<QueryTerm> terms = parseQuery("f*sh +Blue* *ed -*ing");
+    EXPECT_EQUAL(terms.size(), 3); //a term after the first has to start with a letter, quote or operator
+    EXPECT_EQUAL(terms[0].term, "f*sh");
+    EXPECT_EQUAL(terms[1].term, "blue*");
+    EXPECT_EQUAL(terms[1].op, QUERY_INTERSECT);
+    EXPECT_EQUAL(terms[2].term, "*ing");
+    EXPECT_EQUAL(terms[2].op, QUERY_DIFFERENCE);
+}
+
+STUDENT_TEST("Map findQueryMatches expands wildcard terms over the words of the index") {
+    Map<string, Set<string>> index = buildIndex(readDocs("res/tiny.txt"));
+    PostingIndex postings("res/tiny.txt");
+    EXPECT_EQUAL(findQueryMatches(index, "fish*").size(), 2);
+    for (string query : {"fish*", "*e*", "f*sh +r*d", "milk -bl*", "*zz*"}) {
+        EXPECT_EQUAL(findQueryMatches(index, query), postings.findQueryMatches(query));
+    }
+}
+
+STUDENT_TEST("LineTokenizer time trials against stringSplit and cleanToken") {
+    Vector<string> words = {"Red", "fish!", "~blue~", "i'm", "106", "--", "milk,", "GREEN"};
+    for (int numLines = 10000; numLines <= 270000; numLines *= 3) {
+        Vector<string> lines;
+        for (int i = 0; i < numLines; i++) {
+            string line;
+            for (int w = 0; w < 20; w++) {
+                line += words[(i + w) % words.size()] + " ";
+            }
+            lines.add(line);
+        }
+
+        int splitTokens = 0;
+        TIME_OPERATION(numLines * 20, for (const string& line : lines) {
+            for (const string& word : stringSplit(line, " ")) {
+                if (cleanToken(word) != "") splitTokens++;
+            }
+        });
+
+        int tokens = 0;
+        auto start = chrono::steady_clock::now();
+        for (string& line : lines) {
+            LineTokenizer tokenizer(line);
+            string_view token;
+            while (tokenizer.next(token)) {
+                tokens++;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "    LineTokenizer: " << tokens << " tokens at "
+             << (long long) (tokens / max(seconds, 1e-9)) << " tokens/sec" << endl;
+        EXPECT_EQUAL(tokens, splitTokens);
+    }
+}
@@ -1,11 +1,86 @@
 #pragma once
 #include "map.h"
 #include "set.h"
+#include "vector.h"
+#include <string>
+#include <fstream>
+#include <functional>
+#include <string_view>
 
-Map<std::string, Set<std::string>> readDocs(std::string filename);
+std::string cleanToken(std::string token);
+std::string cleanQueryTerm(std::string term);
 
-Map<std::string, Set<std::string>> buildIndex(Map<std::string, Set<std::string>>& docs);
+// Walks the space-separated words of one line of page content, cleaning each word in place
+// (lowercased, punctuation trimmed) and handing it out as a view into the line. Words that
+// clean to nothing are skipped. The line must outlive the tokenizer and its tokens.
+class LineTokenizer {
+public:
+    LineTokenizer(std::string& line);
+    bool next(std::string_view& token);
 
-Set<std::string> findQueryMatches(Map<std::string, Set<std::string>>& index, std::string query);
+private:
+    std::string& line;
+    size_t position;
+};
+
+// Reads the pages of a database file (a URL line followed by a content line) one at a time,
+// so ingesting a file never needs more than a batch of its pages in memory. A URL line without
+// a content line after it makes next() call error().
+class DocStream {
+public:
+    DocStream(std::string dbfile);
+    bool next(std::string& url, std::string& content);
+    int readBatch(Vector<std::string>& urls, Vector<std::string>& contents, int maxPages = 8192);
+    int pagesRead() const;
+
+private:
+    std::string dbfile;
+    std::ifstream in;
+    int pages;
+};
+
+int ingestThreadCount(int numItems, int numThreads = 0);
+
+void runInParallel(int numItems, int numThreads, const std::function<void(int, int, int)>& worker);
+
+Map<std::string, Set<std::string>> readDocs(std::string filename, int numThreads = 0);
+
+Map<std::string, Set<std::string>> buildIndex(const Map<std::string, Set<std::string>>& docs, int numThreads = 0);
+
+bool parseNearOperator(const std::string& word, int& distance);
+
+Vector<std::string> splitQuery(std::string query);
+
+// How one query term combines with the terms before it.
+enum QueryOperator { QUERY_UNION, QUERY_INTERSECT, QUERY_DIFFERENCE };
+
+// How one query term matches pages: as a word or wildcard, as a quoted phrase, or as words
+// within NEAR/k of each other.
+enum QueryTermKind { QUERY_WORD, QUERY_PHRASE, QUERY_NEAR };
+
+struct QueryTerm {
+    QueryOperator op;
+    std::string term;   // cleaned; a phrase keeps its quotes, a NEAR term its spaces, a wildcard its '*'s
+    QueryTermKind kind;
+};
+
+Vector<std::string> splitQuery(std::string query, Vector<QueryTermKind>& kinds);
+
+Vector<QueryTerm> parseQuery(std::string query);
+
+QueryTermKind termKind(const std::string& term);
+
+Vector<std::string> termWords(const std::string& term);
+
+Set<std::string> evaluateQuery(std::string query,
+                               const std::function<Set<std::string>(const std::string&)>& matchesFor);
+
+Set<std::string> evaluateQuery(std::string query,
+                               const std::function<Set<std::string>(const std::string&)>& matchesFor,
+                               const std::function<long long(const std::string&)>& estimate);
+
+Set<std::string> mapMatchesFor(const Map<std::string, Set<std::string>>& index, const std::string& term);
+
+Set<std::string> findQueryMatches(const Map<std::string, Set<std::string>>& index, std::string query);
 
 void searchEngine(std::string dbfile);
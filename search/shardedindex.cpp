@@ -0,0 +1,577 @@
+//An index partitioned by page range into shards that are queried with scatter-gather: each
+//query goes to every shard at once and the coordinator merges the shards' answers. Shards
+//can live in this process or, on POSIX systems, each in a child process behind a pipe
+
+#include "testing/SimpleTest.h"
+#include "shardedindex.h"
+#include "search.h"
+#include "error.h"
+#include "filelib.h"
+#include "strlib.h"
+#include "random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#ifndef _WIN32
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+class IndexShard {
+public:
+    virtual ~IndexShard() {}
+    virtual Set<string> findQueryMatches(const string& query) = 0;
+    virtual CollectionStatistics statistics(const string& query) = 0;
+    virtual Vector<ScoredMatch> findTopMatches(const string& query, int k, const CollectionStatistics& collection) = 0;
+};
+
+//a shard whose PostingIndex is in this process. PostingIndex queries are const, so
+//any number of threads can query it at once
+class LocalShard : public IndexShard {
+public:
+    LocalShard(const string& dbfile, int shard, int numShards) : index(dbfile, shard, numShards) {}
+
+    Set<string> findQueryMatches(const string& query) override {
+        return index.findQueryMatches(query);
+    }
+
+    CollectionStatistics statistics(const string& query) override {
+        return index.statistics(query);
+    }
+
+    Vector<ScoredMatch> findTopMatches(const string& query, int k, const CollectionStatistics& collection) override {
+        return index.findTopMatches(query, k, collection);
+    }
+
+private:
+    PostingIndex index;
+};
+
+#ifndef _WIN32
+
+//Shard processes speak a line-based protocol over their pipes. Every request starts with a
+//command line and every reply starts with "OK" or "ERROR <message>":
+//  MATCH, <query>                          -> <n>, then n URL lines
+//  STATS, <query>                          -> <statistics>
+//  TOP <k>, <statistics>, <query>          -> <n>, then n lines "<docId> <score> <url>"
+//  QUIT                                    -> no reply; the process exits
+//where <statistics> is a line "<numDocs> <totalLength> <m>" followed by m lines "<df> <word>".
+//scores are written as hexadecimal floats so they cross the pipe without rounding
+
+//this function reads one line without its newline, returning false at end of file
+bool readLine(FILE* in, string& line) {
+    line.clear();
+    int c;
+    while ((c = getc(in)) != EOF && c != '\n') {
+        line += (char) c;
+    }
+    return c != EOF || !line.empty();
+}
+
+void writeStatistics(FILE* out, const CollectionStatistics& statistics) {
+    fprintf(out, "%d %lld %d\n", statistics.numDocs, statistics.totalLength, statistics.documentFrequencies.size());
+    for (const string& word : statistics.documentFrequencies) {
+        fprintf(out, "%d %s\n", statistics.documentFrequencies.get(word), word.c_str());
+    }
+}
+
+CollectionStatistics readStatistics(FILE* in) {
+    CollectionStatistics statistics;
+    string line;
+    int count = 0;
+    readLine(in, line);
+    istringstream(line) >> statistics.numDocs >> statistics.totalLength >> count;
+    for (int i = 0; i < count; i++) {
+        readLine(in, line);
+        size_t space = line.find(' ');
+        statistics.documentFrequencies[line.substr(space + 1)] = stringToInteger(line.substr(0, space));
+    }
+    return statistics;
+}
+
+//this function is all a shard process does once it has built its index: answer requests
+//until it is told to quit or the coordinator goes away
+void serveShard(const PostingIndex& index, FILE* in, FILE* out) {
+    string command;
+    string query;
+    while (readLine(in, command) && command != "QUIT") {
+        try {
+            if (command == "MATCH") {
+                readLine(in, query);
+                Set<string> matches = index.findQueryMatches(query);
+                fprintf(out, "OK\n%d\n", matches.size());
+                for (const string& url : matches) {
+                    fprintf(out, "%s\n", url.c_str());
+                }
+            }
+            else if (command == "STATS") {
+                readLine(in, query);
+                CollectionStatistics statistics = index.statistics(query);
+                fprintf(out, "OK\n");
+                writeStatistics(out, statistics);
+            }
+            else if (startsWith(command, "TOP ")) {
+                int k = stringToInteger(command.substr(4));
+                CollectionStatistics collection = readStatistics(in);
+                readLine(in, query);
+                Vector<ScoredMatch> matches = index.findTopMatches(query, k, collection);
+                fprintf(out, "OK\n%d\n", matches.size());
+                for (const ScoredMatch& match : matches) {
+                    fprintf(out, "%d %a %s\n", match.docId, match.score, match.url.c_str());
+                }
+            }
+            else {
+                error("Unknown shard request " + command);
+            }
+        }
+        catch (ErrorException& e) {
+            fprintf(out, "ERROR %s\n", e.getMessage().c_str());
+        }
+        fflush(out);
+    }
+}
+
+//a write to the pipe of a shard process that died would raise SIGPIPE, which kills the whole
+//program by default, so it is ignored and the dead shard shows up as a read error instead. the
+//handler is process-wide, so the guards count how many indexes need it ignored and the first
+//one saves the handler that the last one puts back
+class PipeSignalGuard {
+public:
+    PipeSignalGuard() {
+        lock_guard<mutex> guard(usersLock);
+        if (users++ == 0) {
+            struct sigaction ignore = {};
+            ignore.sa_handler = SIG_IGN;
+            sigemptyset(&ignore.sa_mask);
+            sigaction(SIGPIPE, &ignore, &saved);
+        }
+    }
+
+    ~PipeSignalGuard() {
+        lock_guard<mutex> guard(usersLock);
+        if (--users == 0) {
+            sigaction(SIGPIPE, &saved, nullptr);
+        }
+    }
+
+private:
+    static mutex usersLock;
+    static int users;                   // guards alive; guarded by usersLock
+    static struct sigaction saved;      // the handler from before the first guard
+};
+
+mutex PipeSignalGuard::usersLock;
+int PipeSignalGuard::users = 0;
+struct sigaction PipeSignalGuard::saved;
+
+//a shard built and served by a child process. the coordinator keeps one end of a pipe to
+//the child and one from it, and sends requests one at a time
+class ProcessShard : public IndexShard {
+public:
+    //this constructor forks the child, which builds its shard of the file and then serves
+    //it. coordinatorFds collects the pipe ends every shard's coordinator side uses, since a
+    //child inherits those of the shards forked before it and has to close them
+    ProcessShard(const string& dbfile, int shard, int numShards, Vector<int>& coordinatorFds) {
+        this->shard = shard;
+        ready = false;
+        int toChild[2];
+        int fromChild[2];
+        if (pipe(toChild) != 0) {
+            error("Cannot create a pipe for shard " + integerToString(shard));
+        }
+        if (pipe(fromChild) != 0) {
+            close(toChild[0]);
+            close(toChild[1]);
+            error("Cannot create a pipe for shard " + integerToString(shard));
+        }
+        fflush(nullptr); //so the child doesn't print the coordinator's buffered output again
+        child = fork();
+        if (child < 0) {
+            for (int fd : {toChild[0], toChild[1], fromChild[0], fromChild[1]}) {
+                close(fd);
+            }
+            error("Cannot start a process for shard " + integerToString(shard));
+        }
+
+        if (child == 0) {
+            for (int fd : coordinatorFds) {
+                close(fd);
+            }
+            close(toChild[1]);
+            close(fromChild[0]);
+            FILE* in = fdopen(toChild[0], "r");
+            FILE* out = fdopen(fromChild[1], "w");
+            try {
+                PostingIndex index(dbfile, shard, numShards);
+                fprintf(out, "OK\n");
+                fflush(out);
+                serveShard(index, in, out);
+            }
+            catch (ErrorException& e) {
+                fprintf(out, "ERROR %s\n", e.getMessage().c_str());
+                fflush(out);
+            }
+            catch (...) {
+                //any other exception, like bad_alloc, must not unwind into the coordinator's
+                //stack. the reply it broke off may be half written, so the child just exits
+                //and the coordinator sees the shard process stop
+                _exit(1);
+            }
+            _exit(0); //skip the coordinator's exit handlers and destructors
+        }
+
+        close(toChild[0]);
+        close(fromChild[1]);
+        toShard = fdopen(toChild[1], "w");
+        fromShard = fdopen(fromChild[0], "r");
+        coordinatorFds.add(toChild[1]);
+        coordinatorFds.add(fromChild[0]);
+    }
+
+    //this destructor tells the child to quit and waits for it to exit
+    ~ProcessShard() override {
+        fprintf(toShard, "QUIT\n");
+        fclose(toShard);
+        fclose(fromShard);
+        waitpid(child, nullptr, 0);
+    }
+
+    Set<string> findQueryMatches(const string& query) override {
+        lock_guard<mutex> guard(lock);
+        request("MATCH\n" + oneLine(query) + "\n");
+        Set<string> matches;
+        string line;
+        for (int count = stringToInteger(reply()); count > 0; count--) {
+            readLine(fromShard, line);
+            matches.add(line);
+        }
+        return matches;
+    }
+
+    CollectionStatistics statistics(const string& query) override {
+        lock_guard<mutex> guard(lock);
+        request("STATS\n" + oneLine(query) + "\n");
+        awaitOk();
+        return readStatistics(fromShard);
+    }
+
+    Vector<ScoredMatch> findTopMatches(const string& query, int k, const CollectionStatistics& collection) override {
+        lock_guard<mutex> guard(lock);
+        fprintf(toShard, "TOP %d\n", k);
+        writeStatistics(toShard, collection);
+        request(oneLine(query) + "\n");
+        Vector<ScoredMatch> matches;
+        string line;
+        for (int count = stringToInteger(reply()); count > 0; count--) {
+            readLine(fromShard, line);
+            size_t scoreStart = line.find(' ') + 1;
+            size_t urlStart = line.find(' ', scoreStart) + 1;
+            matches.add({line.substr(urlStart), strtod(line.c_str() + scoreStart, nullptr),
+                         stringToInteger(line.substr(0, scoreStart - 1))});
+        }
+        return matches;
+    }
+
+private:
+    int shard;
+    pid_t child;
+    FILE* toShard;
+    FILE* fromShard;
+    mutex lock;                 // one request at a time; guards everything below
+    bool ready;                 // whether the child has reported its index built
+
+    //queries are sent as one line, so any line breaks in one become spaces
+    static string oneLine(string query) {
+        replace(query.begin(), query.end(), '\n', ' ');
+        return query;
+    }
+
+    void request(const string& text) {
+        fputs(text.c_str(), toShard);
+        fflush(toShard);
+    }
+
+    //this function reads the status line of a reply, calling error() with the shard's
+    //message if the request failed or the shard process is gone. the status of the shard's
+    //build comes before its first reply
+    void awaitOk() {
+        if (!ready) {
+            ready = true;
+            readStatus();
+        }
+        readStatus();
+    }
+
+    void readStatus() {
+        string status;
+        if (!readLine(fromShard, status)) {
+            error("Shard process " + integerToString(shard) + " stopped");
+        }
+        if (status != "OK") {
+            error("Shard " + integerToString(shard) + ": " + status.substr(status.find(' ') + 1));
+        }
+    }
+
+    //this function reads the status line and the line after it
+    string reply() {
+        awaitOk();
+        string line;
+        readLine(fromShard, line);
+        return line;
+    }
+};
+
+#else
+
+//there are no shard processes, so there are no pipes to guard
+class PipeSignalGuard {};
+
+#endif
+
+//this function runs query on every shard at once, one thread per shard. an error from any
+//shard is rethrown here once all of them are done
+void forEachShard(int numShards, const function<void(int)>& query) {
+    Vector<exception_ptr> failures(numShards);
+    runInParallel(numShards, numShards, [&](int t, int, int) {
+        try {
+            query(t);
+        }
+        catch (...) {
+            failures[t] = current_exception();
+        }
+    });
+    for (exception_ptr failure : failures) {
+        if (failure) {
+            rethrow_exception(failure);
+        }
+    }
+}
+
+//this constructor starts every shard. local shards are built on their own threads; shard
+//processes are all forked first so they build at the same time, and report when done
+ShardedIndex::ShardedIndex(string dbfile, int numShards, bool multiProcess) {
+    if (numShards < 1) {
+        error("A sharded index needs at least one shard");
+    }
+#ifdef _WIN32
+    multiProcess = false;
+#endif
+    this->multiProcess = multiProcess;
+
+    shards.resize(numShards);
+    if (multiProcess) {
+#ifndef _WIN32
+        pipeSignal.reset(new PipeSignalGuard());
+        Vector<int> coordinatorFds;
+        for (int shard = 0; shard < numShards; shard++) {
+            shards[shard].reset(new ProcessShard(dbfile, shard, numShards, coordinatorFds));
+        }
+#endif
+    }
+    else {
+        forEachShard(numShards, [&](int shard) {
+            shards[shard].reset(new LocalShard(dbfile, shard, numShards));
+        });
+    }
+    numDocs = collectionStatistics("").numDocs;
+}
+
+ShardedIndex::~ShardedIndex() {
+}
+
+int ShardedIndex::size() const {
+    return numDocs;
+}
+
+int ShardedIndex::shardCount() const {
+    return shards.size();
+}
+
+bool ShardedIndex::isMultiProcess() const {
+    return multiProcess;
+}
+
+//this function gathers every shard's statistics for query and adds them up
+CollectionStatistics ShardedIndex::collectionStatistics(const string& query) const {
+    Vector<CollectionStatistics> partial(shards.size());
+    forEachShard(shards.size(), [&](int shard) {
+        partial[shard] = shards[shard]->statistics(query);
+    });
+
+    CollectionStatistics total;
+    total.numDocs = 0;
+    total.totalLength = 0;
+    for (const CollectionStatistics& statistics : partial) {
+        total.numDocs += statistics.numDocs;
+        total.totalLength += statistics.totalLength;
+        for (const string& word : statistics.documentFrequencies) {
+            total.documentFrequencies[word] += statistics.documentFrequencies.get(word);
+        }
+    }
+    return total;
+}
+
+//a page matches a query based only on its own content, so the matches of the whole file
+//are just the union of every shard's matches
+Set<string> ShardedIndex::findQueryMatches(string query) const {
+    Vector<Set<string>> partial(shards.size());
+    forEachShard(shards.size(), [&](int shard) {
+        partial[shard] = shards[shard]->findQueryMatches(query);
+    });
+
+    Set<string> result;
+    for (const Set<string>& matches : partial) {
+        result += matches;
+    }
+    return result;
+}
+
+//this function ranks in two rounds. the first gathers collection statistics for the query,
+//and the second has every shard find its own top k scored with them. any page in the overall
+//top k is also in its own shard's top k, so merging the shards' lists by score, then file
+//order, and keeping the first k gives the overall top k
+Vector<ScoredMatch> ShardedIndex::findTopMatches(string query, int k) const {
+    if (k <= 0) {
+        return {};
+    }
+    CollectionStatistics collection = collectionStatistics(query);
+    Vector<Vector<ScoredMatch>> partial(shards.size());
+    forEachShard(shards.size(), [&](int shard) {
+        partial[shard] = shards[shard]->findTopMatches(query, k, collection);
+    });
+
+    Vector<ScoredMatch> merged;
+    for (const Vector<ScoredMatch>& matches : partial) {
+        merged += matches;
+    }
+    sort(merged.begin(), merged.end(), [](const ScoredMatch& a, const ScoredMatch& b) {
+        return a.score != b.score ? a.score > b.score : a.docId < b.docId;
+    });
+
+    Vector<ScoredMatch> result;
+    for (int i = 0; i < min(k, merged.size()); i++) {
+        result.add(merged[i]);
+    }
+    return result;
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("ShardedIndex on tiny.txt matches and ranks like one PostingIndex, for any shard count") {
+    PostingIndex whole("res/tiny.txt");
+    Vector<string> queries = {"fish", "red fish", "fish +red", "fish -blue", "\"red fish\"",
+                              "one NEAR/1 two", "milk bread eggs", "hippo", "106"};
+    for (int numShards : {1, 2, 3, 6}) {
+        ShardedIndex sharded("res/tiny.txt", numShards);
+        EXPECT_EQUAL(sharded.size(), 4);
+        EXPECT_EQUAL(sharded.shardCount(), numShards);
+        for (const string& query : queries) {
+            EXPECT_EQUAL(sharded.findQueryMatches(query), whole.findQueryMatches(query));
+            EXPECT_EQUAL(sharded.findTopMatches(query, 3), whole.findTopMatches(query, 3));
+        }
+    }
+    EXPECT_ERROR(ShardedIndex("res/tiny.txt", 0));
+    EXPECT_ERROR(ShardedIndex("res/missing.txt", 2));
+}
+
+#ifndef _WIN32
+STUDENT_TEST("ShardedIndex only ignores SIGPIPE while shard processes are open") {
+    auto pipeHandler = [] {
+        struct sigaction current;
+        sigaction(SIGPIPE, nullptr, &current);
+        return current.sa_handler;
+    };
+    EXPECT(pipeHandler() == SIG_DFL);
+    {
+        ShardedIndex first("res/tiny.txt", 2, true);
+        EXPECT(pipeHandler() == SIG_IGN);
+        {
+            ShardedIndex second("res/tiny.txt", 2, true);
+            EXPECT_EQUAL(second.findQueryMatches("fish"), first.findQueryMatches("fish"));
+        }
+        EXPECT(pipeHandler() == SIG_IGN);
+    }
+    EXPECT(pipeHandler() == SIG_DFL);
+    EXPECT_ERROR(ShardedIndex("res/missing.txt", 2, true));
+    EXPECT(pipeHandler() == SIG_DFL);
+}
+#endif
+
+STUDENT_TEST("ShardedIndex in shard processes gives exactly the results of one PostingIndex") {
+    string filename = "res/generated-sharded.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 3000; page++) {
+        out << "www.page" << page % 2900 << ".com" << endl; //the last 100 pages replace earlier ones
+        int numWords = randomInteger(1, 40);
+        for (int w = 0; w < numWords; w++) {
+            int word = (int) (pow(randomReal(0, 1), 3) * 200);
+            out << "word" << word << " ";
+        }
+        out << endl;
+    }
+    out.close();
+
+    PostingIndex whole(filename);
+    ShardedIndex threads(filename, 4);
+    ShardedIndex processes(filename, 5, true);
+    deleteFile(filename); //every shard is built by now
+    EXPECT_EQUAL(threads.size(), 2900);
+    EXPECT_EQUAL(processes.size(), 2900);
+#ifndef _WIN32
+    EXPECT(processes.isMultiProcess());
+#endif
+
+    for (int trial = 0; trial < 100; trial++) {
+        string query = "word" + integerToString(randomInteger(0, 10));
+        for (int extra = randomInteger(0, 3); extra > 0; extra--) {
+            string prefix = randomChance(0.2) ? (randomChance(0.5) ? "+" : "-") : "";
+            query += " " + prefix + "word" + integerToString(randomInteger(0, 199));
+        }
+        if (randomChance(0.2)) {
+            query += " \"word0 word1\"";
+        }
+        if (randomChance(0.2)) {
+            query += " word1*";
+        }
+        Set<string> matches = whole.findQueryMatches(query);
+        EXPECT_EQUAL(threads.findQueryMatches(query), matches);
+        EXPECT_EQUAL(processes.findQueryMatches(query), matches);
+        for (int k : {1, 10}) {
+            Vector<ScoredMatch> best = whole.findTopMatches(query, k);
+            EXPECT_EQUAL(threads.findTopMatches(query, k), best);
+            EXPECT_EQUAL(processes.findTopMatches(query, k), best);
+        }
+    }
+    EXPECT_ERROR(ShardedIndex("res/missing.txt", 2, true));
+}
+
+STUDENT_TEST("ShardedIndex build and query times against one PostingIndex") {
+    string filename = "res/generated-sharded.txt";
+    ofstream out(filename);
+    for (int page = 0; page < 20000; page++) {
+        out << "www.page" << page << ".com" << endl;
+        for (int w = randomInteger(10, 60); w > 0; w--) {
+            out << "word" << (int) (pow(randomReal(0, 1), 3) * 2000) << " ";
+        }
+        out << endl;
+    }
+    out.close();
+
+    TIME_OPERATION(20000, PostingIndex(filename).size());
+    TIME_OPERATION(20000, ShardedIndex(filename, 4).size());
+    TIME_OPERATION(20000, ShardedIndex(filename, 4, true).size());
+    PostingIndex whole(filename);
+    ShardedIndex processes(filename, 4, true);
+    deleteFile(filename);
+
+    TIME_OPERATION(200, for (int i = 0; i < 200; i++) whole.findTopMatches("word1 word7 word30", 10));
+    TIME_OPERATION(200, for (int i = 0; i < 200; i++) processes.findTopMatches("word1 word7 word30", 10));
+}
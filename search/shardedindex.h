@@ -0,0 +1,82 @@
+#pragma once
+#include "set.h"
+#include "vector.h"
+#include "postingindex.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * One shard of a ShardedIndex: a PostingIndex over one range of the pages, either held in
+ * this process or served by a child process. Defined in shardedindex.cpp.
+ */
+class IndexShard;
+
+/**
+ * Ignores SIGPIPE for as long as any multi-process ShardedIndex holds one, and puts back the
+ * handler from before once the last is gone. Defined in shardedindex.cpp.
+ */
+class PipeSignalGuard;
+
+/**
+ * An index split by page range into several PostingIndex shards that are built and queried
+ * independently. Queries are scattered to every shard at once and the answers gathered:
+ * boolean matches are the union of every shard's matches, and a ranked query first sums
+ * the shards' CollectionStatistics so every shard scores with collection-wide BM25 numbers,
+ * then merges each shard's top k into the overall top k. Both give exactly the results of a
+ * single PostingIndex over the whole file.
+ *
+ * In multi-process mode every shard is built and served by its own child process, and the
+ * coordinator talks to each child through a pair of pipes, so shards could as well be on
+ * other machines. This needs POSIX fork(); elsewhere the shards are kept in this process.
+ */
+class ShardedIndex {
+public:
+    /**
+     * Builds numShards shards of the database file, in parallel. If multiProcess is true
+     * and the platform supports it, each shard lives in a child process.
+     */
+    ShardedIndex(std::string dbfile, int numShards, bool multiProcess = false);
+
+    /**
+     * Stops any shard processes.
+     */
+    ~ShardedIndex();
+
+    /**
+     * Returns the number of pages across all shards.
+     */
+    int size() const;
+
+    /**
+     * Returns the number of shards.
+     */
+    int shardCount() const;
+
+    /**
+     * Returns whether the shards live in child processes.
+     */
+    bool isMultiProcess() const;
+
+    /**
+     * Returns the URLs matching query, using the same rules as findQueryMatches.
+     */
+    Set<std::string> findQueryMatches(std::string query) const;
+
+    /**
+     * Returns the k best pages for query, exactly as PostingIndex::findTopMatches does for
+     * an index of the whole file.
+     */
+    Vector<ScoredMatch> findTopMatches(std::string query, int k) const;
+
+private:
+    std::unique_ptr<PipeSignalGuard> pipeSignal;    // declared first so it outlives the shards
+    std::vector<std::unique_ptr<IndexShard>> shards;
+    int numDocs;
+    bool multiProcess;
+
+    CollectionStatistics collectionStatistics(const std::string& query) const;
+
+    ShardedIndex(const ShardedIndex&) = delete;
+    ShardedIndex& operator=(const ShardedIndex&) = delete;
+};
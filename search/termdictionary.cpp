@@ -0,0 +1,312 @@
+//A compact, sorted term dictionary that front-codes its terms in blocks, so the search
+//index can find a term's id without a heap string per term and can answer prefix and
+//wildcard queries by walking a range of ids
+
+#include "testing/SimpleTest.h"
+#include "termdictionary.h"
+#include "error.h"
+#include "hashmap.h"
+#include "strlib.h"
+#include "random.h"
+#include <algorithm>
+using namespace std;
+
+//how many terms share a block. a lookup binary searches the blocks and then decodes at most
+//this many terms, so bigger blocks save block table space but cost lookup time
+const int TERMS_PER_BLOCK = 16;
+
+//this function appends value to bytes as a varint: seven bits per byte, low bits first,
+//with the high bit set on every byte except the last
+void appendVarint(vector<unsigned char>& bytes, unsigned int value) {
+    while (value >= 0x80) {
+        bytes.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((unsigned char) value);
+}
+
+//this function reads one varint starting at data and moves data past it
+unsigned int readVarint(const unsigned char*& data) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (*data & 0x80) {
+        value |= (unsigned int) (*data++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (unsigned int) *data++ << shift;
+    return value;
+}
+
+//this function decodes the entry at data, which holds how many leading characters the term
+//shares with current, the length of the rest and the rest, into current and moves data past it
+void decodeEntry(const unsigned char*& data, string& current) {
+    unsigned int shared = readVarint(data);
+    unsigned int suffixLength = readVarint(data);
+    current.resize(shared);
+    current.append((const char*) data, suffixLength);
+    data += suffixLength;
+}
+
+TermDictionary::TermDictionary() {
+    numTerms = 0;
+}
+
+//this constructor sorts the terms and writes them out one entry at a time, starting a new
+//block, whose first term shares nothing, every TERMS_PER_BLOCK terms
+TermDictionary::TermDictionary(Vector<string> terms) {
+    vector<string> sorted(terms.begin(), terms.end());
+    sort(sorted.begin(), sorted.end());
+    sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+    numTerms = sorted.size();
+
+    for (int id = 0; id < numTerms; id++) {
+        size_t shared = 0;
+        if (id % TERMS_PER_BLOCK == 0) {
+            blockStarts.push_back(data.size());
+        }
+        else {
+            const string& previous = sorted[id - 1];
+            while (shared < previous.length() && shared < sorted[id].length()
+                   && previous[shared] == sorted[id][shared]) {
+                shared++;
+            }
+        }
+        appendVarint(data, shared);
+        appendVarint(data, sorted[id].length() - shared);
+        data.insert(data.end(), sorted[id].begin() + shared, sorted[id].end());
+    }
+    data.shrink_to_fit();
+    blockStarts.shrink_to_fit();
+}
+
+int TermDictionary::size() const {
+    return numTerms;
+}
+
+//this function returns the first term of a block without copying it, since a block's first
+//term is stored whole
+string_view TermDictionary::blockHead(int block) const {
+    const unsigned char* entry = data.data() + blockStarts[block];
+    readVarint(entry);
+    unsigned int length = readVarint(entry);
+    return string_view((const char*) entry, length);
+}
+
+//this function returns the id of the first term not less than term and sets found to that
+//term. it binary searches for the last block whose first term is not greater than term,
+//then decodes that block until it reaches a term that is not less than term
+int TermDictionary::search(const string& term, string& found) const {
+    int low = 0;
+    int high = (int) blockStarts.size() - 1;
+    int block = -1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        if (blockHead(middle) <= term) {
+            block = middle;
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    if (block == -1) {
+        found = numTerms == 0 ? "" : string(blockHead(0));
+        return 0;
+    }
+
+    const unsigned char* entry = data.data() + blockStarts[block];
+    int id = block * TERMS_PER_BLOCK;
+    found.clear();
+    while (id < numTerms) {
+        decodeEntry(entry, found);
+        if (found >= term) {
+            return id;
+        }
+        id++;
+    }
+    found.clear();
+    return numTerms;
+}
+
+int TermDictionary::find(const string& term) const {
+    string found;
+    int id = search(term, found);
+    return id < numTerms && found == term ? id : -1;
+}
+
+int TermDictionary::lowerBound(const string& term) const {
+    string found;
+    return search(term, found);
+}
+
+string TermDictionary::term(int id) const {
+    if (id < 0 || id >= numTerms) {
+        error("There is no term with id " + integerToString(id));
+    }
+    const unsigned char* entry = data.data() + blockStarts[id / TERMS_PER_BLOCK];
+    string current;
+    for (int i = 0; i <= id % TERMS_PER_BLOCK; i++) {
+        decodeEntry(entry, current);
+    }
+    return current;
+}
+
+//this function finds the terms starting with the part of pattern before its first '*' and
+//keeps those that match the whole pattern. entries are decoded straight through from the
+//first of those terms, since a block's first entry also decodes correctly mid-walk
+Vector<int> TermDictionary::matching(const string& pattern) const {
+    Vector<int> result;
+    size_t star = pattern.find('*');
+    if (star == string::npos) {
+        int id = find(pattern);
+        if (id != -1) {
+            result.add(id);
+        }
+        return result;
+    }
+
+    string prefix = pattern.substr(0, star);
+    string current;
+    int id = search(prefix, current);
+    if (id == numTerms) {
+        return result;
+    }
+    const unsigned char* entry = data.data() + blockStarts[id / TERMS_PER_BLOCK];
+    for (int i = 0; i <= id % TERMS_PER_BLOCK; i++) {
+        decodeEntry(entry, current);
+    }
+    while (startsWith(current, prefix)) {
+        if (wildcardMatches(pattern, current)) {
+            result.add(id);
+        }
+        id++;
+        if (id == numTerms) {
+            break;
+        }
+        decodeEntry(entry, current);
+    }
+    return result;
+}
+
+long long TermDictionary::bytes() const {
+    return data.size() + blockStarts.size() * sizeof(unsigned int);
+}
+
+//this function matches greedily, remembering the last '*' seen. on a mismatch that '*' is
+//made to swallow one more character of text and matching resumes after it, which is enough
+//because a later '*' can always absorb whatever an earlier one would have
+bool wildcardMatches(string_view pattern, string_view text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = string_view::npos;
+    size_t starText = 0;
+    while (t < text.length()) {
+        if (p < pattern.length() && pattern[p] == '*') {
+            star = p++;
+            starText = t;
+        }
+        else if (p < pattern.length() && pattern[p] == text[t]) {
+            p++;
+            t++;
+        }
+        else if (star != string_view::npos) {
+            p = star + 1;
+            t = ++starText;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern.length() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.length();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("TermDictionary finds terms, prefixes and wildcards") {
+    TermDictionary dictionary({"fish", "red", "blue", "fishing", "fishy", "fish", "bread", "fresh", "one"});
+    EXPECT_EQUAL(dictionary.size(), 8);
+    EXPECT_EQUAL(dictionary.term(0), "blue");
+    EXPECT_EQUAL(dictionary.find("fishing"), 3);
+    EXPECT_EQUAL(dictionary.find("fis"), -1);
+    EXPECT_EQUAL(dictionary.find("zebra"), -1);
+    EXPECT_EQUAL(dictionary.lowerBound("fis"), 2);
+    EXPECT_EQUAL(dictionary.lowerBound("a"), 0);
+    EXPECT_EQUAL(dictionary.lowerBound("zebra"), 8);
+
+    EXPECT_EQUAL(dictionary.matching("fish*"), Vector<int>({2, 3, 4}));
+    EXPECT_EQUAL(dictionary.matching("f*sh"), Vector<int>({2, 5}));
+    EXPECT_EQUAL(dictionary.matching("*e*"), Vector<int>({0, 1, 5, 6, 7}));
+    EXPECT_EQUAL(dictionary.matching("red"), Vector<int>({7}));
+    EXPECT_EQUAL(dictionary.matching("z*"), Vector<int>());
+    EXPECT_ERROR(dictionary.term(8));
+
+    TermDictionary empty;
+    EXPECT_EQUAL(empty.find("fish"), -1);
+    EXPECT_EQUAL(empty.matching("*").size(), 0);
+}
+
+STUDENT_TEST("TermDictionary agrees with a sorted list of many terms sharing prefixes") {
+    Vector<string> terms;
+    for (int i = 0; i < 5000; i++) {
+        string term;
+        for (int length = randomInteger(1, 8); length > 0; length--) {
+            term += (char) ('a' + randomInteger(0, 3));
+        }
+        terms.add(term);
+    }
+    TermDictionary dictionary(terms);
+    vector<string> sorted(terms.begin(), terms.end());
+    sort(sorted.begin(), sorted.end());
+    sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+    EXPECT_EQUAL(dictionary.size(), (int) sorted.size());
+    for (int id = 0; id < (int) sorted.size(); id++) {
+        EXPECT_EQUAL(dictionary.term(id), sorted[id]);
+        EXPECT_EQUAL(dictionary.find(sorted[id]), id);
+    }
+    for (int trial = 0; trial < 500; trial++) {
+        string probe;
+        for (int length = randomInteger(0, 9); length > 0; length--) {
+            probe += (char) ('a' + randomInteger(0, 4));
+        }
+        int expected = lower_bound(sorted.begin(), sorted.end(), probe) - sorted.begin();
+        EXPECT_EQUAL(dictionary.lowerBound(probe), expected);
+
+        string pattern = probe.substr(0, randomInteger(0, probe.length())) + "*";
+        if (randomChance(0.5)) {
+            pattern += (char) ('a' + randomInteger(0, 3));
+        }
+        Vector<int> matches;
+        for (int id = 0; id < (int) sorted.size(); id++) {
+            if (wildcardMatches(pattern, sorted[id])) {
+                matches.add(id);
+            }
+        }
+        EXPECT_EQUAL(dictionary.matching(pattern), matches);
+    }
+}
+
+STUDENT_TEST("TermDictionary size and lookup time against a HashMap of the same terms") {
+    Vector<string> terms;
+    HashMap<string, int> hashed;
+    for (int i = 0; i < 200000; i++) {
+        string term = "word" + integerToString(i);
+        terms.add(term);
+        hashed[term] = i;
+    }
+    TermDictionary dictionary(terms);
+    long long characters = 0;
+    for (const string& term : terms) {
+        characters += term.length();
+    }
+    EXPECT(dictionary.bytes() < characters); //front coding stores less than the bare characters
+
+    int found = 0;
+    TIME_OPERATION(terms.size(), for (const string& term : terms) found += dictionary.find(term) != -1);
+    TIME_OPERATION(terms.size(), for (const string& term : terms) found += hashed.containsKey(term));
+    EXPECT_EQUAL(found, 2 * terms.size());
+}
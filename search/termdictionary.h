@@ -0,0 +1,86 @@
+#pragma once
+#include "vector.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Appends value to bytes as a varint: seven bits per byte, low bits first, with the high
+ * bit set on every byte except the last.
+ */
+void appendVarint(std::vector<unsigned char>& bytes, unsigned int value);
+
+/**
+ * Reads one varint starting at data and moves data past it.
+ */
+unsigned int readVarint(const unsigned char*& data);
+
+/**
+ * An immutable sorted set of terms, stored front-coded. The terms are split into blocks of
+ * 16; each term only stores how many leading characters it shares with the term before it
+ * and the characters after those, and the first term of every block shares nothing, so any
+ * block can be decoded on its own. A term's id is its position in sorted order.
+ *
+ * Finding a term binary searches the first terms of the blocks, which are read in place,
+ * and then decodes one block. Terms sharing a prefix have consecutive ids, so prefix and
+ * wildcard lookups only decode the range of terms that start with the pattern's prefix.
+ */
+class TermDictionary {
+public:
+    /**
+     * Creates an empty dictionary.
+     */
+    TermDictionary();
+
+    /**
+     * Creates a dictionary of terms, which can be in any order and have repeats.
+     */
+    TermDictionary(Vector<std::string> terms);
+
+    /**
+     * Returns the number of distinct terms.
+     */
+    int size() const;
+
+    /**
+     * Returns the id of term, or -1 if it is not in the dictionary.
+     */
+    int find(const std::string& term) const;
+
+    /**
+     * Returns the term with the given id. If there is no such id, this function calls error().
+     */
+    std::string term(int id) const;
+
+    /**
+     * Returns the id of the first term that is not less than term, or size() if every term
+     * is less than it.
+     */
+    int lowerBound(const std::string& term) const;
+
+    /**
+     * Returns the ids of every term matching pattern, in sorted order, where each '*' in
+     * the pattern matches any run of characters (including none) and every other character
+     * matches itself. "fish*" returns every term starting with "fish".
+     */
+    Vector<int> matching(const std::string& pattern) const;
+
+    /**
+     * Returns the number of bytes used by the encoded terms and the block table.
+     */
+    long long bytes() const;
+
+private:
+    std::vector<unsigned char> data;        // front-coded terms, in sorted order
+    std::vector<unsigned int> blockStarts;  // offset in data of each block's first term
+    int numTerms;
+
+    std::string_view blockHead(int block) const;
+    int search(const std::string& term, std::string& found) const;
+};
+
+/**
+ * Returns whether text matches pattern, where each '*' in pattern matches any run of
+ * characters (including none).
+ */
+bool wildcardMatches(std::string_view pattern, std::string_view text);
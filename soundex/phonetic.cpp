@@ -0,0 +1,419 @@
+// This file contains the phonetic encoders other than classic Soundex: Refined Soundex, NYSIIS
+// and Metaphone, each written into a fixed-size code without allocating.
+
+
+#include "testing/SimpleTest.h"
+#include "phonetic.h"
+#include "random.h"
+#include <array>
+#include <cctype>
+using namespace std;
+
+//this function builds the Refined Soundex table: the digit of every letter, in either case, and
+//'\0' for every other byte so non-letters are skipped
+constexpr array<char, 256> makeRefinedTable() {
+    array<char, 256> table{};
+    const char* digits = "01360240043788015936020505"; //A to Z
+    for (int i = 0; i < 26; i++) {
+        table['A' + i] = digits[i];
+        table['a' + i] = digits[i];
+    }
+    return table;
+}
+
+const array<char, 256> REFINED_DIGITS = makeRefinedTable();
+
+//this function writes the letters of name, uppercased, into letters and returns how many there
+//are, stopping at PHONETIC_MAX_LETTERS
+int upperLetters(string_view name, char* letters) {
+    int count = 0;
+    for (char c : name) {
+        if (isalpha((unsigned char) c) && (unsigned char) c < 128) {
+            letters[count++] = toupper(c);
+            if (count == PHONETIC_MAX_LETTERS) {
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+//this function pads the code with spaces after its first length chars
+void padCode(char* code, int length, int codeLength) {
+    for (int i = length; i < codeLength; i++) {
+        code[i] = ' ';
+    }
+}
+
+//this function works like soundexInto, except that the first letter's digit is written too and
+//zeros are kept
+void RefinedSoundex::encode(string_view name, char* code) {
+    int length = 0;
+    char last = 0;
+    for (char c : name) {
+        char digit = REFINED_DIGITS[(unsigned char) c];
+        if (digit == 0) {
+            continue;
+        }
+        if (length == 0) {
+            code[length++] = toupper(c);
+        }
+        if (digit != last) {
+            code[length++] = digit;
+            if (length == LENGTH) {
+                return;
+            }
+        }
+        last = digit;
+    }
+    padCode(code, length, LENGTH);
+}
+
+bool isVowel(char letter) {
+    return letter == 'A' || letter == 'E' || letter == 'I' || letter == 'O' || letter == 'U';
+}
+
+//this function returns whether the letters from start begin with text
+bool startsWithAt(const char* letters, int count, int start, const char* text) {
+    int length = strlen(text);
+    return start >= 0 && start + length <= count && memcmp(letters + start, text, length) == 0;
+}
+
+//this function rewrites the start and the end of the name, then walks the rest of it, rewriting
+//each letter in place from the letters around it (which can also rewrite the next one or two,
+//like SCH to SSS), and keeps a rewritten letter if it differs from the rewritten letter before
+//it. a final S or A is dropped, and a final AY becomes Y
+void Nysiis::encode(string_view name, char* code) {
+    char letters[PHONETIC_MAX_LETTERS + 2];
+    int count = upperLetters(name, letters);
+
+    if (startsWithAt(letters, count, 0, "MAC")) {
+        letters[1] = 'C';
+    }
+    else if (startsWithAt(letters, count, 0, "KN")) {
+        letters[0] = 'N';
+    }
+    else if (startsWithAt(letters, count, 0, "K")) {
+        letters[0] = 'C';
+    }
+    else if (startsWithAt(letters, count, 0, "PH") || startsWithAt(letters, count, 0, "PF")) {
+        letters[0] = letters[1] = 'F';
+    }
+    else if (startsWithAt(letters, count, 0, "SCH")) {
+        letters[1] = letters[2] = 'S';
+    }
+    if (startsWithAt(letters, count, count - 2, "EE") || startsWithAt(letters, count, count - 2, "IE")) {
+        letters[count - 2] = 'Y';
+        count--;
+    }
+    else if (count >= 2 && (letters[count - 1] == 'T' || letters[count - 1] == 'D')
+             && strchr("DRN", letters[count - 2]) && !(letters[count - 2] == 'D' && letters[count - 1] == 'D')) {
+        letters[count - 2] = 'D';   // DT, RT, RD, NT and ND all become D
+        count--;
+    }
+
+    char key[PHONETIC_MAX_LETTERS];
+    int length = 0;
+    if (count > 0) {
+        key[length++] = letters[0];
+    }
+    for (int i = 1; i < count; i++) {
+        char previous = letters[i - 1];
+        char next = i + 1 < count ? letters[i + 1] : 0;
+        char afterNext = i + 2 < count ? letters[i + 2] : 0;
+        char& current = letters[i];
+        if (current == 'E' && next == 'V') {
+            current = 'A';
+            letters[i + 1] = 'F';
+        }
+        else if (isVowel(current)) {
+            current = 'A';
+        }
+        else if (current == 'Q') {
+            current = 'G';
+        }
+        else if (current == 'Z') {
+            current = 'S';
+        }
+        else if (current == 'M') {
+            current = 'N';
+        }
+        else if (current == 'K') {
+            current = next == 'N' ? 'N' : 'C';
+        }
+        else if (current == 'S' && next == 'C' && afterNext == 'H') {
+            letters[i + 1] = letters[i + 2] = 'S';
+        }
+        else if (current == 'P' && next == 'H') {
+            current = letters[i + 1] = 'F';
+        }
+        else if (current == 'H' && (!isVowel(previous) || !isVowel(next))) {
+            current = previous;
+        }
+        else if (current == 'W' && isVowel(previous)) {
+            current = previous;
+        }
+        if (current != previous) {
+            key[length++] = current;
+        }
+    }
+
+    if (length > 1 && key[length - 1] == 'S') {
+        length--;
+    }
+    if (length > 2 && key[length - 2] == 'A' && key[length - 1] == 'Y') {
+        key[length - 2] = 'Y';
+        length--;
+    }
+    if (length > 1 && key[length - 1] == 'A') {
+        length--;
+    }
+    length = min(length, LENGTH);
+    memcpy(code, key, length);
+    padCode(code, length, LENGTH);
+}
+
+//this function fixes up the first two letters (KN, GN, PN, AE and WR drop their first letter,
+//WH becomes W and X becomes S), then codes the letters one at a time from the letters around
+//them, skipping a letter repeated from the one before it unless it is a C
+void Metaphone::encode(string_view name, char* code) {
+    char letters[PHONETIC_MAX_LETTERS + 1];
+    int count = upperLetters(name, letters);
+    char* word = letters;
+    if (count == 1) {
+        code[0] = letters[0];
+        padCode(code, 1, LENGTH);
+        return;
+    }
+    if (count >= 2) {
+        char first = letters[0];
+        char second = letters[1];
+        if ((second == 'N' && (first == 'K' || first == 'G' || first == 'P')) || (first == 'A' && second == 'E')
+            || (first == 'W' && second == 'R')) {
+            word++;
+            count--;
+        }
+        else if (first == 'W' && second == 'H') {
+            word++;
+            count--;
+            word[0] = 'W';
+        }
+        else if (first == 'X') {
+            word[0] = 'S';
+        }
+    }
+
+    auto at = [&](int i) {
+        return i >= 0 && i < count ? word[i] : '\0';
+    };
+    auto isFrontVowel = [&](int i) {
+        return at(i) == 'E' || at(i) == 'I' || at(i) == 'Y';
+    };
+    auto matches = [&](int i, const char* text) {
+        return startsWithAt(word, count, i, text);
+    };
+
+    int length = 0;
+    auto add = [&](char c) {
+        if (length < LENGTH) {
+            code[length++] = c;
+        }
+    };
+    for (int n = 0; n < count && length < LENGTH; n++) {
+        char symbol = word[n];
+        if (symbol != 'C' && at(n - 1) == symbol) {
+            continue;
+        }
+        bool isLast = n == count - 1;
+        switch (symbol) {
+        case 'A': case 'E': case 'I': case 'O': case 'U':
+            if (n == 0) {
+                add(symbol);
+            }
+            break;
+        case 'B':
+            if (!(at(n - 1) == 'M' && isLast)) {
+                add('B');                       // B is silent in a final MB
+            }
+            break;
+        case 'C':
+            if (at(n - 1) == 'S' && isFrontVowel(n + 1)) {
+                break;                          // SCI, SCE and SCY
+            }
+            if (matches(n, "CIA")) {
+                add('X');
+            }
+            else if (isFrontVowel(n + 1)) {
+                add('S');
+            }
+            else if (at(n - 1) == 'S' && at(n + 1) == 'H') {
+                add('K');                       // SCH
+            }
+            else if (at(n + 1) == 'H') {
+                add(n == 0 && count >= 3 && !isVowel(at(2)) ? 'K' : 'X');
+            }
+            else {
+                add('K');
+            }
+            break;
+        case 'D':
+            if (at(n + 1) == 'G' && isFrontVowel(n + 2)) {
+                add('J');                       // DGE, DGI and DGY
+                n += 2;
+            }
+            else {
+                add('T');
+            }
+            break;
+        case 'G':
+            if (at(n + 1) == 'H' && (n + 2 == count || !isVowel(at(n + 2)))) {
+                break;                          // GH at the end or before a consonant
+            }
+            if (n > 0 && matches(n, "GN")) {
+                break;
+            }
+            add(isFrontVowel(n + 1) ? 'J' : 'K');
+            break;
+        case 'H':
+            if (!isLast && !(n > 0 && strchr("CSPTG", at(n - 1))) && isVowel(at(n + 1))) {
+                add('H');
+            }
+            break;
+        case 'K':
+            if (at(n - 1) != 'C') {
+                add('K');
+            }
+            break;
+        case 'P':
+            add(at(n + 1) == 'H' ? 'F' : 'P');
+            break;
+        case 'Q':
+            add('K');
+            break;
+        case 'S':
+            add(matches(n, "SH") || matches(n, "SIO") || matches(n, "SIA") ? 'X' : 'S');
+            break;
+        case 'T':
+            if (matches(n, "TIA") || matches(n, "TIO")) {
+                add('X');
+            }
+            else if (matches(n, "TH")) {
+                add('0');
+            }
+            else if (!matches(n, "TCH")) {
+                add('T');
+            }
+            break;
+        case 'V':
+            add('F');
+            break;
+        case 'W': case 'Y':
+            if (isVowel(at(n + 1))) {
+                add(symbol);                    // silent unless a vowel follows
+            }
+            break;
+        case 'X':
+            add('K');
+            add('S');
+            break;
+        case 'Z':
+            add('S');
+            break;
+        default:
+            add(symbol);                        // F, J, L, M, N and R
+        }
+    }
+    padCode(code, length, LENGTH);
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("RefinedSoundex codes a sentence") {
+    Vector<string> words = {"The", "quick", "brown", "fox", "jumped", "over", "the", "lazy", "dogs", "testing"};
+    Vector<string> codes = {"T60", "Q503", "B1908", "F205", "J408106", "O0209", "T60", "L7050", "D6043", "T6036084"};
+    for (int i = 0; i < words.size(); i++) {
+        EXPECT_EQUAL(phoneticCode<RefinedSoundex>(words[i]), codes[i]);
+    }
+    EXPECT_EQUAL(phoneticCode<RefinedSoundex>("TESTING"), "T6036084");
+    EXPECT_EQUAL(phoneticCode<RefinedSoundex>("Tessier-Lavigne"), "T603097020");
+    EXPECT_EQUAL(phoneticCode<RefinedSoundex>("--"), "");
+}
+
+STUDENT_TEST("Nysiis codes the names of the original paper") {
+    Vector<string> names = {"MACINTOSH", "KNUTH", "KOEHN", "PHILLIPSON", "PFEISTER", "SCHOENHOEFT", "MCKEE",
+                            "MACKIE", "HEITSCHMIDT", "BART", "HURD", "HUNT", "WESTERLUND", "CASSTEVENS",
+                            "VASQUEZ", "FRAZIER", "BOWMAN", "MCKNIGHT", "RICKERT", "DEUTSCH", "WESTPHAL",
+                            "SHRIVER", "KUHL", "RAWSON", "JILES", "CARRAWAY", "YAMADA"};
+    Vector<string> codes = {"MCANT", "NAT", "CAN", "FALAPS", "FASTAR", "SANAFT", "MCY",
+                            "MCY", "HATSNA", "BAD", "HAD", "HAD", "WASTAR", "CASTAF",
+                            "VASG", "FRASAR", "BANAN", "MCNAGT", "RACAD", "DAT", "WASTFA",
+                            "SRAVAR", "CAL", "RASAN", "JAL", "CARY", "YANAD"};
+    for (int i = 0; i < names.size(); i++) {
+        EXPECT_EQUAL(phoneticCode<Nysiis>(names[i]), codes[i]);
+    }
+    EXPECT_EQUAL(phoneticCode<Nysiis>("Knuth"), "NAT");
+    EXPECT_EQUAL(phoneticCode<Nysiis>(""), "");
+}
+
+STUDENT_TEST("Metaphone codes a sentence and some hard spellings") {
+    Vector<string> words = {"howl", "testing", "The", "quick", "brown", "fox", "jumped", "over", "lazy", "dogs"};
+    Vector<string> codes = {"HL", "TSTN", "0", "KK", "BRN", "FKS", "JMPT", "OFR", "LS", "TKS"};
+    for (int i = 0; i < words.size(); i++) {
+        EXPECT_EQUAL(phoneticCode<Metaphone>(words[i]), codes[i]);
+    }
+    EXPECT_EQUAL(phoneticCode<Metaphone>("Smith"), "SM0");
+    EXPECT_EQUAL(phoneticCode<Metaphone>("Smyth"), "SM0");
+    EXPECT_EQUAL(phoneticCode<Metaphone>("Knight"), "NT");
+    EXPECT_EQUAL(phoneticCode<Metaphone>("Wright"), "RT");
+    EXPECT_EQUAL(phoneticCode<Metaphone>("Xavier"), "SFR");
+    EXPECT_EQUAL(phoneticCode<Metaphone>("x"), "X");
+}
+
+STUDENT_TEST("phoneticBatch gives every encoder's codes in fixed-width slots") {
+    vector<string_view> names = {"Smith", "", "Knuth"};
+    vector<char> codes(Nysiis::LENGTH * names.size());
+    phoneticBatch<Nysiis>(names.data(), names.size(), codes.data());
+    EXPECT_EQUAL(string(codes.begin(), codes.end()), "SNAT        NAT   ");
+
+    vector<char> soundexCodes(AmericanSoundex::LENGTH * names.size());
+    phoneticBatch<AmericanSoundex>(names.data(), names.size(), soundexCodes.data());
+    EXPECT_EQUAL(string(soundexCodes.begin(), soundexCodes.end()), "S5300000K530");
+}
+
+STUDENT_TEST("PhoneticIndex groups names by each encoder's code") {
+    Vector<string> names = {"Smith", "Smyth", "Schmidt", "Knuth", "Newth", "Kuhl", "Cole", "Smith"};
+    PhoneticIndex<Metaphone> metaphone(names);
+    EXPECT_EQUAL(metaphone.size(), 8);
+    EXPECT_EQUAL(metaphone.matchesFor("smith"), Vector<string>({"Smith", "Smith", "Smyth"}));
+    EXPECT_EQUAL(metaphone.matchesFor("Zzyzx"), Vector<string>());
+
+    PhoneticIndex<Nysiis> nysiis(names);
+    EXPECT_EQUAL(nysiis.matchesFor("Knuth"), Vector<string>({"Knuth", "Newth"}));
+    EXPECT_EQUAL(nysiis.matchesFor("Cole"), Vector<string>({"Cole", "Kuhl"}));
+
+    PhoneticIndex<AmericanSoundex> american(names);
+    SoundexIndex soundexIndex(names);
+    for (const string& name : names) {
+        EXPECT_EQUAL(american.matchesFor(name), soundexIndex.matchesFor(name));
+    }
+}
+
+STUDENT_TEST("Phonetic encoder time trials on the same 1 million names") {
+    vector<string> names;
+    for (int i = 0; i < 1000000; i++) {
+        string name(1, 'A' + randomInteger(0, 25));
+        for (int length = randomInteger(3, 9); length > 0; length--) {
+            name += 'a' + randomInteger(0, 25);
+        }
+        names.push_back(name);
+    }
+    vector<string_view> views(names.begin(), names.end());
+    vector<char> codes(10 * names.size());
+
+    TIME_OPERATION(names.size(), soundexBatch(views.data(), views.size(), codes.data()));
+    TIME_OPERATION(names.size(), phoneticBatch<AmericanSoundex>(views.data(), views.size(), codes.data()));
+    TIME_OPERATION(names.size(), phoneticBatch<RefinedSoundex>(views.data(), views.size(), codes.data()));
+    TIME_OPERATION(names.size(), phoneticBatch<Nysiis>(views.data(), views.size(), codes.data()));
+    TIME_OPERATION(names.size(), phoneticBatch<Metaphone>(views.data(), views.size(), codes.data()));
+}
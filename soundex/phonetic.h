@@ -0,0 +1,171 @@
+/**
+ * File: phonetic.h
+ *
+ * Phonetic encoders as policy types that plug into one batch encoder and one name index.
+ * An encoder is a type with:
+ *
+ *     static constexpr int LENGTH = ...;                          // chars in every code
+ *     static void encode(std::string_view name, char* code);      // writes LENGTH chars
+ *     static void encodeBatch(const std::string_view* names, int count, char* codes);
+ *
+ * Codes shorter than LENGTH are padded with spaces (classic Soundex pads with '0's, as it
+ * always has). Encoders never allocate. Those with no faster batch kernel inherit
+ * encodeBatch from EncodeEachName.
+ */
+#pragma once
+#include "soundex.h"
+#include "vector.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The most letters of a name that Nysiis and Metaphone read. Later letters are ignored.
+const int PHONETIC_MAX_LETTERS = 64;
+
+// Gives an encoder an encodeBatch that calls its encode on one name at a time.
+template <typename Encoder>
+struct EncodeEachName {
+    static void encodeBatch(const std::string_view* names, int count, char* codes) {
+        for (int i = 0; i < count; i++) {
+            Encoder::encode(names[i], codes + Encoder::LENGTH * i);
+        }
+    }
+};
+
+// The classic American Soundex of soundex(), with its vector batch kernel.
+struct AmericanSoundex {
+    static constexpr int LENGTH = 4;
+
+    static void encode(std::string_view name, char* code) {
+        soundexInto(name, code);
+    }
+
+    static void encodeBatch(const std::string_view* names, int count, char* codes) {
+        soundexBatch(names, count, codes);
+    }
+};
+
+// Refined Soundex: the first letter, then the digit of every letter including the first,
+// from a table with ten digit groups instead of seven. Repeated digits are coalesced but
+// zeros are kept, so "testing" is "T6036084". Cut to 10 chars.
+struct RefinedSoundex : EncodeEachName<RefinedSoundex> {
+    static constexpr int LENGTH = 10;
+    static void encode(std::string_view name, char* code);
+};
+
+// The New York State Identification and Intelligence System code, which rewrites common
+// spellings of the same sound (MAC to MCC, PH to FF, EV to AF, every vowel to A, ...)
+// before dropping repeats, so "Knuth" is "NAT". Cut to 6 chars.
+struct Nysiis : EncodeEachName<Nysiis> {
+    static constexpr int LENGTH = 6;
+    static void encode(std::string_view name, char* code);
+};
+
+// Lawrence Philips' original Metaphone, which codes consonant sounds with letters (and TH
+// with '0'), keeping a vowel only at the start, so "Smith" and "Smyth" are both "SM0".
+// Cut to 4 chars.
+struct Metaphone : EncodeEachName<Metaphone> {
+    static constexpr int LENGTH = 4;
+    static void encode(std::string_view name, char* code);
+};
+
+// Writes the codes of names[0] to names[count - 1] into codes, Encoder::LENGTH chars each.
+template <typename Encoder>
+void phoneticBatch(const std::string_view* names, int count, char* codes) {
+    Encoder::encodeBatch(names, count, codes);
+}
+
+// Returns the code of name, without any padding spaces.
+template <typename Encoder>
+std::string phoneticCode(std::string_view name) {
+    char code[Encoder::LENGTH];
+    Encoder::encode(name, code);
+    int length = Encoder::LENGTH;
+    while (length > 0 && code[length - 1] == ' ') {
+        length--;
+    }
+    return std::string(code, length);
+}
+
+// Every name of a database grouped by Encoder code, each group sorted, laid out like
+// SoundexIndex: one char array of names sorted by code and then by name, with the start of
+// every name and of every code's group. Codes of other encoders are too sparse for a bucket
+// per possible code, so the distinct codes are kept in a sorted array and found by binary
+// search.
+template <typename Encoder>
+class PhoneticIndex {
+public:
+    // This constructor encodes every name with one batch call, then sorts the names by code
+    // and name and copies them into one char array.
+    PhoneticIndex(const Vector<std::string>& names) {
+        int numNames = names.size();
+        std::vector<std::string_view> views(names.begin(), names.end());
+        std::vector<char> nameCodes(Encoder::LENGTH * numNames);
+        phoneticBatch<Encoder>(views.data(), numNames, nameCodes.data());
+
+        std::vector<int> order(numNames);
+        for (int i = 0; i < numNames; i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            int byCode = memcmp(&nameCodes[Encoder::LENGTH * a], &nameCodes[Encoder::LENGTH * b], Encoder::LENGTH);
+            return byCode != 0 ? byCode < 0 : views[a] < views[b];
+        });
+
+        for (int n = 0; n < numNames; n++) {
+            const char* code = &nameCodes[Encoder::LENGTH * order[n]];
+            if (codeStarts.empty() || memcmp(code, &codes[codes.size() - Encoder::LENGTH], Encoder::LENGTH) != 0) {
+                codes.insert(codes.end(), code, code + Encoder::LENGTH);
+                codeStarts.push_back(n);
+            }
+            nameStarts.push_back(nameChars.size());
+            nameChars.insert(nameChars.end(), views[order[n]].begin(), views[order[n]].end());
+        }
+        codeStarts.push_back(numNames);
+        nameStarts.push_back(nameChars.size());
+    }
+
+    // Returns the database names with the same code as name, sorted.
+    Vector<std::string> matchesFor(std::string_view name) const {
+        char code[Encoder::LENGTH];
+        Encoder::encode(name, code);
+        int low = 0;
+        int high = codeStarts.size() - 1;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (memcmp(&codes[Encoder::LENGTH * middle], code, Encoder::LENGTH) < 0) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+
+        Vector<std::string> matches;
+        if (low < (int) codeStarts.size() - 1 && memcmp(&codes[Encoder::LENGTH * low], code, Encoder::LENGTH) == 0) {
+            for (uint32_t i = codeStarts[low]; i < codeStarts[low + 1]; i++) {
+                matches.add(std::string(nameChars.data() + nameStarts[i], nameStarts[i + 1] - nameStarts[i]));
+            }
+        }
+        return matches;
+    }
+
+    // Returns the number of distinct codes among the names.
+    int codeCount() const {
+        return codeStarts.size() - 1;
+    }
+
+    // Returns the number of names in the database.
+    int size() const {
+        return nameStarts.size() - 1;
+    }
+
+private:
+    std::vector<char> codes;            // distinct codes, sorted, LENGTH chars each
+    std::vector<uint32_t> codeStarts;   // one per distinct code, plus one past the end
+    std::vector<uint32_t> nameStarts;   // one per name, plus one past the end
+    std::vector<char> nameChars;
+};
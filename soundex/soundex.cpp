@@ -4,14 +4,47 @@
 
 
 #include "testing/SimpleTest.h"
+#include "soundex.h"
 #include "strlib.h"
 #include "filelib.h"
 #include "simpio.h"
+#include "random.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstring>
 #include <fstream>
 #include <cctype>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SOUNDEX_SSSE3
+#include <immintrin.h>
+#endif
 using namespace std;
 
+//this function builds the table soundexInto reads: the soundex digit of every letter, in
+//either case, and '\0' for every other byte so non-letters are skipped
+constexpr array<char, 256> makeSoundexTable() {
+    array<char, 256> table{};
+    const char* digits = "01230120022455012623010202"; //A to Z
+    for (int i = 0; i < 26; i++) {
+        table['A' + i] = digits[i];
+        table['a' + i] = digits[i];
+    }
+    return table;
+}
+
+const array<char, 256> SOUNDEX_DIGITS = makeSoundexTable();
+
 // This function takes a string s and returns a version of of the string which has all non letters removed
 // The bug made it so that adjacent non-letters would not be accounted for. After the first non-letter was removed, an indexing
 // problem meant that the second one would be skipped over. In order to fix this, I added "i--" after the removal of a character.
@@ -113,36 +146,590 @@ string removeZeros(string s){
 }
 
 
-//this function takes a string and outputs its Soundex code using the helper functions removeNonLetters,
-//encodeDigits, coalesceSimilar, removeZeros, and makeLengthFour. the helper functions are run in the order
-//specified by the Soundex algorithm and the Soundex code of the input is returned as a string
+//this function does the work of removeNonLetters, encodeDigits, coalesceSimilar, removeZeros
+//and makeLengthFour in a single pass. each letter's digit is looked up in the table and compared
+//with the digit of the letter before it, so a repeated digit is coalesced, and a new digit is
+//written unless it is a zero. the code starts out padded with zeros, and the pass stops as soon
+//as all four chars are written
+void soundexInto(string_view name, char* code) {
+    code[0] = code[1] = code[2] = code[3] = '0';
+    int length = 0;
+    char last = 0;
+    for (char c : name) {
+        char digit = SOUNDEX_DIGITS[(unsigned char) c];
+        if (digit == 0 || digit == last) {
+            continue;
+        }
+        if (length == 0) {
+            code[length++] = toupper(c);
+        }
+        else if (digit != '0') {
+            code[length++] = digit;
+            if (length == 4) {
+                return;
+            }
+        }
+        last = digit;
+    }
+}
+
+void soundexBatchScalar(const string_view* names, int count, char* codes) {
+    for (int i = 0; i < count; i++) {
+        soundexInto(names[i], codes + 4 * i);
+    }
+}
+
+#ifdef SOUNDEX_SSSE3
+//the widest name the vector kernel encodes. longer names go to soundexInto
+const size_t SOUNDEX_LANE_WIDTH = 16;
+
+//this function builds the left-packing shuffles: entry m holds, from its lowest byte up, the
+//positions of the bits set in the 8-bit mask m, followed by 0x80s, which shuffle in zeros
+constexpr array<uint64_t, 256> makeCompactTable() {
+    array<uint64_t, 256> table{};
+    for (int mask = 0; mask < 256; mask++) {
+        uint64_t shuffle = 0x8080808080808080ULL;
+        int count = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            if (mask & (1 << bit)) {
+                shuffle &= ~(0xffULL << (8 * count));
+                shuffle |= (uint64_t) bit << (8 * count);
+                count++;
+            }
+        }
+        table[mask] = shuffle;
+    }
+    return table;
+}
+
+//this function builds the shuffles that move bytes up: entry k moves byte i to byte i + k and
+//fills the k bytes below with zeros
+constexpr array<array<char, 16>, 9> makeShiftTable() {
+    array<array<char, 16>, 9> table{};
+    for (int k = 0; k <= 8; k++) {
+        for (int i = 0; i < 16; i++) {
+            table[k][i] = i < k ? (char) 0x80 : i - k;
+        }
+    }
+    return table;
+}
+
+const array<uint64_t, 256> COMPACT_SHUFFLES = makeCompactTable();
+const array<array<char, 16>, 9> SHIFT_SHUFFLES = makeShiftTable();
+
+//this function returns the bytes of v whose bits are set in the 16-bit mask, packed to the
+//bottom in order, with zeros above them. each half is packed with one shuffle, and the packed
+//high half is shuffled up past the packed low half
+__attribute__((target("ssse3")))
+__m128i compactBytes(__m128i v, int mask) {
+    const long long zeros = (long long) 0x8080808080808080ULL;
+    int lowCount = __builtin_popcount(mask & 0xff);
+    __m128i low = _mm_shuffle_epi8(v, _mm_set_epi64x(zeros, COMPACT_SHUFFLES[mask & 0xff]));
+    __m128i high = _mm_shuffle_epi8(_mm_srli_si128(v, 8), _mm_set_epi64x(zeros, COMPACT_SHUFFLES[mask >> 8]));
+    __m128i shift = _mm_loadu_si128((const __m128i*) SHIFT_SHUFFLES[lowCount].data());
+    return _mm_or_si128(low, _mm_shuffle_epi8(high, shift));
+}
+
+//this function encodes names of up to 16 chars 16 letters at a time. a name is copied into a
+//zeroed 16-byte lane, and each letter is folded to lowercase and looked up as one more than its
+//soundex digit, with two 16-entry shuffles for a to p and q to z. non-letters look up 0 and are
+//packed out, which puts letters that only had non-letters between them side by side. a packed
+//letter's digit is kept if it differs from the digit before it and is not a zero, and the first
+//three kept digits after the first letter are the code
+__attribute__((target("ssse3")))
+void soundexBatchSsse3(const string_view* names, int count, char* codes) {
+    const __m128i lowDigits = _mm_setr_epi8(1, 2, 3, 4, 1, 2, 3, 1, 1, 3, 3, 5, 6, 6, 1, 2);  //a to p
+    const __m128i highDigits = _mm_setr_epi8(3, 7, 3, 4, 1, 2, 1, 3, 1, 3, 0, 0, 0, 0, 0, 0); //q to z
+    const __m128i beforeA = _mm_set1_epi8('a' - 1);
+    const __m128i afterZ = _mm_set1_epi8('z' + 1);
+    const __m128i fifteen = _mm_set1_epi8(15);
+    const __m128i vowel = _mm_set1_epi8(1);
+
+    alignas(16) unsigned char lane[SOUNDEX_LANE_WIDTH];
+    alignas(16) unsigned char letters[SOUNDEX_LANE_WIDTH];
+    for (int i = 0; i < count; i++) {
+        char* code = codes + 4 * i;
+        if (names[i].length() > SOUNDEX_LANE_WIDTH) {
+            soundexInto(names[i], code);
+            continue;
+        }
+        _mm_store_si128((__m128i*) lane, _mm_setzero_si128());
+        memcpy(lane, names[i].data(), names[i].length());
+        __m128i chars = _mm_load_si128((__m128i*) lane);
+
+        __m128i folded = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+        __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(folded, beforeA), _mm_cmplt_epi8(folded, afterZ));
+        __m128i letter = _mm_sub_epi8(folded, _mm_set1_epi8('a'));
+        __m128i isHigh = _mm_cmpgt_epi8(letter, fifteen);
+        __m128i digits = _mm_or_si128(_mm_andnot_si128(isHigh, _mm_shuffle_epi8(lowDigits, letter)),
+                                      _mm_and_si128(isHigh, _mm_shuffle_epi8(highDigits, letter)));
+
+        int letterMask = _mm_movemask_epi8(isLetter);
+        if (letterMask == 0) {
+            memcpy(code, "0000", 4);
+            continue;
+        }
+        code[0] = toupper(lane[__builtin_ctz(letterMask)]);
+
+        __m128i packed = compactBytes(digits, letterMask);
+        __m128i isKept = _mm_andnot_si128(_mm_cmpeq_epi8(packed, _mm_slli_si128(packed, 1)),
+                                          _mm_cmpgt_epi8(packed, vowel));
+        int keptMask = _mm_movemask_epi8(isKept) & ~1;
+        _mm_store_si128((__m128i*) letters, packed);
+        for (int d = 1; d < 4; d++) {
+            if (keptMask == 0) {
+                code[d] = '0';
+            }
+            else {
+                code[d] = '0' + letters[__builtin_ctz(keptMask)] - 1;
+                keptMask &= keptMask - 1;
+            }
+        }
+    }
+}
+#endif
+
+//this function uses the vector kernel when the processor running it has SSSE3 shuffles, and
+//soundexInto on each name otherwise
+void soundexBatch(const string_view* names, int count, char* codes) {
+#ifdef SOUNDEX_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        soundexBatchSsse3(names, count, codes);
+        return;
+    }
+#endif
+    soundexBatchScalar(names, count, codes);
+}
+
+//this function takes a string and outputs its Soundex code. the first letter is kept and the rest
+//of the letters are turned into digits following the Soundex algorithm, the same steps the helper
+//functions removeNonLetters, encodeDigits, coalesceSimilar, removeZeros and makeLengthFour take one
+//at a time. the Soundex code of the input is returned as a string
 string soundex(string s) {
-    s = removeNonLetters(s);
-    char fLetter = s[0];
-    s = encodeDigits(s);
-    s = coalesceSimilar(s);
-    s[0] = toupper(fLetter);
-    s = removeZeros(s);
-    s = makeLengthFour(s);
-    return s;
+    char code[4];
+    soundexInto(s, code);
+    return string(code, 4);
 }
 
 
-//this function opens a file and reads it onto a vector. the user is prompted for a name and then all names in the file with a matching
-//soundex will be printed as well as the soundex code. the function continues to run until the user types RETURN to quit. nothing
-//is returned
-void soundexSearch(string filepath) {
-    // The proivded code opens the file with the given name 
-    // and then reads the lines of that file into a vector.
-    ifstream in;
-    Vector<string> databaseNames;
+PackedSoundex packedSoundex(string_view name) {
+    char code[4];
+    soundexInto(name, code);
+    return packSoundex(code);
+}
+
+//the first bytes of every soundex index file
+const string SOUNDEX_INDEX_MAGIC = "SDXINDX1";
+
+//names per thread below which another thread costs more than it saves
+const int NAMES_PER_THREAD = 4096;
+
+//candidate pairs per task of soundexJoin. a code with more pairs than this is split between
+//tasks by its left names, so no one code's pairs have to be held in memory at once
+const int JOIN_TASK_PAIRS = 1 << 16;
+
+//tasks each thread takes per round of soundexJoin. each round's output is written before the
+//next starts
+const int JOIN_TASKS_PER_THREAD = 4;
+
+//a guess at the bytes per line of a name file, used to pick how many threads split its lines
+const int BYTES_PER_NAME = 8;
+
+//this function splits numItems into numThreads contiguous ranges and calls worker(t, begin, end)
+//on range t in its own thread. the last range runs on the calling thread
+void runInParallel(int numItems, int numThreads, const function<void(int, int, int)>& worker) {
+    vector<thread> workers;
+    int perThread = numItems / numThreads;
+    int leftover = numItems % numThreads;
+    int begin = 0;
+    for (int t = 0; t < numThreads; t++) {
+        int end = begin + perThread + (t < leftover ? 1 : 0);
+        if (t == numThreads - 1) {
+            worker(t, begin, end);
+        }
+        else {
+            workers.emplace_back(worker, t, begin, end);
+        }
+        begin = end;
+    }
+    for (thread& w : workers) {
+        w.join();
+    }
+}
+
+//this function returns how many threads to use for numItems names, capped at numThreads, or at
+//the number of cores if numThreads is 0
+int threadsFor(int numItems, int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = max(1, (int) thread::hardware_concurrency());
+    }
+    return max(1, min(numThreads, numItems / NAMES_PER_THREAD));
+}
+
+//this function groups names by packed code. the names are encoded with soundexBatch, each thread
+//taking a range of them, and then counting sorted: counting the names of each code gives where
+//each code's group starts, and each name is put in the next free place of its group. each group
+//is sorted by name, with the groups split between the threads
+CodeBuckets bucketByCode(const string_view* names, int numNames, int numThreads) {
+    numThreads = threadsFor(numNames, numThreads);
+    vector<char> chars(4 * numNames);
+    vector<PackedSoundex> codes(numNames);
+    runInParallel(numNames, numThreads, [&](int, int begin, int end) {
+        soundexBatch(names + begin, end - begin, chars.data() + 4 * begin);
+        for (int i = begin; i < end; i++) {
+            codes[i] = packSoundex(chars.data() + 4 * i);
+        }
+    });
+
+    CodeBuckets buckets;
+    buckets.starts.assign(SOUNDEX_CODE_COUNT + 1, 0);
+    for (PackedSoundex code : codes) {
+        buckets.starts[code + 1]++;
+    }
+    for (int code = 0; code < SOUNDEX_CODE_COUNT; code++) {
+        buckets.starts[code + 1] += buckets.starts[code];
+    }
+    buckets.order.resize(numNames);
+    vector<uint32_t> next(buckets.starts.begin(), buckets.starts.end() - 1);
+    for (int i = 0; i < numNames; i++) {
+        buckets.order[next[codes[i]]++] = i;
+    }
+    runInParallel(SOUNDEX_CODE_COUNT, numThreads, [&](int, int begin, int end) {
+        for (int code = begin; code < end; code++) {
+            sort(buckets.order.begin() + buckets.starts[code], buckets.order.begin() + buckets.starts[code + 1],
+                 [&](int a, int b) {
+                return names[a] < names[b];
+            });
+        }
+    });
+    return buckets;
+}
+
+SoundexIndex::SoundexIndex(const Vector<string>& names)
+    : SoundexIndex(vector<string_view>(names.begin(), names.end()).data(), names.size()) {
+}
+
+//this constructor groups the names by code, then copies them in group order into one char array
+SoundexIndex::SoundexIndex(const string_view* names, int count) {
+    CodeBuckets buckets = bucketByCode(names, count);
+    codeStarts = buckets.starts;
+
+    size_t totalChars = 0;
+    for (int i = 0; i < count; i++) {
+        totalChars += names[i].length();
+    }
+    if (totalChars > UINT32_MAX) {
+        error("Too many name characters for a soundex index");
+    }
+    nameChars.reserve(totalChars);
+    for (int i : buckets.order) {
+        nameStarts.push_back(nameChars.size());
+        nameChars.insert(nameChars.end(), names[i].begin(), names[i].end());
+    }
+    nameStarts.push_back(nameChars.size());
+}
+
+//this function writes an array of numbers to out byte for byte
+template <typename T>
+void writeArray(ofstream& out, const vector<T>& values) {
+    out.write((const char*) values.data(), values.size() * sizeof(T));
+}
+
+//this function reads count numbers from in into values, returning false if the file ends first
+template <typename T>
+bool readArray(ifstream& in, vector<T>& values, size_t count) {
+    values.resize(count);
+    return (bool) in.read((char*) values.data(), count * sizeof(T));
+}
+
+//this function writes the magic bytes, the number of names and the number of name chars,
+//then codeStarts, nameStarts and nameChars as they are in memory
+void SoundexIndex::save(string indexfile) const {
+    ofstream out(indexfile, ios::binary);
+    if (!out) {
+        error("Cannot write file named " + indexfile);
+    }
+    uint32_t counts[2] = {(uint32_t) size(), (uint32_t) nameChars.size()};
+    out.write(SOUNDEX_INDEX_MAGIC.data(), SOUNDEX_INDEX_MAGIC.length());
+    out.write((const char*) counts, sizeof(counts));
+    writeArray(out, codeStarts);
+    writeArray(out, nameStarts);
+    writeArray(out, nameChars);
+    if (!out) {
+        error("Cannot write file named " + indexfile);
+    }
+}
+
+SoundexIndex SoundexIndex::load(string indexfile) {
+    ifstream in(indexfile, ios::binary);
+    if (!in) {
+        error("Cannot open file named " + indexfile);
+    }
+    string magic(SOUNDEX_INDEX_MAGIC.length(), ' ');
+    uint32_t counts[2];
+    in.read(&magic[0], magic.length());
+    in.read((char*) counts, sizeof(counts));
+    if (!in || magic != SOUNDEX_INDEX_MAGIC) {
+        error(indexfile + " is not a soundex index");
+    }
 
-    if (openFile(in, filepath)) {
-        readEntireFile(in, databaseNames);
+    //the counts give the exact size of the file, so damaged counts are caught before any
+    //array is sized from them
+    long long headerBytes = in.tellg();
+    in.seekg(0, ios::end);
+    long long expectedBytes = headerBytes + (SOUNDEX_CODE_COUNT + 1) * sizeof(uint32_t)
+                              + ((long long) counts[0] + 1) * sizeof(uint32_t) + counts[1];
+    if (counts[0] == UINT32_MAX || in.tellg() != expectedBytes) {
+        error("Soundex index " + indexfile + " is damaged");
     }
+    in.seekg(headerBytes);
+
+    //matchesFor trusts both offset arrays to run upward from 0 to the end of what they index
+    SoundexIndex index;
+    if (!readArray(in, index.codeStarts, SOUNDEX_CODE_COUNT + 1) || !readArray(in, index.nameStarts, counts[0] + 1)
+        || !readArray(in, index.nameChars, counts[1])
+        || index.codeStarts.front() != 0 || index.codeStarts.back() != counts[0]
+        || !is_sorted(index.codeStarts.begin(), index.codeStarts.end())
+        || index.nameStarts.front() != 0 || index.nameStarts.back() != counts[1]
+        || !is_sorted(index.nameStarts.begin(), index.nameStarts.end())) {
+        error("Soundex index " + indexfile + " is damaged");
+    }
+    return index;
+}
+
+//this function reads where the group of the name's code starts and ends, then copies out the
+//names in between
+Vector<string> SoundexIndex::matchesFor(string name) const {
+    PackedSoundex code = packedSoundex(name);
+    Vector<string> matches;
+    for (uint32_t i = codeStarts[code]; i < codeStarts[code + 1]; i++) {
+        matches.add(string(nameChars.data() + nameStarts[i], nameStarts[i + 1] - nameStarts[i]));
+    }
+    return matches;
+}
+
+int SoundexIndex::countOf(PackedSoundex code) const {
+    return codeStarts[code + 1] - codeStarts[code];
+}
+
+int SoundexIndex::size() const {
+    return nameStarts.size() - 1;
+}
+
+//the longest second name whose edit distance rows fit on the stack
+const int EDIT_STACK_WIDTH = 64;
+
+//this function fills one row of the edit distance table at a time, keeping only the row above.
+//once every entry of a row is past limit, no later row can come back under it. rows for names
+//of up to EDIT_STACK_WIDTH chars live on the stack, since the join calls this for every pair
+int editDistance(string_view a, string_view b, int limit) {
+    if (abs((int) a.length() - (int) b.length()) > limit) {
+        return limit + 1;
+    }
+    int stackRows[2][EDIT_STACK_WIDTH + 1];
+    vector<int> heapRows;
+    int* above = stackRows[0];
+    int* row = stackRows[1];
+    if (b.length() > EDIT_STACK_WIDTH) {
+        heapRows.resize(2 * (b.length() + 1));
+        above = heapRows.data();
+        row = above + b.length() + 1;
+    }
+
+    for (int j = 0; j <= b.length(); j++) {
+        above[j] = j;
+    }
+    for (int i = 1; i <= a.length(); i++) {
+        row[0] = i;
+        int rowMin = row[0];
+        for (int j = 1; j <= b.length(); j++) {
+            int substitute = above[j - 1] + (tolower(a[i - 1]) != tolower(b[j - 1]));
+            row[j] = min(substitute, min(above[j], row[j - 1]) + 1);
+            rowMin = min(rowMin, row[j]);
+        }
+        if (rowMin > limit) {
+            return limit + 1;
+        }
+        swap(above, row);
+    }
+    return min(above[b.length()], limit + 1);
+}
+
+//this constructor maps the file and then finds its lines in parallel. each thread owns an equal
+//range of bytes and takes the lines that start in it, skipping the end of a line begun in the
+//range before, so every line is taken by exactly one thread and the ranges join in file order
+MappedNames::MappedNames(string filename) : bytes(nullptr), length(0) {
+#ifdef _WIN32
+    ifstream in(filename, ios::binary);
+    if (!in) {
+        error("Cannot open file named " + filename);
+    }
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    bytes = contents.data();
+    length = contents.size();
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        error("Cannot open file named " + filename);
+    }
+    length = info.st_size;
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            error("Cannot map file named " + filename);
+        }
+        bytes = (const char*) mapped;
+        madvise(mapped, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+#endif
+
+    int numThreads = threadsFor((int) min<size_t>(length / BYTES_PER_NAME, INT_MAX), 0);
+    vector<vector<string_view>> lines(numThreads);
+    runInParallel(numThreads, numThreads, [&](int t, int, int) {
+        size_t end = length * (t + 1) / numThreads;
+        size_t pos = length * t / numThreads;
+        if (pos > 0 && bytes[pos - 1] != '\n') {
+            const char* newline = (const char*) memchr(bytes + pos, '\n', length - pos);
+            pos = newline ? newline - bytes + 1 : length;
+        }
+        while (pos < end) {
+            const char* newline = (const char*) memchr(bytes + pos, '\n', length - pos);
+            size_t lineEnd = newline ? newline - bytes : length;
+            size_t nameEnd = lineEnd > pos && bytes[lineEnd - 1] == '\r' ? lineEnd - 1 : lineEnd;
+            lines[t].emplace_back(bytes + pos, nameEnd - pos);
+            pos = lineEnd + 1;
+        }
+    });
+    for (const vector<string_view>& range : lines) {
+        names.insert(names.end(), range.begin(), range.end());
+    }
+}
+
+MappedNames::~MappedNames() {
+#ifndef _WIN32
+    if (length > 0) {
+        munmap((void*) bytes, length);
+    }
+#endif
+}
+
+int MappedNames::size() const {
+    return names.size();
+}
+
+string_view MappedNames::operator[](int i) const {
+    return names[i];
+}
+
+const string_view* MappedNames::data() const {
+    return names.data();
+}
+
+//a run of left names of soundexJoin, by their position in code order, starting in code
+struct JoinTask {
+    int code;
+    uint32_t begin;
+    uint32_t end;
+};
+
+//this function cuts the left names into tasks of about JOIN_TASK_PAIRS candidate pairs each, in
+//code order. a task can hold many small codes or part of a big one, and names whose code has no
+//right names cost nothing
+vector<JoinTask> joinTasks(const CodeBuckets& leftBuckets, const CodeBuckets& rightBuckets) {
+    vector<JoinTask> tasks;
+    JoinTask task = {0, 0, 0};
+    long long taskPairs = 0;
+    for (int code = 0; code < SOUNDEX_CODE_COUNT; code++) {
+        long long rightCount = rightBuckets.starts[code + 1] - rightBuckets.starts[code];
+        uint32_t l = leftBuckets.starts[code];
+        while (rightCount > 0 && l < leftBuckets.starts[code + 1]) {
+            if (taskPairs == 0) {
+                task = {code, l, l};
+            }
+            long long names = max(1LL, (JOIN_TASK_PAIRS - taskPairs + rightCount - 1) / rightCount);
+            names = min<long long>(names, leftBuckets.starts[code + 1] - l);
+            l += names;
+            taskPairs += names * rightCount;
+            task.end = l;
+            if (taskPairs >= JOIN_TASK_PAIRS) {
+                tasks.push_back(task);
+                taskPairs = 0;
+            }
+        }
+    }
+    if (taskPairs > 0) {
+        tasks.push_back(task);
+    }
+    return tasks;
+}
+
+//this function groups both files by code and cuts the left names into tasks, then joins a round
+//of tasks at a time. the threads split the round's tasks, and each writes the pairs of its tasks
+//to its own buffer; the buffers are written out in code order before the next round, so the
+//output is in the same order for any number of threads and only one round of it is ever held in
+//memory, however many names share a code
+long long soundexJoin(string leftFile, string rightFile, ostream& out, int maxDistance, int numThreads) {
+    MappedNames left(leftFile);
+    MappedNames right(rightFile);
+    CodeBuckets leftBuckets = bucketByCode(left.data(), left.size(), numThreads);
+    CodeBuckets rightBuckets = bucketByCode(right.data(), right.size(), numThreads);
+    numThreads = threadsFor(left.size() + right.size(), numThreads);
+    vector<JoinTask> tasks = joinTasks(leftBuckets, rightBuckets);
+
+    long long numPairs = 0;
+    vector<string> buffers(numThreads);
+    vector<long long> counts(numThreads);
+    int roundTasks = numThreads * JOIN_TASKS_PER_THREAD;
+    for (int round = 0; round < (int) tasks.size(); round += roundTasks) {
+        int roundEnd = min(round + roundTasks, (int) tasks.size());
+        runInParallel(roundEnd - round, numThreads, [&](int t, int begin, int end) {
+            buffers[t].clear();
+            counts[t] = 0;
+            for (int i = round + begin; i < round + end; i++) {
+                int code = tasks[i].code;
+                for (uint32_t l = tasks[i].begin; l < tasks[i].end; l++) {
+                    while (l >= leftBuckets.starts[code + 1]) {
+                        code++;
+                    }
+                    string_view leftName = left[leftBuckets.order[l]];
+                    for (uint32_t r = rightBuckets.starts[code]; r < rightBuckets.starts[code + 1]; r++) {
+                        string_view rightName = right[rightBuckets.order[r]];
+                        if (maxDistance < 0 || editDistance(leftName, rightName, maxDistance) <= maxDistance) {
+                            buffers[t] += leftName;
+                            buffers[t] += '\t';
+                            buffers[t] += rightName;
+                            buffers[t] += '\n';
+                            counts[t]++;
+                        }
+                    }
+                }
+            }
+        });
+        for (int t = 0; t < numThreads; t++) {
+            out << buffers[t];
+            numPairs += counts[t];
+        }
+    }
+    out.flush();
+    return numPairs;
+}
+
+//this function opens a file and reads it onto a vector, which is indexed by soundex code. the user is prompted for a name and then all
+//names in the file with a matching soundex will be printed as well as the soundex code. the function continues to run until the user
+//types RETURN to quit. nothing is returned
+void soundexSearch(string filepath) {
+    //the file is mapped rather than read line by line, so the names are views into it until the
+    //index copies them in code order
+    MappedNames databaseNames(filepath);
     cout << "Read file " << filepath << ", "
          << databaseNames.size() << " names found." << endl;
-    // The names in the database are now stored in the provided vector named databaseNames
+    SoundexIndex index(databaseNames.data(), databaseNames.size());
 
     bool isRunning = true;
     while (isRunning){
@@ -155,14 +742,7 @@ void soundexSearch(string filepath) {
             string soundexCode = soundex(name);
             cout << "Soundex code is " << soundexCode << endl << "\n";
 
-            Vector<string> matchingNames;
-            for (int i = 0; i < databaseNames.size(); i++){
-                if (soundex(databaseNames.get(i)).compare(soundexCode) == 0){
-                    matchingNames.add(databaseNames.get(i));  //finds names with matching codes are adds them to the vector
-                }
-            }
-
-            matchingNames.sort();
+            Vector<string> matchingNames = index.matchesFor(name); //already sorted
             cout << "Matches from database: " << matchingNames << endl << "\n";
         }
     }
@@ -304,3 +884,396 @@ STUDENT_TEST("test Soundex with only one letter"){
     EXPECT_EQUAL(soundex("_r_"), "R000");
 
 }
+
+STUDENT_TEST("soundexInto gives the same codes as the chain of helper functions") {
+    auto chained = [](string s) {
+        s = removeNonLetters(s);
+        char fLetter = s[0];
+        s = encodeDigits(s);
+        s = coalesceSimilar(s);
+        s[0] = toupper(fLetter);
+        s = removeZeros(s);
+        return makeLengthFour(s);
+    };
+    string alphabet = "abcdefghijklmnopqrstuvwxyzAEIOUHWYBFPVLR -'9\xe9";
+    for (int i = 0; i < 100000; i++) {
+        string name;
+        for (int length = randomInteger(0, 12); length > 0; length--) {
+            name += alphabet[randomInteger(0, alphabet.length() - 1)];
+        }
+        char code[4];
+        soundexInto(name, code);
+        EXPECT_EQUAL(string(code, 4), chained(name));
+    }
+}
+
+STUDENT_TEST("soundexBatch encodes every name into its own 4 chars") {
+    vector<string_view> names = {"Master", "Jue", "", "Tessier-Lavigne", "_r_"};
+    vector<char> codes(4 * names.size());
+    soundexBatch(names.data(), names.size(), codes.data());
+    EXPECT_EQUAL(string(codes.begin(), codes.end()), "M236J0000000T264R000");
+}
+
+STUDENT_TEST("soundexBatch time trials against calling soundex name by name") {
+    vector<string> names;
+    for (int i = 0; i < 1000000; i++) {
+        string name(1, 'A' + randomInteger(0, 25));
+        for (int length = randomInteger(2, 10); length > 0; length--) {
+            name += 'a' + randomInteger(0, 25);
+        }
+        names.push_back(name);
+    }
+    vector<string_view> views(names.begin(), names.end());
+    vector<char> codes(4 * names.size());
+
+    TIME_OPERATION(names.size(), for (const string& name : names) soundex(name));
+    TIME_OPERATION(names.size(), soundexBatchScalar(views.data(), views.size(), codes.data()));
+    TIME_OPERATION(names.size(), soundexBatch(views.data(), views.size(), codes.data()));
+}
+
+STUDENT_TEST("soundexBatch fuzzed against soundex on names of every length and byte") {
+    vector<string> names = {"", "Master", "Jue", "Tessier-Lavigne", "Van Niekerk", "Ashcraft", "Schwarz",
+                            "@[`{", "abcdefghijklmnop", "abcdefghijklmnopq", "zzzzzzzzzzzzzzzz"};
+    string letters = "abcdefghijklmnopqrstuvwxyzAEIOUHWYBFPVLRSTM";
+    for (int i = 0; i < 200000; i++) {
+        string name;
+        for (int length = randomInteger(0, 20); length > 0; length--) {
+            name += randomChance(0.8) ? letters[randomInteger(0, letters.length() - 1)]
+                                      : (char) randomInteger(0, 255);
+        }
+        names.push_back(name);
+    }
+    vector<string_view> views(names.begin(), names.end());
+    vector<char> codes(4 * names.size());
+    vector<char> scalarCodes(4 * names.size());
+    soundexBatch(views.data(), views.size(), codes.data());
+    soundexBatchScalar(views.data(), views.size(), scalarCodes.data());
+    for (int i = 0; i < names.size(); i++) {
+        EXPECT_EQUAL(string(codes.data() + 4 * i, 4), soundex(names[i]));
+    }
+    EXPECT(codes == scalarCodes);
+}
+
+//this function returns a made-up surname: a capital letter followed by 3 to 9 lowercase letters
+string randomSurname() {
+    string name(1, 'A' + randomInteger(0, 25));
+    for (int length = randomInteger(3, 9); length > 0; length--) {
+        name += 'a' + randomInteger(0, 25);
+    }
+    return name;
+}
+
+STUDENT_TEST("SoundexIndex finds the same sorted names as encoding every database name") {
+    Vector<string> names = {"Vaska", "Vasque", "Vussky", "Master", "Jue", "Liu", "Lee", "Vaska", "O'Hara"};
+    for (int i = 0; i < 5000; i++) {
+        names.add(randomSurname());
+    }
+    SoundexIndex index(names);
+    EXPECT_EQUAL(index.size(), names.size());
+    EXPECT_EQUAL(SoundexIndex({"Vussky", "Vaska", "Lee", "Vasque", "Vaska"}).matchesFor("vaska"),
+                 Vector<string>({"Vaska", "Vaska", "Vasque", "Vussky"}));
+
+    for (string query : {"Vaska", "Liu", "Master", "Ohara", "Zyzzyva", "Smith"}) {
+        Vector<string> expected;
+        for (const string& name : names) {
+            if (soundex(name) == soundex(query)) {
+                expected.add(name);
+            }
+        }
+        expected.sort();
+        EXPECT_EQUAL(index.matchesFor(query), expected);
+    }
+}
+
+STUDENT_TEST("packSoundex and unpackSoundex round trip every code") {
+    static_assert(packSoundex("M236") == 12236, "M is letter 12");
+    static_assert(packSoundex("A000") == 0 && packSoundex("Z666") == 25666, "codes fit in 15 bits");
+    static_assert(packSoundex("0000") == SOUNDEX_NO_LETTERS, "no letters has its own code");
+    for (int packed = 0; packed < SOUNDEX_CODE_COUNT; packed++) {
+        char code[4];
+        unpackSoundex(packed, code);
+        EXPECT_EQUAL(packSoundex(code), packed);
+    }
+    EXPECT_EQUAL(packedSoundex("Tessier-Lavigne"), packSoundex("T264"));
+    EXPECT_EQUAL(packedSoundex("_9_"), SOUNDEX_NO_LETTERS);
+}
+
+STUDENT_TEST("SoundexIndex saved to a file loads back the same") {
+    Vector<string> names = {"Vaska", "", "Vasque", "9", "Liu", "Lee", "Vaska", "O'Hara", "Ohara"};
+    for (int i = 0; i < 1000; i++) {
+        names.add(randomSurname());
+    }
+    EXPECT_EQUAL(SoundexIndex(names.subList(0, 9)).countOf(packSoundex("V200")), 3);
+    SoundexIndex index(names);
+    EXPECT_EQUAL(index.matchesFor("--"), Vector<string>({"", "9"}));
+
+    string indexfile = "res/generated-soundex.idx";
+    index.save(indexfile);
+    SoundexIndex loaded = SoundexIndex::load(indexfile);
+    deleteFile(indexfile);
+    EXPECT_EQUAL(loaded.size(), names.size());
+    for (const string& name : names) {
+        EXPECT_EQUAL(loaded.matchesFor(name), index.matchesFor(name));
+    }
+
+    EXPECT_ERROR(SoundexIndex::load("res/missing.idx"));
+    ofstream out(indexfile);
+    out << "SDXINDX1 but cut short";
+    out.close();
+    EXPECT_ERROR(SoundexIndex::load(indexfile));
+
+    //overwrites the 4 bytes at offset in a saved copy of index and checks that load refuses it
+    auto expectDamaged = [&](long long offset, uint32_t value) {
+        index.save(indexfile);
+        fstream file(indexfile, ios::binary | ios::in | ios::out);
+        file.seekp(offset);
+        file.write((const char*) &value, sizeof(value));
+        file.close();
+        EXPECT_ERROR(SoundexIndex::load(indexfile));
+    };
+    long long codeStarts = SOUNDEX_INDEX_MAGIC.length() + 2 * sizeof(uint32_t);
+    long long nameStarts = codeStarts + (SOUNDEX_CODE_COUNT + 1) * sizeof(uint32_t);
+    expectDamaged(SOUNDEX_INDEX_MAGIC.length(), UINT32_MAX); //name count + 1 wraps to 0
+    expectDamaged(SOUNDEX_INDEX_MAGIC.length() + sizeof(uint32_t), 5); //too few name chars
+    expectDamaged(codeStarts, 1); //the first code does not start at name 0
+    expectDamaged(codeStarts + packSoundex("V200") * sizeof(uint32_t), UINT32_MAX); //codes go backwards
+    expectDamaged(nameStarts + 5 * sizeof(uint32_t), UINT32_MAX); //a name past the chars
+    expectDamaged(nameStarts + names.size() * sizeof(uint32_t), 0); //the last name ends early
+    deleteFile(indexfile);
+}
+
+STUDENT_TEST("SoundexIndex load and query time trials on 2 million surnames") {
+    Vector<string> names;
+    for (int i = 0; i < 2000000; i++) {
+        names.add(randomSurname());
+    }
+    Vector<string> queries;
+    for (int i = 0; i < 10000; i++) {
+        queries.add(randomSurname());
+    }
+
+    TIME_OPERATION(names.size(), SoundexIndex(names).size());
+    SoundexIndex index(names);
+    TIME_OPERATION(queries.size(), for (const string& query : queries) index.matchesFor(query));
+    int total = 0;
+    TIME_OPERATION(queries.size(), for (const string& query : queries) total += index.countOf(packedSoundex(query)));
+    EXPECT(total > 0);
+
+    string indexfile = "res/generated-soundex.idx";
+    TIME_OPERATION(names.size(), index.save(indexfile));
+    TIME_OPERATION(names.size(), SoundexIndex::load(indexfile).size());
+    deleteFile(indexfile);
+
+    //the old way: encode the whole database for every query
+    TIME_OPERATION(names.size(), for (const string& name : names) soundex(name) == soundex(queries[0]));
+}
+
+STUDENT_TEST("editDistance ignores case and stops past its limit") {
+    EXPECT_EQUAL(editDistance("kitten", "sitting"), 3);
+    EXPECT_EQUAL(editDistance("", "abc"), 3);
+    EXPECT_EQUAL(editDistance("SMITH", "smith"), 0);
+    EXPECT_EQUAL(editDistance("Smith", "Smyth"), 1);
+    EXPECT_EQUAL(editDistance("Vaska", "Vussky", 1), 2);
+    EXPECT_EQUAL(editDistance("a", "abcdef", 2), 3);
+    EXPECT_EQUAL(editDistance(string(100, 'a'), string(99, 'a') + "b"), 1);
+}
+
+STUDENT_TEST("soundexJoin writes every pair of names with the same code, in code order") {
+    string leftFile = "res/generated-left.txt";
+    string rightFile = "res/generated-right.txt";
+    ofstream left(leftFile);
+    left << "Vaska\nSmith\nLee\nO'Hara\n";
+    left.close();
+    ofstream right(rightFile);
+    right << "Vussky\nSmyth\nLeigh\nJones\nVasque\nOhara\n";
+    right.close();
+
+    ostringstream all;
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, all), 4);
+    EXPECT_EQUAL(all.str(), "O'Hara\tOhara\nSmith\tSmyth\nVaska\tVasque\nVaska\tVussky\n");
+    ostringstream close;
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, close, 1), 2);
+    EXPECT_EQUAL(close.str(), "O'Hara\tOhara\nSmith\tSmyth\n");
+    deleteFile(leftFile);
+    deleteFile(rightFile);
+    EXPECT_ERROR(soundexJoin(leftFile, rightFile, all));
+}
+
+STUDENT_TEST("soundexJoin gives the same pairs on any number of threads") {
+    string leftFile = "res/generated-left.txt";
+    string rightFile = "res/generated-right.txt";
+    Vector<string> leftNames;
+    Vector<string> rightNames;
+    ofstream left(leftFile);
+    ofstream right(rightFile);
+    for (int i = 0; i < 30000; i++) {
+        leftNames.add(randomSurname());
+        rightNames.add(randomSurname());
+        left << leftNames[i] << '\n';
+        right << rightNames[i] << '\n';
+    }
+    left.close();
+    right.close();
+
+    SoundexIndex leftIndex(leftNames);
+    SoundexIndex rightIndex(rightNames);
+    long long expected = 0;
+    for (int code = 0; code < SOUNDEX_CODE_COUNT; code++) {
+        expected += (long long) leftIndex.countOf(code) * rightIndex.countOf(code);
+    }
+    ostringstream one;
+    ostringstream many;
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, one, -1, 1), expected);
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, many, -1, 8), expected);
+    EXPECT(one.str() == many.str());
+
+    ostringstream close;
+    long long closePairs = soundexJoin(leftFile, rightFile, close, 2);
+    EXPECT(closePairs > 0 && closePairs < expected);
+    deleteFile(leftFile);
+    deleteFile(rightFile);
+}
+
+//a stream buffer that keeps none of its output, only its size, a checksum and its largest write
+struct MeasuringBuffer : streambuf {
+    long long bytes = 0;
+    long long largestWrite = 0;
+    unsigned long long checksum = 0;
+
+    streamsize xsputn(const char* text, streamsize n) override {
+        bytes += n;
+        largestWrite = max<long long>(largestWrite, n);
+        for (streamsize i = 0; i < n; i++) {
+            checksum = checksum * 31 + (unsigned char) text[i];
+        }
+        return n;
+    }
+
+    int overflow(int c) override {
+        if (c != EOF) {
+            char ch = c;
+            xsputn(&ch, 1);
+        }
+        return c;
+    }
+};
+
+STUDENT_TEST("soundexJoin writes one huge code in bounded pieces, the same on any number of threads") {
+    string leftFile = "res/generated-left.txt";
+    string rightFile = "res/generated-right.txt";
+    Vector<string> smiths = {"Smith", "Smyth", "Smithe", "Smeeth"}; //all S530
+    int perSide = 4500;
+    ofstream left(leftFile);
+    ofstream right(rightFile);
+    for (int i = 0; i < perSide; i++) {
+        left << smiths[i % 4] << '\n';
+        right << smiths[(i / 7) % 4] << '\n';
+    }
+    left.close();
+    right.close();
+
+    MeasuringBuffer one;
+    MeasuringBuffer two;
+    ostream oneOut(&one);
+    ostream twoOut(&two);
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, oneOut, -1, 1), (long long) perSide * perSide);
+    EXPECT_EQUAL(soundexJoin(leftFile, rightFile, twoOut, -1, 2), (long long) perSide * perSide);
+    EXPECT_EQUAL(one.bytes, two.bytes);
+    EXPECT_EQUAL(one.checksum, two.checksum);
+    long long longestLine = 2 * smiths[2].length() + 2;
+    EXPECT(one.largestWrite <= JOIN_TASKS_PER_THREAD * (JOIN_TASK_PAIRS + perSide) * longestLine);
+    EXPECT(one.largestWrite * 20 < one.bytes);
+    deleteFile(leftFile);
+    deleteFile(rightFile);
+}
+
+STUDENT_TEST("soundexJoin time trials on two files of 200000 names") {
+    string leftFile = "res/generated-left.txt";
+    string rightFile = "res/generated-right.txt";
+    ofstream left(leftFile);
+    ofstream right(rightFile);
+    for (int i = 0; i < 200000; i++) {
+        left << randomSurname() << '\n';
+        right << randomSurname() << '\n';
+    }
+    left.close();
+    right.close();
+
+    ofstream discard("res/generated-pairs.txt");
+    TIME_OPERATION(200000, soundexJoin(leftFile, rightFile, discard, 1, 1));
+    TIME_OPERATION(200000, soundexJoin(leftFile, rightFile, discard, 1));
+    TIME_OPERATION(200000, soundexJoin(leftFile, rightFile, discard, -1));
+    discard.close();
+    deleteFile("res/generated-pairs.txt");
+    deleteFile(leftFile);
+    deleteFile(rightFile);
+}
+
+STUDENT_TEST("MappedNames splits a file into the same names as readEntireFile") {
+    string filename = "res/generated-names.txt";
+    ofstream out(filename, ios::binary);
+    out << "Vaska\n\nO'Hara\r\nLee\n\n";
+    out.close();
+    MappedNames mapped(filename);
+    EXPECT_EQUAL(mapped.size(), 5);
+    Vector<string> names;
+    for (int i = 0; i < mapped.size(); i++) {
+        names.add(string(mapped[i]));
+    }
+    EXPECT_EQUAL(names, Vector<string>({"Vaska", "", "O'Hara", "Lee", ""}));
+
+    out.open(filename, ios::binary);
+    out << "Vussky\nSmyth";
+    out.close();
+    MappedNames unterminated(filename);
+    EXPECT_EQUAL(unterminated.size(), 2);
+    EXPECT_EQUAL(string(unterminated[1]), "Smyth");
+
+    out.open(filename, ios::binary);
+    Vector<string> expected;
+    for (int i = 0; i < 100000; i++) {
+        expected.add(randomSurname());
+        out << expected[i] << '\n';
+    }
+    out.close();
+    MappedNames many(filename);
+    EXPECT_EQUAL(many.size(), expected.size());
+    bool allSame = true;
+    for (int i = 0; i < many.size(); i++) {
+        allSame = allSame && many[i] == expected[i];
+    }
+    EXPECT(allSame);
+    EXPECT_EQUAL(SoundexIndex(many.data(), many.size()).matchesFor("Smith"), SoundexIndex(expected).matchesFor("Smith"));
+
+    out.open(filename, ios::binary);
+    out.close();
+    EXPECT_EQUAL(MappedNames(filename).size(), 0);
+    deleteFile(filename);
+    EXPECT_ERROR(MappedNames("res/missing-names.txt"));
+}
+
+STUDENT_TEST("MappedNames loading time trials against readEntireFile on 2 million surnames") {
+    string filename = "res/generated-names.txt";
+    ofstream out(filename);
+    for (int i = 0; i < 2000000; i++) {
+        out << randomSurname() << '\n';
+    }
+    out.close();
+
+    auto readAndIndex = [&]() {
+        ifstream in;
+        Vector<string> names;
+        openFile(in, filename);
+        readEntireFile(in, names);
+        return SoundexIndex(names).size();
+    };
+    auto mapAndIndex = [&]() {
+        MappedNames names(filename);
+        return SoundexIndex(names.data(), names.size()).size();
+    };
+    EXPECT_EQUAL(mapAndIndex(), readAndIndex());
+    TIME_OPERATION(2000000, readAndIndex());
+    TIME_OPERATION(2000000, mapAndIndex());
+    TIME_OPERATION(2000000, MappedNames(filename).size());
+    deleteFile(filename);
+}
@@ -6,8 +6,153 @@
  * will be called from main.cpp
  */
 #pragma once
+#include "vector.h"
+#include <cstdint>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 void soundexSearch(std::string filepath);
 std::string soundex(std::string s);
 std::string removeNonLetters(std::string s);
+
+// Writes the Soundex code of name into the 4 chars at code, with no '\0' after them. Same
+// code as soundex(name), found in one pass over name without allocating anything.
+void soundexInto(std::string_view name, char* code);
+
+// Writes the codes of names[0] to names[count - 1] into codes, 4 chars per name, so codes
+// must hold 4 * count chars. On x86 processors with SSSE3, names of up to 16 chars are
+// encoded with vector shuffles; otherwise soundexBatchScalar does the work.
+void soundexBatch(const std::string_view* names, int count, char* codes);
+
+// Same as soundexBatch, calling soundexInto on one name at a time.
+void soundexBatchScalar(const std::string_view* names, int count, char* codes);
+
+// A Soundex code packed into 15 bits: the letter's place in the alphabet times 1000 plus
+// the three digits read as a number, so "M236" is 12236. The code "0000" of a name with no
+// letters packs to SOUNDEX_NO_LETTERS, right after the 26,000 letter codes.
+typedef uint16_t PackedSoundex;
+
+const PackedSoundex SOUNDEX_NO_LETTERS = 26000;
+const int SOUNDEX_CODE_COUNT = SOUNDEX_NO_LETTERS + 1;
+
+// Returns the packed form of a 4-char Soundex code.
+constexpr PackedSoundex packSoundex(const char* code) {
+    if (code[0] < 'A' || code[0] > 'Z') {
+        return SOUNDEX_NO_LETTERS;
+    }
+    return (code[0] - 'A') * 1000 + (code[1] - '0') * 100 + (code[2] - '0') * 10 + (code[3] - '0');
+}
+
+// Writes the 4 chars of a packed Soundex code into code.
+constexpr void unpackSoundex(PackedSoundex packed, char* code) {
+    if (packed == SOUNDEX_NO_LETTERS) {
+        code[0] = code[1] = code[2] = code[3] = '0';
+        return;
+    }
+    code[0] = 'A' + packed / 1000;
+    code[1] = '0' + packed / 100 % 10;
+    code[2] = '0' + packed / 10 % 10;
+    code[3] = '0' + packed % 10;
+}
+
+// Returns the packed Soundex code of name.
+PackedSoundex packedSoundex(std::string_view name);
+
+// Names grouped by packed Soundex code: order lists name indexes sorted by code and then
+// by name, and the names of code c are order[starts[c]] to order[starts[c + 1] - 1].
+struct CodeBuckets {
+    std::vector<uint32_t> starts;   // SOUNDEX_CODE_COUNT + 1 entries
+    std::vector<int> order;
+};
+
+// Groups names[0] to names[count - 1] by packed code, encoding them on up to numThreads
+// threads, or one per core if numThreads is 0.
+CodeBuckets bucketByCode(const std::string_view* names, int count, int numThreads = 0);
+
+// The lines of a file of names, one name per line, read by mapping the file into memory.
+// Each name is a string_view into the mapped bytes, so no name is copied and the views stay
+// valid for as long as the MappedNames does. A '\r' before a line's '\n' is not part of the
+// name, and like readEntireFile an empty last line after the final '\n' is not a name. The
+// lines are found on one thread per core for files big enough to be worth it.
+class MappedNames {
+public:
+    // Maps the file into memory. If the file is missing, this function calls error().
+    MappedNames(std::string filename);
+    ~MappedNames();
+    MappedNames(const MappedNames&) = delete;
+    MappedNames& operator=(const MappedNames&) = delete;
+
+    // Returns the number of names in the file.
+    int size() const;
+
+    // Returns name i.
+    std::string_view operator[](int i) const;
+
+    // Returns the names as one array of size() views.
+    const std::string_view* data() const;
+
+private:
+    const char* bytes;
+    size_t length;
+    std::vector<char> contents;     // the bytes where files cannot be mapped
+    std::vector<std::string_view> names;
+};
+
+// Returns the number of single-letter inserts, deletes and substitutions that turn a into
+// b, ignoring case. Once the distance is sure to be more than limit, limit + 1 is returned.
+int editDistance(std::string_view a, std::string_view b, int limit = 1 << 20);
+
+// Joins two files of names, one name per line, by Soundex code: every pair of a name from
+// leftFile and a name from rightFile with the same code is written to out as the two names
+// separated by a tab, one pair per line. With maxDistance of 0 or more, only pairs within
+// that edit distance of each other are written. Pairs come out sorted by code and then by
+// left name and right name, and are written out in rounds as they are found, so memory
+// stays bounded even when thousands of names on each side share a code.
+// Codes are computed and pairs found on up to numThreads threads, or one per core if
+// numThreads is 0. Returns the number of pairs written.
+long long soundexJoin(std::string leftFile, std::string rightFile, std::ostream& out, int maxDistance = -1,
+                      int numThreads = 0);
+
+// Every name of a database grouped by Soundex code, each group sorted, so the names that
+// sound like a surname take one encode and one lookup to find instead of encoding the whole
+// database again.
+//
+// The groups are stored like a compressed sparse row matrix: the names sit back to back in
+// one char array, sorted by code and then by name, nameStarts[i] is where name i starts and
+// codeStarts[c] is the first name with packed code c, so the names of code c are names
+// codeStarts[c] to codeStarts[c + 1] - 1. All three are flat arrays of fixed-size numbers,
+// so save writes them to a file as they are and the file could be memory-mapped.
+class SoundexIndex {
+public:
+    SoundexIndex(const Vector<std::string>& names);
+
+    // Builds the index from names[0] to names[count - 1], such as the names of a MappedNames.
+    SoundexIndex(const std::string_view* names, int count);
+
+    // Reads an index written by save. If the file is missing or is not a soundex index,
+    // this function calls error(). Numbers are stored in the byte order of the machine
+    // that saved the file.
+    static SoundexIndex load(std::string indexfile);
+
+    // Writes the index to a file that load can read.
+    void save(std::string indexfile) const;
+
+    // Returns the database names with the same Soundex code as name, sorted. A name listed
+    // more than once in the database is returned that many times.
+    Vector<std::string> matchesFor(std::string name) const;
+
+    // Returns the number of database names with the given packed code.
+    int countOf(PackedSoundex code) const;
+
+    // Returns the number of names in the database.
+    int size() const;
+
+private:
+    std::vector<uint32_t> codeStarts;   // SOUNDEX_CODE_COUNT + 1 entries
+    std::vector<uint32_t> nameStarts;   // one per name, plus one past the end
+    std::vector<char> nameChars;
+
+    SoundexIndex() = default;
+};